@@ -21,6 +21,36 @@
 
 string GetVersion();
 
+/*!
+ * \brief Returns the amount of memory held by push message objects
+ *
+ * Each com.intel.cpclient.PushMessage object holds a copy of its message
+ * and the decoded document until it is closed.  The CPClient limits the
+ * memory and the number of objects held for all clients together and for
+ * each client.  When a new object would exceed one of these limits, the
+ * least recently used objects that are not being applied are closed,
+ * starting with those of the caller.  If this does not free enough memory
+ * the new object is not created and the QuotaExceeded error is returned.
+ *
+ * @return A dictionary with the following keys, all of whose values are
+ * unsigned 64 bit integers.  A limit of 0 means that there is no limit.
+ * <dl>
+ * <dt>Bytes</dt><dd>Memory held by all push message objects</dd>
+ * <dt>Objects</dt><dd>Number of push message objects</dd>
+ * <dt>ClientBytes</dt><dd>Memory held by the caller's objects</dd>
+ * <dt>ClientObjects</dt><dd>Number of objects owned by the caller</dd>
+ * <dt>MaxBytes</dt><dd>Limit on Bytes</dd>
+ * <dt>MaxObjects</dt><dd>Limit on Objects</dd>
+ * <dt>MaxClientBytes</dt><dd>Limit on ClientBytes</dd>
+ * <dt>MaxClientObjects</dt><dd>Limit on ClientObjects</dd>
+ * </dl>
+ *
+ * \exception com.intel.cpclient.Error.Died The CPClient was killed before
+ *   the #GetUsage command could be executed.
+*/
+
+dictionary GetUsage();
+
 /*!
  * \brief Creates a com.intel.cpclient.PushMessage object from
  * an OMA CP WAP Push message.
@@ -40,6 +70,13 @@ string GetVersion();
  * merely decodes the message and creates a new object that allows the caller
  * to inspect the message and apply it if he sees fit.
  *
+ * Operators often retransmit the same message several times.  If the caller
+ * has already created an object for a message with the same body and
+ * security parameters, and that object has not yet been closed, the path of
+ * the existing object is returned and the message is not decoded again.  If
+ * such a message has recently been applied, the AlreadyApplied error is
+ * returned instead.
+ *
  * @param message the binary contents of an OMA CP WAP Push message
  *  including the WSP headers.
  * @return the path of the newly created d-Bus object.
@@ -52,10 +89,110 @@ string GetVersion();
  * are not well formed.
  * \exception com.intel.cpclient.Error.IO Unable to register the new object
  * with the session d-Bus.
+ * \exception com.intel.cpclient.Error.QuotaExceeded The new object would
+ * exceed the memory limits and no other objects could be closed to make
+ * room for it.  See #GetUsage.
+ * \exception com.intel.cpclient.Error.AlreadyApplied An identical message
+ * has recently been applied.
 */
 
 path CreatePushMessage(array message);
 
+/*!
+ * \brief Creates a com.intel.cpclient.PushMessage object from an OMA CP WAP
+ * Push message stored in a file.
+ *
+ * This method behaves like #CreatePushMessage but reads the message from a
+ * file descriptor rather than from a byte array, so that large messages need
+ * not be copied through the session bus.  The descriptor must refer to a
+ * regular file or a memfd.  If it is sealed against shrinking, by
+ * F_SEAL_SHRINK, the CPClient maps it directly.  Otherwise its contents are
+ * read from the start of the file.  The CPClient closes its copy of the
+ * descriptor once the message has been decoded.
+ *
+ * @param message a file descriptor containing the binary contents of an OMA
+ * CP WAP Push message including the WSP headers.
+ * @return the path of the newly created d-Bus object.
+ *
+ * \exception com.intel.cpclient.Error.LoadFailed message is not a regular
+ * file or memfd, or cannot be read.
+ * \exception com.intel.cpclient.Error.OOM Not enough memory was available
+ * to process the message.
+ * \exception com.intel.cpclient.Error.ParseError The contents of the message
+ * are not well formed.
+ * \exception com.intel.cpclient.Error.IO Unable to register the new object
+ * with the session d-Bus.
+ * \exception com.intel.cpclient.Error.QuotaExceeded The new object would
+ * exceed the memory limits and no other objects could be closed to make
+ * room for it.  See #GetUsage.
+*/
+
+path CreatePushMessageFd(fd message);
+
+/*!
+ * \brief Creates com.intel.cpclient.PushMessage objects from several
+ * OMA CP WAP Push messages at once.
+ *
+ * This method behaves like #CreatePushMessage but accepts an array of
+ * messages, which are decoded in parallel.  The paths of the new d-Bus
+ * objects are returned in the same order as the messages.  If any one of the
+ * messages cannot be decoded an error is returned and none of the objects
+ * are created.
+ *
+ * @param messages an array of OMA CP WAP Push messages, each of which
+ *  includes its WSP headers.
+ * @return the paths of the newly created d-Bus objects.
+ *
+ * \exception com.intel.cpclient.Error.Died The CPClient was killed before
+ *   the #CreatePushMessages command could be executed.
+ * \exception com.intel.cpclient.Error.OOM Not enough memory was available
+ * to process the messages.
+ * \exception com.intel.cpclient.Error.ParseError The contents of one of the
+ * messages are not well formed.
+ * \exception com.intel.cpclient.Error.IO Unable to register the new objects
+ * with the session d-Bus.
+ * \exception com.intel.cpclient.Error.QuotaExceeded The new objects would
+ * exceed the memory limits.  See #GetUsage.
+*/
+
+array CreatePushMessages(array messages);
+
+/*!
+ * \brief Decodes, authenticates and applies an OMA CP WAP Push message in a
+ * single call.
+ *
+ * This method is equivalent to calling #CreatePushMessage followed by
+ * the GetProps, Apply and Close methods of the new object, but no
+ * com.intel.cpclient.PushMessage object is ever created.  It is intended for
+ * applications that do not need to inspect a message before deciding whether
+ * to apply it.  As no object is created, a message that fails to
+ * authenticate cannot be retried with a different PIN code without being
+ * passed to the CPClient again.
+ *
+ * @param message the binary contents of an OMA CP WAP Push message
+ *  including the WSP headers.
+ * @param pin_code a string containing the pin_code to authenticate the
+ * message, or the empty string if no pin code is required.
+ * @return a dictionary containing the same key/value pairs that are returned
+ * by the GetProps method of the com.intel.cpclient.PushMessage interface.
+ *
+ * \exception com.intel.cpclient.Error.Died The CPClient was killed before
+ *   the #CreateAndApply command could be executed.
+ * \exception com.intel.cpclient.Error.Cancelled The CPClient was killed before
+ *   the #CreateAndApply command could be completed.
+ * \exception com.intel.cpclient.Error.OOM Not enough memory was available
+ * to process the message.
+ * \exception com.intel.cpclient.Error.ParseError The contents of the message
+ * are not well formed.
+ * \exception com.intel.cpclient.Error.IO Unable to communicate with Provman.
+ * \exception com.intel.cpclient.Error.Denied The message could not be
+ * authenticated.
+ * \exception com.intel.cpclient.Error.AlreadyApplied An identical message
+ * has recently been applied.
+*/
+
+dictionary CreateAndApply(array message, string pin_code);
+
 /*!
  * \brief Test function to Parse and apply the contents of an OMA CP XML file.
  *
@@ -80,3 +217,72 @@ path CreatePushMessage(array message);
 */
 
 void ParseCP(string filename);
+
+/*!
+ * \brief Test function to Parse and apply the contents of an OMA CP XML
+ * document passed as a file descriptor.
+ *
+ * This method behaves like #ParseCP but reads the document from a file
+ * descriptor, which must refer to a regular file or a memfd.  The document
+ * is parsed as it is read, so it is never held in memory in its entirety.
+ *
+ * @param fd A file descriptor containing the OMA CP XML document.
+ *
+ * \exception com.intel.cpclient.Error.Died The CPClient was killed before
+ *   the #ParseCPFd command could be executed.
+ * \exception com.intel.cpclient.Error.OOM Not enough memory was available
+ * to process the message.
+ * \exception com.intel.cpclient.Error.ParseError The contents of the message
+ * are not well formed.
+ * \exception com.intel.cpclient.Error.LoadFailed fd is not a regular file
+ * or memfd, or cannot be read.
+*/
+
+void ParseCPFd(fd fd);
+
+/*!
+ * \brief Test function to Parse and apply the contents of several OMA CP XML
+ * files in a single provisioning session.
+ *
+ * This method behaves like #ParseCP called once for each file, except that
+ * the files are parsed in parallel and their settings are merged and
+ * provisioned in a single Provman session per Provman instance.  Where two
+ * files define the same setting, the file that appears later in filenames
+ * takes precedence.  If any of the files cannot be parsed, none of the
+ * settings are applied.
+ *
+ * @param filenames The full paths of the OMA CP XML files to be processed.
+ *
+ * \exception com.intel.cpclient.Error.Died The CPClient was killed before
+ *   the #ParseCPFiles command could be executed.
+ * \exception com.intel.cpclient.Error.OOM Not enough memory was available
+ * to process the files.
+ * \exception com.intel.cpclient.Error.ParseError The contents of one of the
+ * files are not well formed.
+ * \exception com.intel.cpclient.Error.LoadFailed Unable to load one of the
+ * files, or filenames is empty.
+*/
+
+void ParseCPFiles(array filenames);
+
+/*!
+ * \brief Test function to Parse and apply all the OMA CP XML files in a
+ * directory.
+ *
+ * This method behaves like #ParseCPFiles called with the full paths of the
+ * regular files in directory, sorted by name.  Hidden files, whose names
+ * begin with '.', are ignored.  Files whose names sort later take precedence.
+ *
+ * @param directory The full path of the directory to be processed.
+ *
+ * \exception com.intel.cpclient.Error.Died The CPClient was killed before
+ *   the #ParseCPDirectory command could be executed.
+ * \exception com.intel.cpclient.Error.OOM Not enough memory was available
+ * to process the files.
+ * \exception com.intel.cpclient.Error.ParseError The contents of one of the
+ * files are not well formed.
+ * \exception com.intel.cpclient.Error.LoadFailed Unable to open directory, or
+ * it contains no files.
+*/
+
+void ParseCPDirectory(string directory);
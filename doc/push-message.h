@@ -7,6 +7,11 @@
  *
  * All the methods documented below are part of the
  * \a com.intel.cpclient.PushManager interface.
+ *
+ * Push Message objects that are not being applied may be closed by the
+ * CPClient to make room for new ones when its memory limits are reached,
+ * in which case their methods return com.intel.cpclient.Error.NotFound.
+ * See com.intel.cpclient.Manager.GetUsage.
  */
 
 /*!
@@ -51,10 +56,15 @@
  * \exception com.intel.cpclient.Error.IO Unable to communicate with Provman.
  * \exception com.intel.cpclient.Error.Denied The message could not be
  * authenticated or the caller did not create the message.
- * \exception com.intel.cpclient.Error.AlreadyApplied The message has already
- * been applied.
+ * \exception com.intel.cpclient.Error.AlreadyApplied The message, or an
+ * identical copy of it, has already been applied.
  * \exception com.intel.cpclient.Error.NotFound The specified Push Message does
  * not exist
+ * \exception com.intel.cpclient.Error.ParseError The message is well formed
+ * but its settings are inconsistent, for example they refer to an undefined
+ * network access point.  Push Message objects only validate the structure of
+ * the message when they are created.  Its settings are generated the first
+ * time it is successfully authenticated.
 */
 
 void Apply(string pin_code);
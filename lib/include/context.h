@@ -44,6 +44,12 @@
  * also been newly created by Intel, although the comments that preceed them are
  * derived from comments in the original ACCESS file, omadm_cp_parser_prv.h.
  *
+ * All the functions declared in this file are reentrant.  They keep no state
+ * outside of their arguments and may be called concurrently from different
+ * threads, as long as two threads do not operate on the same cpc_context_t
+ * at the same time.  Programs that call cpc_context_new from multiple threads
+ * must call xmlInitParser from their main thread before doing so.
+ *
  *****************************************************************************/
 
 #ifndef CPC_CONTEXT_H__
@@ -77,6 +83,13 @@ typedef enum cpc_provisioned_type_ cpc_provisioned_type;
 
 typedef uint32_t cpc_provisioned_set;
 
+/*
+ * A cpc_provisioned_set containing every type.  Pass this to cpc_context_new
+ * to keep all the applications defined in a document.
+ */
+
+#define CPC_TYPE_ALL ((cpc_provisioned_set) (CPC_TYPE_MAX - 1))
+
 typedef struct cpc_provisioned_set_iter_ cpc_provisioned_set_iter;
 
 struct cpc_provisioned_set_iter_ {
@@ -395,6 +408,12 @@ void cpc_context_delete(cpc_context_t *context);
  *
  * @param prov_data a pointer to an in memory document.
  * @param data_length length in bytes of the in memory XML document
+ * @param mask the types of application the caller is interested in.
+ * APPLICATION characteristics whose APPID maps to a type that is not in mask
+ * are skipped while the document is read, so no memory is spent on them and
+ * they do not appear in the model.  NAPDEF and PXLOGICAL characteristics are
+ * always kept as the remaining applications may refer to them.  Pass
+ * CPC_TYPE_ALL to keep everything.
  * @param context The in memory model is returned via this parameter,
  * if the function succeeds.  The caller needs to delete this model by calling
  * cpc_context_delete when it is finished with it.
@@ -409,7 +428,32 @@ void cpc_context_delete(cpc_context_t *context);
  */
 
 int cpc_context_new(const char *prov_data, int data_length,
-		    cpc_context_t **context);
+		    cpc_provisioned_set mask, cpc_context_t **context);
+
+/*!
+ * @brief Parses an OMA CP XML document read from a file descriptor.
+ *
+ * This function behaves like cpc_context_new but streams the document from
+ * fd in fixed size chunks rather than requiring it to be loaded into memory
+ * first.  Peak memory usage is therefore bounded by the size of the
+ * resulting model rather than by the size of the document plus the model.
+ *
+ * @param fd A descriptor from which the document is read.  If fd is seekable
+ * the document is read from offset 0 without modifying the file offset.
+ * fd is not closed.
+ * @param mask the types of application to keep, as for cpc_context_new.
+ * @param context The in memory model is returned via this parameter,
+ * if the function succeeds.  The caller needs to delete this model by calling
+ * cpc_context_delete when it is finished with it.
+ *
+ * @return CPC_ERR_NONE The document was correctly parsed.
+ * @return CPC_ERR_OOM The document could not be parsed correctly due to
+ * an OOM.
+ * @return CPC_ERR_CORRUPT The document is corrupt or could not be read.
+ */
+
+int cpc_context_new_from_fd(int fd, cpc_provisioned_set mask,
+			    cpc_context_t **context);
 
 /*!
  * @brief Initialises an iterator for the cpc_provisioned_set computed by
@@ -455,6 +499,35 @@ int cpc_context_analyse(cpc_context_t *context,
 			cpc_provisioned_set *set,
 			cpc_ptr_array_t **start_sessions);
 
+/*!
+ * @brief Parses an OMA CP XML document and identifies the settings it
+ * contains without building an in memory model.
+ *
+ * The results are the same as those obtained by calling cpc_context_new
+ * followed by cpc_context_analyse, but the document is only parsed and
+ * validated.  It is not mapped onto the cpc_context_t object model, which is
+ * considerably cheaper.  Errors that would only be detected while mapping
+ * the document, for example references to undefined NAPDEFs, are not
+ * reported.
+ *
+ * @param prov_data a pointer to the XML document
+ * @param data_length the length in bytes of prov_data
+ * @param mask the types of application to consider, as for cpc_context_new.
+ * @param set a BitSet that contains the types of settings stored in
+ * the document.
+ * @param start_sessions a cpc_ptr_array_t of DM server identifiers.  Needs
+ * to be deleted with cpc_ptr_array_free followed by free.
+ *
+ * @return CPC_ERR_NONE The document was correctly analysed
+ * @return CPC_ERR_OOM The document could not be analysed correctly due to
+ * an OOM.
+ * @return CPC_ERR_CORRUPT The document is corrupt.
+ */
+
+int cpc_context_summarise(const char *prov_data, int data_length,
+			  cpc_provisioned_set mask, cpc_provisioned_set *set,
+			  cpc_ptr_array_t **start_sessions);
+
 
 #ifdef __cplusplus
 }
@@ -45,7 +45,8 @@ enum cpc_generic_errors
 	CPC_ERR_DIED,
 	CPC_ERR_TOO_LARGE,
 	CPC_ERR_IN_PROGRESS,
-	CPC_ERR_ALREADY_APPLIED
+	CPC_ERR_ALREADY_APPLIED,
+	CPC_ERR_QUOTA
 };
 
 #endif
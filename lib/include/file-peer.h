@@ -31,14 +31,43 @@
 #define CPC_FILE_PEER_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+typedef struct cpc_file_map_t_ cpc_file_map_t;
+struct cpc_file_map_t_ {
+	uint8_t *data;
+	size_t length;
+	bool mapped;
+};
+
 int cpc_file_get_binary(const char *path, size_t *file_len, uint8_t **data_buf);
 
+/*
+ * Maps the contents of fd read-only into memory.  If fd cannot be mapped,
+ * e.g., it is a pipe, its contents are read into a heap buffer instead.  If
+ * sealed_only is true, fd is only mapped if it has been sealed against
+ * shrinking, so that a peer cannot truncate it while the mapping is in use.
+ * fd is not closed.  The data must be released with cpc_file_unmap.
+ */
+
+int cpc_file_map_fd(int fd, bool sealed_only, cpc_file_map_t *map);
+
+/*
+ * Maps the file at path read-only, falling back to reading it if it is not a
+ * regular file.  Files that do not belong to the effective user of the process
+ * are only mapped if they have been sealed against shrinking, and are read
+ * otherwise.  The caller must not modify the file while it is mapped.
+ */
+
+int cpc_file_map(const char *path, cpc_file_map_t *map);
+void cpc_file_unmap(cpc_file_map_t *map);
+
 #ifdef __cplusplus
 }
 #endif
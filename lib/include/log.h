@@ -25,6 +25,10 @@
  *
  * @brief Macros and functions for logging
  *
+ * Once the log has been opened, the logging functions may be called from
+ * any thread.  Each call is written to the log file atomically.  The log
+ * must not be opened or closed while other threads are logging.
+ *
  ******************************************************************************/
 
 #ifndef CPC_LOG_H
@@ -31,6 +31,11 @@
  * This file is based on the original ACCESS file, omadm_cp_push_handler_prv.h.
  * Identifiers have been renamed to adhere to the cpclient coding guidelines.
  *
+ * cpc_wp_new and cpc_get_prov_doc are reentrant and may be called
+ * concurrently on different cpc_wp_t objects.  Whether cpc_authenticate is
+ * reentrant depends on the HMAC backend selected at configure time.  gnutls
+ * versions older than 3.3 do not support concurrent initialisation.
+ *
  ******************************************************************************/
 
 #ifndef CPC_WP_H
@@ -56,6 +61,22 @@ typedef struct cpc_wp_t_ cpc_wp_t;
 int cpc_wp_new(const uint8_t *data, size_t length, cpc_wp_t **context);
 void cpc_wp_delete(cpc_wp_t *context);
 cpc_sec_t cpc_wp_security(cpc_wp_t *context);
+
+/*
+ * Return the MAC parameter of the message, or NULL if there is none, and the
+ * still WBXML encoded body of the message.  Both point into context.
+ */
+
+const char *cpc_wp_mac(const cpc_wp_t *context);
+const uint8_t *cpc_wp_body(const cpc_wp_t *context, size_t *length);
+
+/*
+ * Releases the WSP headers of the message, keeping only the MAC and the body
+ * needed by cpc_authenticate and cpc_get_prov_doc.  Pointers previously
+ * returned by cpc_wp_mac and cpc_wp_body are invalidated.
+ */
+
+int cpc_wp_compact(cpc_wp_t *context);
 int cpc_authenticate(const cpc_wp_t *context, const char *imsi,
 		     const char *pin);
 int cpc_get_prov_doc(const cpc_wp_t *context, char **xml,
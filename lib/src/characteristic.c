@@ -47,7 +47,11 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <limits.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include "error.h"
 #include "error-macros.h"
@@ -55,6 +59,44 @@
 
 #include "characteristic.h"
 
+typedef struct cpc_fd_input_t_ cpc_fd_input_t;
+struct cpc_fd_input_t_ {
+	int fd;
+	off_t offset;
+};
+
+/*
+ * The characteristics of each type found at the root of a document, in
+ * document order.  The lists are built as the characteristics are parsed
+ * and validated and are used to drive the global checks.  Deleting an
+ * entry marks the characteristic as deleted rather than freeing it.
+ */
+
+typedef struct cpc_root_index_t_ cpc_root_index_t;
+struct cpc_root_index_t_ {
+	cpc_ptr_array_t chars[CPC_CT_MAX];
+};
+
+/*
+ * A characteristic tree that has been frozen by cpc_characteristic_freeze.
+ * The nodes are stored in nodes, with the children of each node adjacent
+ * to one another.  The pointer arrays and the parameters follow the nodes
+ * in the same allocation.  The root keeps the string pool of the document.
+ */
+
+typedef struct cpc_frozen_char_t_ cpc_frozen_char_t;
+struct cpc_frozen_char_t_ {
+	unsigned int node_count;
+	cpc_characteristic_t nodes[];
+};
+
+typedef struct cpc_freezer_t_ cpc_freezer_t;
+struct cpc_freezer_t_ {
+	cpc_characteristic_t *nodes;
+	void **pointers;
+	cpc_parameter_t *params;
+};
+
 typedef struct cpc_char_string_map_t_ cpc_char_string_map_t;
 struct cpc_char_string_map_t_ {
 	cpc_characteristic_type_t type;
@@ -682,17 +724,23 @@ static const int g_cpc_normal_element = 1;
 static const int g_cpc_end_element = 15;
 static const unsigned int g_cpc_current_major_version = 1;
 
-static const xmlChar *g_supported_applications[] = {
-	(const xmlChar *)"25",	        /* SMTP */
-	(const xmlChar *)"110",         /* POP3 */
-	(const xmlChar *)"143",         /* IMAP4 */
-	(const xmlChar *)"w2",	        /* Browser */
-	(const xmlChar *)"w4",	        /* MMS 1.2 */
-	(const xmlChar *)"w5",	        /* OMA DS */
-	(const xmlChar *)"w7",	        /* OMA DM */
-	(const xmlChar *)"wA",	        /* IMPS */
-	(const xmlChar *)"DL",	        /* OMA DL */
-	(const xmlChar *)"ap0004",	/* SUPL */
+typedef struct cpc_app_type_map_t_ cpc_app_type_map_t;
+struct cpc_app_type_map_t_ {
+	const xmlChar *appid;
+	cpc_provisioned_type type;
+};
+
+static const cpc_app_type_map_t g_supported_applications[] = {
+	{(const xmlChar *)"25", CPC_TYPE_EMAIL},	/* SMTP */
+	{(const xmlChar *)"110", CPC_TYPE_EMAIL},	/* POP3 */
+	{(const xmlChar *)"143", CPC_TYPE_EMAIL},	/* IMAP4 */
+	{(const xmlChar *)"w2", CPC_TYPE_BROWSER},	/* Browser */
+	{(const xmlChar *)"w4", CPC_TYPE_MMS},		/* MMS 1.2 */
+	{(const xmlChar *)"w5", CPC_TYPE_OMADS},	/* OMA DS */
+	{(const xmlChar *)"w7", CPC_TYPE_OMADM},	/* OMA DM */
+	{(const xmlChar *)"wA", CPC_TYPE_IMPS},		/* IMPS */
+	{(const xmlChar *)"DL", CPC_TYPE_OMADL},	/* OMA DL */
+	{(const xmlChar *)"ap0004", CPC_TYPE_SUPL},	/* SUPL */
 };
 
 typedef int(*cpc_char_merge_fn_t)(cpc_characteristic_t *,
@@ -724,16 +772,38 @@ static int prv_find_valid_params(const void *argv1, const void *argv2)
 
 static void prv_parameter_free(void *param)
 {
-	cpc_parameter_t *obj = (cpc_parameter_t *) param;
+	free(param);
+}
 
-	if (obj) {
-		if (obj->data_type == CPC_WPDT_UTF8 && obj->utf8_value)
-			xmlFree(obj->utf8_value);
+/*
+ * Values short enough to fit in utf8_inline are copied there.  Longer
+ * values are interned in strings, the pool of the document.
+ */
 
-		free(obj);
-	}
+static int prv_parameter_set_utf8(cpc_parameter_t *param,
+				  xmlDictPtr strings, const xmlChar *value)
+{
+	CPC_ERR_MANAGE;
+	int len = xmlStrlen(value);
+
+	param->utf8_is_inline = len < CPC_PARAM_INLINE_SIZE;
+	if (param->utf8_is_inline)
+		memcpy(param->utf8_inline, value, len + 1);
+	else
+		CPC_FAIL_NULL(param->utf8_shared,
+				   xmlDictLookup(strings, value, len),
+				   CPC_ERR_OOM);
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
 }
 
+/*
+ * Parameters do not own their interned values, so a copy can simply share
+ * them.
+ */
+
 static int prv_parameter_dup(cpc_parameter_t *param,
 			     cpc_parameter_t **param_dup)
 {
@@ -742,28 +812,11 @@ static int prv_parameter_dup(cpc_parameter_t *param,
 
 	CPC_FAIL_NULL(retval, malloc(sizeof(*param)), CPC_ERR_OOM);
 
-	if (param->data_type == CPC_WPDT_UTF8 ||
-	    param->data_type == CPC_WPDT_UTF8OPT) {
-		if (param->utf8_value)
-			CPC_FAIL_NULL(retval->utf8_value,
-					   xmlStrdup(param->utf8_value),
-					   CPC_ERR_OOM);
-		else
-			retval->utf8_value = NULL;
-	} else
-		retval->int_value = param->int_value;
-
-	retval->type = param->type;
-	retval->data_type = param->data_type;
-	retval->transient = param->transient;
+	*retval = *param;
 	*param_dup = retval;
 
-	return CPC_ERR_NONE;
-
 CPC_ON_ERR:
 
-	free(retval);
-
 	return CPC_ERR;
 }
 
@@ -774,6 +827,10 @@ static void prv_wap_char_free(void *characteristic)
 	if (obj) {
 		cpc_ptr_array_free(&obj->parameters);
 		cpc_ptr_array_free(&obj->characteristics);
+		free(obj->param_index);
+		free(obj->char_index);
+		if (obj->strings)
+			xmlDictFree(obj->strings);
 		free(obj);
 	}
 }
@@ -782,10 +839,63 @@ static void prv_characteristic_make(cpc_characteristic_t *characteristic,
 				    cpc_characteristic_type_t type)
 {
 	characteristic->type = type;
+	characteristic->deleted = false;
+	characteristic->frozen = false;
 	cpc_ptr_array_make(&characteristic->parameters, 8,
 				    prv_parameter_free);
 	cpc_ptr_array_make(&characteristic->characteristics, 4,
 				    prv_wap_char_free);
+	characteristic->param_index = NULL;
+	characteristic->char_index = NULL;
+	characteristic->strings = NULL;
+}
+
+/*
+ * All changes to the parameters or children of a characteristic need to
+ * go through the functions below so that the indices used by
+ * cpc_find_param and cpc_find_char are discarded.
+ */
+
+static void prv_param_index_reset(cpc_characteristic_t *characteristic)
+{
+	free(characteristic->param_index);
+	characteristic->param_index = NULL;
+}
+
+static void prv_char_index_reset(cpc_characteristic_t *characteristic)
+{
+	free(characteristic->char_index);
+	characteristic->char_index = NULL;
+}
+
+static int prv_append_param(cpc_characteristic_t *characteristic,
+			    cpc_parameter_t *param)
+{
+	prv_param_index_reset(characteristic);
+
+	return cpc_ptr_array_append(&characteristic->parameters, param);
+}
+
+static void prv_delete_param(cpc_characteristic_t *characteristic,
+			     unsigned int index)
+{
+	prv_param_index_reset(characteristic);
+	cpc_ptr_array_delete(&characteristic->parameters, index);
+}
+
+static int prv_append_char(cpc_characteristic_t *characteristic,
+			   cpc_characteristic_t *child)
+{
+	prv_char_index_reset(characteristic);
+
+	return cpc_ptr_array_append(&characteristic->characteristics, child);
+}
+
+static void prv_delete_char(cpc_characteristic_t *characteristic,
+			    unsigned int index)
+{
+	prv_char_index_reset(characteristic);
+	cpc_ptr_array_delete(&characteristic->characteristics, index);
 }
 
 static int prv_characteristic_dup(cpc_characteristic_t *characteristic,
@@ -807,8 +917,7 @@ static int prv_characteristic_dup(cpc_characteristic_t *characteristic,
 				      cpc_get_param(characteristic, i),
 				      &param));
 
-		CPC_FAIL(cpc_ptr_array_append(&retval->parameters,
-							    param));
+		CPC_FAIL(prv_append_param(retval, param));
 		param = NULL;
 	}
 
@@ -816,8 +925,7 @@ static int prv_characteristic_dup(cpc_characteristic_t *characteristic,
 		CPC_FAIL(prv_characteristic_dup(cpc_get_char
 							   (characteristic, i),
 							   &new_char));
-		CPC_FAIL(cpc_ptr_array_append(&retval->characteristics,
-							    new_char));
+		CPC_FAIL(prv_append_char(retval, new_char));
 		new_char = NULL;
 	}
 
@@ -862,6 +970,87 @@ static bool prv_find_param_occurrence(cpc_characteristic_type_t characteristic,
 	return retval;
 }
 
+/*
+ * xmlLastError is shared by all the parsers running in a thread and may
+ * hold an error from an unrelated document, so we never consult it.
+ * Errors raised while reading a document are recorded in a cpc_xml_error_t
+ * owned by the call to prv_parse_characteristic instead.
+ */
+
+typedef struct cpc_xml_error_t_ cpc_xml_error_t;
+struct cpc_xml_error_t_ {
+	int code;
+};
+
+#if LIBXML_VERSION >= 21200
+static void prv_xml_error(void *user_data, const xmlError *error)
+#else
+static void prv_xml_error(void *user_data, xmlErrorPtr error)
+#endif
+{
+	cpc_xml_error_t *xml_error = user_data;
+
+	CPC_LOGF("XML error %d at line %d", error->code, error->line);
+
+	if (xml_error->code != XML_ERR_NO_MEMORY)
+		xml_error->code = error->code;
+}
+
+/*
+ * xmlTextReaderGetAttribute returns NULL both when the attribute is missing
+ * and when it cannot be allocated.  Only the latter is an error.
+ */
+
+static int prv_get_attribute(xmlTextReaderPtr reader_ptr, const char *name,
+			     xmlChar **value)
+{
+	CPC_ERR_MANAGE;
+	int present;
+
+	*value = xmlTextReaderGetAttribute(reader_ptr, (const xmlChar *) name);
+	if (!*value) {
+		present = xmlTextReaderMoveToAttribute(reader_ptr,
+						       (const xmlChar *) name);
+		if (present != 0) {
+			CPC_LOGF("Unable to read attribute %s", name);
+			CPC_ERR = CPC_ERR_OOM;
+		}
+		if (present == 1)
+			(void) xmlTextReaderMoveToElement(reader_ptr);
+	}
+
+	return CPC_ERR;
+}
+
+/*
+ * Like prv_get_attribute but returns a pointer owned by the reader rather
+ * than a copy.  The value is only valid until the reader next moves or
+ * returns another value, so callers must finish with one attribute before
+ * asking for the next.
+ */
+
+static int prv_get_const_attribute(xmlTextReaderPtr reader_ptr,
+				   const char *name, const xmlChar **value)
+{
+	CPC_ERR_MANAGE;
+	int present;
+
+	*value = NULL;
+	present = xmlTextReaderMoveToAttribute(reader_ptr,
+					       (const xmlChar *) name);
+	if (present == 1) {
+		*value = xmlTextReaderConstValue(reader_ptr);
+		(void) xmlTextReaderMoveToElement(reader_ptr);
+	}
+
+	if (present == -1 || (present == 1 && !*value)) {
+		CPC_LOGF("Unable to read attribute %s", name);
+		CPC_ERR = CPC_ERR_OOM;
+	}
+
+	return CPC_ERR;
+}
+
 static int prv_check_root_node(xmlTextReaderPtr reader_ptr)
 {
 	CPC_ERR_MANAGE;
@@ -873,9 +1062,8 @@ static int prv_check_root_node(xmlTextReaderPtr reader_ptr)
 			   CPC_ERR_CORRUPT);
 
 	if (xmlStrEqual((const xmlChar *)"wap-provisioningdoc", name)) {
-		version_att = xmlTextReaderGetAttribute(reader_ptr,
-							(const xmlChar *)
-							"version");
+		CPC_FAIL(prv_get_attribute(reader_ptr, "version",
+					   &version_att));
 		if (version_att) {
 			if ((unsigned int) strtod((char *)version_att, &end) !=
 			    g_cpc_current_major_version) {
@@ -884,8 +1072,6 @@ static int prv_check_root_node(xmlTextReaderPtr reader_ptr)
 				CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 			}
 		}
-		else if (xmlLastError.code == XML_ERR_NO_MEMORY)
-			CPC_FAIL_FORCE(CPC_ERR_OOM);
 	}
 
 CPC_ON_ERR:
@@ -916,11 +1102,10 @@ static int prv_process_characteristic(xmlTextReaderPtr reader_ptr,
 	cpc_characteristic_t *new_char = NULL;
 	xmlChar *type;
 
-	type = xmlTextReaderGetAttribute(reader_ptr, (const xmlChar *)"type");
+	CPC_FAIL(prv_get_attribute(reader_ptr, "type", &type));
 	if (!type) {
 		CPC_LOGF("Unable to read characteristic type");
-		CPC_FAIL_FORCE(xmlLastError.code == XML_ERR_NO_MEMORY ?
-				CPC_ERR_OOM : CPC_ERR_NONE);
+		goto CPC_ON_ERR;
 	}
 
 	char_key.string = (const char *)type;
@@ -961,8 +1146,7 @@ static int prv_process_characteristic(xmlTextReaderPtr reader_ptr,
 
 	prv_characteristic_make(new_char, char_found->type);
 
-	CPC_FAIL(cpc_ptr_array_append(&characteristic->characteristics,
-				      new_char));
+	CPC_FAIL(prv_append_char(characteristic, new_char));
 
 	new_char = NULL;
 
@@ -978,7 +1162,8 @@ CPC_ON_ERR:
 
 static int prv_add_param(xmlTextReaderPtr reader_ptr,
 			 cpc_characteristic_t *characteristic,
-			 cpc_valid_param_t *valid_param, xmlChar **value)
+			 cpc_valid_param_t *valid_param, xmlDictPtr strings,
+			 const xmlChar *value)
 {
 	CPC_ERR_MANAGE;
 	cpc_param_data_type_t dt = valid_param->data_type;
@@ -988,16 +1173,18 @@ static int prv_add_param(xmlTextReaderPtr reader_ptr,
 	CPC_FAIL_NULL(param, malloc(sizeof(*param)), CPC_ERR_OOM);
 
 	param->transient = false;
+	param->utf8_is_inline = false;
+	param->data_type = CPC_WPDT_NONE;
 	if (dt == CPC_WPDT_UINT || dt == CPC_WPDT_UINTHEX) {
-		if (!*value) {
+		if (!value) {
 			CPC_LOGF("Invalid paramater value %d",
 				      valid_param->type);
 			goto CPC_ON_ERR;
 		}
 
-		param->int_value = strtoul((char *)*value, &ptr,
+		param->int_value = strtoul((const char *) value, &ptr,
 					   dt == CPC_WPDT_UINT ? 10 : 16);
-		if ((param->int_value == 0 && ptr == (char *) *value)
+		if ((param->int_value == 0 && ptr == (const char *) value)
 		    || param->int_value > UINT_MAX) {
 			CPC_LOGF("Invalid paramater value %d",
 				      valid_param->type);
@@ -1006,28 +1193,20 @@ static int prv_add_param(xmlTextReaderPtr reader_ptr,
 
 		param->data_type = CPC_WPDT_UINT;
 	} else if (dt == CPC_WPDT_UTF8 || dt == CPC_WPDT_UTF8OPT) {
-		if (!*value) {
-			if (dt == CPC_WPDT_UTF8OPT)
-				param->data_type = CPC_WPDT_NONE;
-			else {
-				CPC_LOGF("Invalid paramater value %d",
-					      valid_param->type);
-				goto CPC_ON_ERR;
-			}
-		} else {
+		if (value) {
+			CPC_FAIL(prv_parameter_set_utf8(param, strings,
+							value));
 			param->data_type = CPC_WPDT_UTF8;
-			param->utf8_value = *value;
-
-			/* So it doesen't get deleted by caller */
-
-			*value = NULL;
+		} else if (dt != CPC_WPDT_UTF8OPT) {
+			CPC_LOGF("Invalid paramater value %d",
+				      valid_param->type);
+			goto CPC_ON_ERR;
 		}
-	} else
-		param->data_type = CPC_WPDT_NONE;
+	}
 
 	param->type = valid_param->type;
 
-	CPC_FAIL(cpc_ptr_array_append(&characteristic->parameters, param));
+	CPC_FAIL(prv_append_param(characteristic, param));
 
 	param = NULL;
 
@@ -1038,11 +1217,30 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
+static bool prv_app_wanted(const xmlChar *appid, cpc_provisioned_set mask)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(g_supported_applications) /
+		     sizeof(cpc_app_type_map_t); ++i)
+		if (xmlStrEqual(appid, g_supported_applications[i].appid))
+			return (mask & g_supported_applications[i].type) != 0;
+
+	/*
+	 * Unknown applications are left for
+	 * prv_validate_application_characteristic to reject.
+	 */
+
+	return true;
+}
+
 static int prv_process_param(xmlTextReaderPtr reader_ptr,
-			     cpc_characteristic_t *characteristic)
+			     cpc_characteristic_t *characteristic,
+			     xmlDictPtr strings, cpc_provisioned_set mask,
+			     bool *filtered)
 {
 	CPC_ERR_MANAGE;
-	xmlChar *value = NULL;
+	const xmlChar *value = NULL;
 	cpc_param_string_map_t param_key;
 	cpc_param_string_map_t *param_found = NULL;
 	cpc_valid_param_t valid_param_key;
@@ -1051,19 +1249,18 @@ static int prv_process_param(xmlTextReaderPtr reader_ptr,
 	unsigned int i = 0;
 	unsigned int param_count;
 	cpc_param_occurrence_t occurence;
-	xmlChar *name =
-		xmlTextReaderGetAttribute(reader_ptr, (const xmlChar *) "name");
+	const xmlChar *name = NULL;
 
+	/*
+	 * The attributes are read in place to avoid copying every name and
+	 * value in the document.  name is only used to find the parameter
+	 * type and must not be used once value has been read.
+	 */
+
+	CPC_FAIL(prv_get_const_attribute(reader_ptr, "name", &name));
 	if (!name) {
 		CPC_LOGF("Unable to read parameter name");
-		CPC_FAIL_FORCE((xmlLastError.code == XML_ERR_NO_MEMORY) ?
-					CPC_ERR_OOM : CPC_ERR_NONE);
-	}
-
-	value = xmlTextReaderGetAttribute(reader_ptr, (const xmlChar *)"value");
-	if (!value && xmlLastError.code == XML_ERR_NO_MEMORY) {
-		CPC_LOGF("Unable to read parameter value");
-		CPC_FAIL_FORCE(CPC_ERR_OOM);
+		goto CPC_ON_ERR;
 	}
 
 	param_key.string = (const char *) name;
@@ -1079,6 +1276,8 @@ static int prv_process_param(xmlTextReaderPtr reader_ptr,
 
 	valid_param_key.type = param_found->type;
 
+	CPC_FAIL(prv_get_const_attribute(reader_ptr, "value", &value));
+
 	char_param_map = &g_char_allowed_params[characteristic->type];
 
 	valid_param_found = bsearch(&valid_param_key, char_param_map->params,
@@ -1087,8 +1286,8 @@ static int prv_process_param(xmlTextReaderPtr reader_ptr,
 				    prv_find_valid_params);
 
 	if (!valid_param_found) {
-		CPC_LOGF("parameter %s not valid param %d\n", name,
-			      valid_param_key.type);
+		CPC_LOGF("parameter %s not valid param %d\n",
+			      param_found->string, valid_param_key.type);
 		goto CPC_ON_ERR;
 	}
 
@@ -1101,35 +1300,125 @@ static int prv_process_param(xmlTextReaderPtr reader_ptr,
 			     valid_param_found->type; ++i);
 
 		if (i != param_count) {
-			CPC_LOGF("Ignorning duplicate param %s", name);
+			CPC_LOGF("Ignorning duplicate param %s",
+				      param_found->string);
 			goto CPC_ON_ERR;
 		}
 	}
 
+	if (characteristic->type == CPC_CT_APPLICATION &&
+	    valid_param_found->type == CPC_PT_APPID && value &&
+	    !prv_app_wanted(value, mask)) {
+		CPC_LOGF("Skipping filtered application %s", value);
+		*filtered = true;
+		goto CPC_ON_ERR;
+	}
+
 	CPC_FAIL(prv_add_param(reader_ptr, characteristic, valid_param_found,
-				    &value));
+				    strings, value));
 
 CPC_ON_ERR:
 
-	if (value)
-		xmlFree(value);
+	return CPC_ERR;
+}
+
+static int prv_validate_non_root_char(cpc_characteristic_t *characteristic);
+
+static void prv_mark_deleted(void *characteristic)
+{
+	((cpc_characteristic_t *) characteristic)->deleted = true;
+}
+
+static void prv_root_index_make(cpc_root_index_t *index)
+{
+	unsigned int i;
+
+	for (i = 0; i < CPC_CT_MAX; ++i)
+		cpc_ptr_array_make(&index->chars[i], 4, prv_mark_deleted);
+}
+
+static void prv_root_index_free(cpc_root_index_t *index)
+{
+	unsigned int i;
+
+	/*
+	 * The lists do not own the characteristics.  Make sure that
+	 * freeing them does not mark the survivors as deleted.
+	 */
+
+	for (i = 0; i < CPC_CT_MAX; ++i) {
+		index->chars[i].destructor = NULL;
+		cpc_ptr_array_free(&index->chars[i]);
+	}
+}
+
+/*
+ * Called when the characteristic at the top of the stack is closed.  All
+ * of its children have been closed, and so validated, already, which
+ * means that the characteristic can be validated straight away, without a
+ * separate pass over the tree once the document has been read.  Invalid
+ * characteristics are removed from their parents.  Valid characteristics
+ * that are children of the root are added to index.
+ */
+
+static int prv_close_characteristic(cpc_ptr_array_t *characteristic_stack,
+				    int depth, int *depth_of_current_char,
+				    cpc_root_index_t *index)
+{
+	CPC_ERR_MANAGE;
+	cpc_characteristic_t *closed;
+	cpc_characteristic_t *parent;
+	unsigned int stack_size;
+
+	stack_size = cpc_ptr_array_get_size(characteristic_stack);
+	closed = cpc_ptr_array_get(characteristic_stack, stack_size - 1);
+
+	cpc_ptr_array_delete(characteristic_stack, stack_size - 1);
 
-	if (name)
-		xmlFree(name);
+	--stack_size;
+
+	if (stack_size == 0)
+		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
+
+	parent = cpc_ptr_array_get(characteristic_stack, stack_size - 1);
+
+	if (closed) {
+		CPC_ERR = prv_validate_non_root_char(closed);
+		if (CPC_ERR == CPC_ERR_CORRUPT) {
+			prv_delete_char(parent,
+					cpc_get_char_count(parent) - 1);
+			CPC_ERR = CPC_ERR_NONE;
+		} else if (CPC_ERR != CPC_ERR_NONE) {
+			goto CPC_ON_ERR;
+		} else if (stack_size == 1) {
+			CPC_FAIL(cpc_ptr_array_append(
+					 &index->chars[closed->type], closed));
+		}
+	}
+
+	if (parent)
+		*depth_of_current_char = depth - 1;
+
+CPC_ON_ERR:
 
 	return CPC_ERR;
 }
 
 static int prv_process_normal_element(xmlTextReaderPtr reader_ptr,
 				      cpc_ptr_array_t *characteristic_stack,
-				      int depth, int *depth_of_current_char)
+				      int depth, int *depth_of_current_char,
+				      cpc_provisioned_set mask,
+				      cpc_root_index_t *index)
 {
 	CPC_ERR_MANAGE;
 	const xmlChar *name = NULL;
 	cpc_characteristic_t *current_char = NULL;
+	cpc_characteristic_t *parent;
+	cpc_characteristic_t *root;
 	unsigned int stack_size;
 	int old_last_char_index = -1;
 	int last_char_index = -1;
+	bool filtered = false;
 
 	CPC_FAIL_NULL(name, xmlTextReaderConstName(reader_ptr), CPC_ERR_OOM);
 
@@ -1167,6 +1456,17 @@ static int prv_process_normal_element(xmlTextReaderPtr reader_ptr,
 
 		CPC_FAIL(cpc_ptr_array_append(characteristic_stack,
 					      current_char));
+
+		/*
+		 * The reader does not report the end of empty elements so
+		 * we need to close them here.
+		 */
+
+		if (xmlTextReaderIsEmptyElement(reader_ptr))
+			CPC_FAIL(prv_close_characteristic(characteristic_stack,
+							  depth,
+							  depth_of_current_char,
+							  index));
 	} else if (xmlStrcmp((const xmlChar *)"parm", name) == 0) {
 
 		/*
@@ -1174,8 +1474,29 @@ static int prv_process_normal_element(xmlTextReaderPtr reader_ptr,
 		 * within parameters.
 		 */
 
-		if (current_char && *depth_of_current_char + 1 == depth)
-			CPC_FAIL(prv_process_param(reader_ptr, current_char));
+		if (current_char && *depth_of_current_char + 1 == depth) {
+			root = cpc_ptr_array_get(characteristic_stack, 0);
+			CPC_FAIL(prv_process_param(reader_ptr, current_char,
+						   root->strings, mask,
+						   &filtered));
+		}
+
+		/*
+		 * The application is not wanted.  Throw away what we have
+		 * built of it so far, which is usually nothing but the
+		 * characteristic itself as APPID tends to come first, and
+		 * replace it on the stack with NULL so that the rest of its
+		 * subtree is skipped without being allocated.
+		 */
+
+		if (filtered) {
+			parent = cpc_ptr_array_get(characteristic_stack,
+						   stack_size - 2);
+			prv_delete_char(parent,
+					cpc_get_char_count(parent) - 1);
+			cpc_ptr_array_get(characteristic_stack,
+					  stack_size - 1) = NULL;
+		}
 	} else {
 
 		/* We have encountered a node that we don't recognise.
@@ -1200,27 +1521,18 @@ CPC_ON_ERR:
 
 static int prv_process_end_element(xmlTextReaderPtr reader_ptr,
 				   cpc_ptr_array_t *characteristic_stack,
-				   int depth, int *depth_of_current_char)
+				   int depth, int *depth_of_current_char,
+				   cpc_root_index_t *index)
 {
 	CPC_ERR_MANAGE;
 	const xmlChar *name = NULL;
-	unsigned int stack_size;
 
 	CPC_FAIL_NULL(name, xmlTextReaderConstName(reader_ptr), CPC_ERR_OOM);
 
-	if (depth > 0 && xmlStrcmp((const xmlChar *)"parm", name) != 0) {
-		stack_size = cpc_ptr_array_get_size(characteristic_stack);
-
-		cpc_ptr_array_delete(characteristic_stack, stack_size - 1);
-
-		--stack_size;
-
-		if (stack_size == 0)
-			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
-
-		if (cpc_ptr_array_get(characteristic_stack, stack_size - 1))
-			--*depth_of_current_char;
-	}
+	if (depth > 0 && xmlStrcmp((const xmlChar *)"parm", name) != 0)
+		CPC_FAIL(prv_close_characteristic(characteristic_stack, depth,
+						  depth_of_current_char,
+						  index));
 
 CPC_ON_ERR:
 
@@ -1229,7 +1541,9 @@ CPC_ON_ERR:
 
 static int prv_process_node(xmlTextReaderPtr reader_ptr,
 			    cpc_ptr_array_t *characteristic_stack,
-			    int *depth_of_current_char)
+			    int *depth_of_current_char,
+			    cpc_provisioned_set mask,
+			    cpc_root_index_t *index)
 {
 	CPC_ERR_MANAGE;
 	int depth = 0;
@@ -1249,11 +1563,13 @@ static int prv_process_node(xmlTextReaderPtr reader_ptr,
 	} else if (type == g_cpc_normal_element) {
 		CPC_FAIL(prv_process_normal_element(reader_ptr,
 						  characteristic_stack, depth,
-						  depth_of_current_char));
+						  depth_of_current_char,
+						  mask, index));
 	} else if (type == g_cpc_end_element) {
 		CPC_FAIL(prv_process_end_element(reader_ptr,
 						characteristic_stack, depth,
-						depth_of_current_char));
+						depth_of_current_char,
+						index));
 	}
 
 CPC_ON_ERR:
@@ -1261,12 +1577,94 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
+static unsigned int prv_param_type_of(const void *param)
+{
+	return ((const cpc_parameter_t *) param)->type;
+}
+
+static unsigned int prv_char_type_of(const void *characteristic)
+{
+	return ((const cpc_characteristic_t *) characteristic)->type;
+}
+
+/*
+ * Builds an index of the elements of array by type.  The first type_count
+ * entries hold the position of the first element of each type.  They are
+ * followed by one entry per element, holding the position of the next
+ * element of the same type.  -1 terminates each chain.  NULL is returned if
+ * the index cannot be allocated, in which case callers fall back to a
+ * linear search.
+ */
+
+static int16_t *prv_index_make(cpc_ptr_array_t *array,
+			       unsigned int type_count,
+			       unsigned int (*type_of)(const void *))
+{
+	int16_t *index;
+	unsigned int size = cpc_ptr_array_get_size(array);
+	unsigned int type;
+	unsigned int i;
+
+	if (size > INT16_MAX)
+		return NULL;
+
+	index = malloc((type_count + size) * sizeof(*index));
+	if (!index)
+		return NULL;
+
+	for (i = 0; i < type_count; ++i)
+		index[i] = -1;
+
+	for (i = size; i > 0; --i) {
+		type = type_of(cpc_ptr_array_get(array, i - 1));
+		index[type_count + i - 1] = index[type];
+		index[type] = i - 1;
+	}
+
+	return index;
+}
+
+/*
+ * Callers usually iterate over the elements of a type by searching again
+ * from the position after the last match.  In this case the next element of
+ * the type can be read straight from the chain, without walking it from
+ * its head.
+ */
+
+static int prv_index_find(const int16_t *index, cpc_ptr_array_t *array,
+			  unsigned int type_count,
+			  unsigned int (*type_of)(const void *),
+			  unsigned int type, int from)
+{
+	int i;
+
+	if (from > 0 && (unsigned int) from <= cpc_ptr_array_get_size(array)
+	    && type_of(cpc_ptr_array_get(array, from - 1)) == type)
+		return index[type_count + from - 1];
+
+	i = index[type];
+	while (i != -1 && i < from)
+		i = index[type_count + i];
+
+	return i;
+}
+
 int cpc_find_param(cpc_characteristic_t *characteristic,
 		   cpc_param_type_t param, int index)
 {
 	int retval = -1;
 	unsigned int i = index;
 
+	if (!characteristic->param_index)
+		characteristic->param_index =
+			prv_index_make(&characteristic->parameters,
+				       CPC_PT_MAX, prv_param_type_of);
+
+	if (characteristic->param_index)
+		return prv_index_find(characteristic->param_index,
+				      &characteristic->parameters, CPC_PT_MAX,
+				      prv_param_type_of, param, index);
+
 	for (; i < cpc_get_param_count(characteristic) &&
 	     cpc_get_param(characteristic, i)->type != param; ++i);
 
@@ -1276,29 +1674,48 @@ int cpc_find_param(cpc_characteristic_t *characteristic,
 	return retval;
 }
 
-int cpc_find_char(cpc_characteristic_t *characteristic,
-		  cpc_characteristic_type_t characteristic_type, int index)
+static int prv_find_char(cpc_ptr_array_t *chars,
+			 cpc_characteristic_type_t characteristic_type,
+			 int index)
 {
 	int retval = -1;
 	unsigned int i = index;
 
-	for (; i < cpc_get_char_count(characteristic) &&
-	     cpc_get_char(characteristic, i)->type != characteristic_type;
-	      ++i);
+	for (; i < cpc_ptr_array_get_size(chars) &&
+	     ((cpc_characteristic_t *) cpc_ptr_array_get(chars, i))->type !=
+		     characteristic_type; ++i);
 
-	if (i < cpc_get_char_count(characteristic))
+	if (i < cpc_ptr_array_get_size(chars))
 		retval = i;
 
 	return retval;
 }
 
+int cpc_find_char(cpc_characteristic_t *characteristic,
+		  cpc_characteristic_type_t characteristic_type, int index)
+{
+	if (!characteristic->char_index)
+		characteristic->char_index =
+			prv_index_make(&characteristic->characteristics,
+				       CPC_CT_MAX, prv_char_type_of);
+
+	if (characteristic->char_index)
+		return prv_index_find(characteristic->char_index,
+				      &characteristic->characteristics,
+				      CPC_CT_MAX, prv_char_type_of,
+				      characteristic_type, index);
+
+	return prv_find_char(&characteristic->characteristics,
+			     characteristic_type, index);
+}
+
 static bool prv_validate_utf8_combo(cpc_characteristic_t *characteristic,
 				    cpc_param_type_t if_present,
 				    cpc_param_type_t also_required)
 {
 	bool retval = true;
 	int i = 0;
-	xmlChar *str = NULL;
+	const xmlChar *str = NULL;
 
 	if (cpc_find_param(characteristic, if_present, 0) != -1) {
 		i = cpc_find_param(characteristic, also_required, 0);
@@ -1306,7 +1723,7 @@ static bool prv_validate_utf8_combo(cpc_characteristic_t *characteristic,
 		if (i == -1)
 			retval = false;
 		else {
-			str = cpc_get_param(characteristic, i)->utf8_value;
+			str = cpc_get_utf8(cpc_get_param(characteristic, i));
 
 			if (xmlStrlen(str) == 0)
 				retval = false;
@@ -1322,7 +1739,7 @@ static void prv_delete_parameter(cpc_characteristic_t *characteristic,
 	int i = cpc_find_param(characteristic, param_type, 0);
 
 	while (i != -1) {
-		cpc_ptr_array_delete(&characteristic->parameters, i);
+		prv_delete_param(characteristic, i);
 
 		CPC_LOGF("Deleting param %d", param_type);
 
@@ -1359,9 +1776,21 @@ static bool prv_compare_params(cpc_parameter_t *param1, cpc_parameter_t *param2)
 			break;
 		case CPC_WPDT_UTF8:
 		case CPC_WPDT_UTF8OPT:
-			if (param1->utf8_value && param2->utf8_value)
-				retval = xmlStrEqual(param1->utf8_value,
-						      param2->utf8_value);
+
+			/*
+			 * Short values are always stored inline and long
+			 * values are interned, so the long values only
+			 * need to be compared by address.
+			 */
+
+			if (param1->utf8_is_inline != param2->utf8_is_inline)
+				retval = false;
+			else if (param1->utf8_is_inline)
+				retval = xmlStrEqual(param1->utf8_inline,
+						     param2->utf8_inline);
+			else
+				retval = param1->utf8_shared ==
+					param2->utf8_shared;
 			break;
 		}
 	}
@@ -1383,7 +1812,7 @@ static bool prv_params_equal(cpc_characteristic_t *characteristic1,
 	return prv_compare_params(param1, param2);
 }
 
-static void prv_del_dup_app(cpc_characteristic_t *characteristic,
+static void prv_del_dup_app(cpc_ptr_array_t *chars,
 			    int from, const char *appid,
 			    cpc_param_type_t param_type, int param1,
 			    int appidIndex1,
@@ -1393,19 +1822,19 @@ static void prv_del_dup_app(cpc_characteristic_t *characteristic,
 	int appid_index2 = -1;
 	cpc_characteristic_t *target_char2 = NULL;
 
-	int j = cpc_find_char(characteristic, CPC_CT_APPLICATION,
-				   from + 1);
+	int j = prv_find_char(chars, CPC_CT_APPLICATION, from + 1);
 
 	while (j != -1) {
-		target_char2 = cpc_get_char(characteristic, j);
+		target_char2 = cpc_ptr_array_get(chars, j);
 
 		param2 = cpc_find_param(target_char2, param_type, 0);
 
 		appid_index2 = cpc_find_param(target_char2, CPC_PT_APPID,
 						  0);
 		if (appid_index2 != -1 &&
-		    xmlStrEqual((const xmlChar *) appid, cpc_get_param
-				(target_char2, appid_index2)->utf8_value)
+		    xmlStrEqual((const xmlChar *) appid,
+				cpc_get_utf8(cpc_get_param(target_char2,
+							   appid_index2)))
 		    && prv_params_equal(target_char1, appidIndex1,
 					target_char2, appid_index2)) {
 
@@ -1418,29 +1847,27 @@ static void prv_del_dup_app(cpc_characteristic_t *characteristic,
 			    ((param1 != -1 && param2 != -1) &&
 			     prv_params_equal(target_char1,
 					      param1, target_char2, param2))) {
-				cpc_ptr_array_delete
-					(&characteristic->characteristics, j);
+				cpc_ptr_array_delete(chars, j);
 				CPC_LOGF("Deleting duplicate APPICATION");
 			} else
 				++j;
 		} else
 			++j;
 
-		j = cpc_find_char(characteristic, CPC_CT_APPLICATION, j);
+		j = prv_find_char(chars, CPC_CT_APPLICATION, j);
 	}
 }
 
-static void prv_rm_dup_app(cpc_characteristic_t *characteristic,
-			   const char *appid,
+static void prv_rm_dup_app(cpc_ptr_array_t *chars, const char *appid,
 			   cpc_param_type_t param_type)
 {
 	int appid_index1 = -1;
 	int param1 = -1;
 	cpc_characteristic_t *target_char1 = NULL;
-	int i = cpc_find_char(characteristic, CPC_CT_APPLICATION, 0);
+	int i = prv_find_char(chars, CPC_CT_APPLICATION, 0);
 
 	while (i != -1) {
-		target_char1 = cpc_get_char(characteristic, i);
+		target_char1 = cpc_ptr_array_get(chars, i);
 
 		param1 = cpc_find_param(target_char1, param_type, 0);
 
@@ -1448,16 +1875,15 @@ static void prv_rm_dup_app(cpc_characteristic_t *characteristic,
 					      0);
 
 		if (appid_index1 != -1 && xmlStrEqual((const xmlChar *) appid,
-				cpc_get_param(target_char1,
-					      appid_index1)->utf8_value))
-			prv_del_dup_app(characteristic, i, appid, param_type,
+				cpc_get_utf8(cpc_get_param(target_char1,
+					      appid_index1))))
+			prv_del_dup_app(chars, i, appid, param_type,
 					param1, appid_index1, target_char1);
-		i = cpc_find_char(characteristic, CPC_CT_APPLICATION,
-				       i + 1);
+		i = prv_find_char(chars, CPC_CT_APPLICATION, i + 1);
 	}
 }
 
-static void prv_del_dup_char(cpc_characteristic_t *characteristic,
+static void prv_del_dup_char(cpc_ptr_array_t *chars,
 			     cpc_characteristic_type_t
 			     characteristic_type,
 			     cpc_characteristic_t *target_char1,
@@ -1468,18 +1894,17 @@ static void prv_del_dup_char(cpc_characteristic_t *characteristic,
 	int param2 = -1;
 	cpc_characteristic_t *target_char2 = NULL;
 
-	j = cpc_find_char(characteristic, characteristic_type, from + 1);
+	j = prv_find_char(chars, characteristic_type, from + 1);
 
 	while (j != -1) {
-		target_char2 = cpc_get_char(characteristic, j);
+		target_char2 = cpc_ptr_array_get(chars, j);
 
 		param2 = cpc_find_param(target_char2, param_type, 0);
 
 		if (param2 != -1) {
 			if (prv_params_equal(target_char1, param1, target_char2,
 					     param2)) {
-				cpc_ptr_array_delete
-					(&characteristic->characteristics, j);
+				cpc_ptr_array_delete(chars, j);
 				CPC_LOGF("Deleting duplicate CHAR %d",
 					      characteristic_type);
 			} else
@@ -1487,34 +1912,44 @@ static void prv_del_dup_char(cpc_characteristic_t *characteristic,
 		} else
 			++j;
 
-		j = cpc_find_char(characteristic, characteristic_type, j);
+		j = prv_find_char(chars, characteristic_type, j);
 	}
 }
 
-static void prv_rm_dup_char(cpc_characteristic_t *characteristic,
+static void prv_rm_dup_char(cpc_ptr_array_t *chars,
 			    cpc_characteristic_type_t
 			    characteristic_type,
 			    cpc_param_type_t param_type)
 {
 	int param1 = -1;
 	cpc_characteristic_t *target_char1 = NULL;
-	int i = cpc_find_char(characteristic, characteristic_type, 0);
+	int i = prv_find_char(chars, characteristic_type, 0);
 
 	while (i != -1) {
-		target_char1 = cpc_get_char(characteristic, i);
+		target_char1 = cpc_ptr_array_get(chars, i);
 
 		param1 = cpc_find_param(target_char1, param_type, 0);
 
 		if (param1 != -1)
-			prv_del_dup_char(characteristic,
-					       characteristic_type,
-					       target_char1, param_type, param1,
-					       i);
-		i = cpc_find_char(characteristic, characteristic_type,
-				       i + 1);
+			prv_del_dup_char(chars, characteristic_type,
+					 target_char1, param_type, param1, i);
+		i = prv_find_char(chars, characteristic_type, i + 1);
 	}
 }
 
+static void prv_rm_dup_child(cpc_characteristic_t *characteristic,
+			     cpc_characteristic_type_t characteristic_type,
+			     cpc_param_type_t param_type)
+{
+	unsigned int count = cpc_get_char_count(characteristic);
+
+	prv_rm_dup_char(&characteristic->characteristics, characteristic_type,
+			param_type);
+
+	if (cpc_get_char_count(characteristic) != count)
+		prv_char_index_reset(characteristic);
+}
+
 static void prv_rm_extra_domains(cpc_characteristic_t *characteristic)
 {
 	int i = 0;
@@ -1528,7 +1963,7 @@ static void prv_rm_extra_domains(cpc_characteristic_t *characteristic)
 	}
 
 	while (i != -1) {
-		cpc_ptr_array_delete(&characteristic->parameters, i);
+		prv_delete_param(characteristic, i);
 		CPC_LOGF("Deleting extra DOMAIN");
 		i = cpc_find_param(characteristic, CPC_PT_DOMAIN, i);
 	}
@@ -1546,10 +1981,11 @@ static int prv_add_default_param(cpc_characteristic_t *characteristic,
 		CPC_FAIL_NULL(param, malloc(sizeof(*param)), CPC_ERR_OOM);
 
 		param->type = param_type;
+		param->data_type = CPC_WPDT_NONE;
 		param->transient = true;
+		param->utf8_is_inline = false;
 
-		CPC_FAIL(cpc_ptr_array_append(&characteristic->parameters,
-					      param));
+		CPC_FAIL(prv_append_param(characteristic, param));
 
 		CPC_LOGF("Adding Int Parameter %d", param_type);
 	}
@@ -1584,30 +2020,55 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static int prv_add_default_utf8_param(cpc_characteristic_t *characteristic,
-				      cpc_param_type_t param_type,
-				      const char *value)
+static int prv_add_inline_utf8_param(cpc_characteristic_t *characteristic,
+				     cpc_param_type_t param_type,
+				     const char *value)
 {
 	CPC_ERR_MANAGE;
 	cpc_parameter_t *param = NULL;
-	xmlChar *utf8Str;
 
 	CPC_FAIL(prv_add_default_param(characteristic, param_type, &param));
 
 	if (param) {
-		CPC_FAIL_NULL_LABEL(utf8Str, xmlStrdup((xmlChar*) value),
-					 CPC_ERR_OOM, remove_param);
-		param->utf8_value = utf8Str;
+		strcpy((char *) param->utf8_inline, value);
+		param->utf8_is_inline = true;
 		param->data_type = CPC_WPDT_UTF8;
 	}
 
-	return CPC_ERR_NONE;
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+/*
+ * The default values are string literals that are stored inline, so no
+ * string pool is needed to add them.  Literals that are too long to be
+ * stored inline are rejected at compile time.
+ */
+
+#define prv_add_default_utf8_param(characteristic, param_type, value)	\
+	(sizeof(char[sizeof(value "") <= CPC_PARAM_INLINE_SIZE ? 1 : -1]) ? \
+	 prv_add_inline_utf8_param(characteristic, param_type, value) : 0)
 
-remove_param:
+/*
+ * Like prv_add_default_utf8_param but takes its value from another
+ * parameter of the same document.  The value is shared rather than copied.
+ */
 
-	cpc_ptr_array_delete(&characteristic->characteristics,
-				      cpc_get_char_count
-				      (characteristic) - 1);
+static int prv_add_default_utf8_ref(cpc_characteristic_t *characteristic,
+				    cpc_param_type_t param_type,
+				    const cpc_parameter_t *value)
+{
+	CPC_ERR_MANAGE;
+	cpc_parameter_t *param = NULL;
+
+	CPC_FAIL(prv_add_default_param(characteristic, param_type, &param));
+
+	if (param) {
+		*param = *value;
+		param->type = param_type;
+		param->transient = true;
+	}
 
 CPC_ON_ERR:
 
@@ -1627,8 +2088,7 @@ static int prv_validate_int_parameter(cpc_characteristic_t *characteristic,
 		parameter = cpc_get_param(characteristic, param);
 
 		if (parameter->int_value > max_value) {
-			cpc_ptr_array_delete(&characteristic->parameters,
-					     param);
+			prv_delete_param(characteristic, param);
 			CPC_ERR = CPC_ERR_CORRUPT;
 		}
 	}
@@ -1645,9 +2105,8 @@ static int prv_validate_utf8_parameter(cpc_characteristic_t *characteristic,
 
 	if (param != -1) {
 		parameter = cpc_get_param(characteristic, param);
-		if (xmlStrlen(parameter->utf8_value) > CPC_PARSER_MAX_REF) {
-			cpc_ptr_array_delete(&characteristic->parameters,
-					     param);
+		if (xmlStrlen(cpc_get_utf8(parameter)) > CPC_PARSER_MAX_REF) {
+			prv_delete_param(characteristic, param);
 			CPC_ERR = CPC_ERR_CORRUPT;
 		}
 	}
@@ -1689,7 +2148,7 @@ static int prv_add_dup_parameter(cpc_characteristic_t *characteristic,
 	cpc_parameter_t *param_dup = NULL;
 
 	CPC_FAIL(prv_parameter_dup(param, &param_dup));
-	CPC_FAIL(cpc_ptr_array_append(&characteristic->parameters, param_dup));
+	CPC_FAIL(prv_append_param(characteristic, param_dup));
 
 	return CPC_ERR_NONE;
 
@@ -1707,8 +2166,7 @@ static int prv_add_dup_char(cpc_characteristic_t *characteristic,
 	cpc_characteristic_t *char_dup = NULL;
 
 	CPC_FAIL(prv_characteristic_dup(characteristic_to_dup, &char_dup));
-	CPC_FAIL(cpc_ptr_array_append(&characteristic->characteristics,
-				      char_dup));
+	CPC_FAIL(prv_append_char(characteristic, char_dup));
 
 	return CPC_ERR_NONE;
 
@@ -1985,7 +2443,7 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static int prv_resolve_dup_characteristics(cpc_characteristic_t *characteristic,
+static int prv_resolve_dup_characteristics(cpc_ptr_array_t *chars,
 					   cpc_characteristic_type_t
 					   characteristic_type,
 					   cpc_param_type_t key,
@@ -1997,16 +2455,15 @@ static int prv_resolve_dup_characteristics(cpc_characteristic_t *characteristic,
 
 	int j = -1;
 	int k = -1, l = -1;
-	int i = cpc_find_char(characteristic, characteristic_type, 0);
+	int i = prv_find_char(chars, characteristic_type, 0);
 
 	while (i != -1) {
-		target_char1 = cpc_get_char(characteristic, i);
+		target_char1 = cpc_ptr_array_get(chars, i);
 
-		j = cpc_find_char(characteristic, characteristic_type,
-				       i + 1);
+		j = prv_find_char(chars, characteristic_type, i + 1);
 
 		while (j != -1) {
-			target_char2 = cpc_get_char(characteristic, j);
+			target_char2 = cpc_ptr_array_get(chars, j);
 
 			k = cpc_find_param(target_char1, key, 0);
 			l = cpc_find_param(target_char2, key, 0);
@@ -2016,20 +2473,16 @@ static int prv_resolve_dup_characteristics(cpc_characteristic_t *characteristic,
 				    (target_char1, k, target_char2, l)) {
 					CPC_FAIL(merge_fn(target_char1,
 							       target_char2));
-					cpc_ptr_array_delete(
-						&characteristic->
-						characteristics, j);
+					cpc_ptr_array_delete(chars, j);
 				} else
 					++j;
 			} else
 				++j;
 
-			j = cpc_find_char(characteristic,
-					       characteristic_type, j);
+			j = prv_find_char(chars, characteristic_type, j);
 		}
 
-		i = cpc_find_char(characteristic, characteristic_type,
-				       i + 1);
+		i = prv_find_char(chars, characteristic_type, i + 1);
 	}
 
 CPC_ON_ERR:
@@ -2053,15 +2506,16 @@ static int prv_validate_pxlogical_characteristic(cpc_characteristic_t
 
 	CPC_ERR_MANAGE;
 
-	prv_rm_dup_char(characteristic, CPC_CT_PORT, CPC_PT_PORTNBR);
+	prv_rm_dup_child(characteristic, CPC_CT_PORT, CPC_PT_PORTNBR);
 	prv_rm_extra_domains(characteristic);
-	prv_rm_dup_char(characteristic, CPC_CT_PXAUTHINFO,
-					  CPC_PT_PXAUTH_TYPE);
+	prv_rm_dup_child(characteristic, CPC_CT_PXAUTHINFO, CPC_PT_PXAUTH_TYPE);
 
-	CPC_FAIL(prv_resolve_dup_characteristics(
-			      characteristic, CPC_CT_PXPHYSICAL,
-			      CPC_PT_PHYSICAL_PROXY_ID,
-			      prv_merge_pxphysical_characteristics));
+	CPC_ERR = prv_resolve_dup_characteristics(
+		&characteristic->characteristics, CPC_CT_PXPHYSICAL,
+		CPC_PT_PHYSICAL_PROXY_ID,
+		prv_merge_pxphysical_characteristics);
+	prv_char_index_reset(characteristic);
+	CPC_FAIL(CPC_ERR);
 
 	CPC_FAIL(prv_add_default_int_param(characteristic,
 						CPC_PT_PUSHENABLED, 0));
@@ -2091,7 +2545,7 @@ static int prv_validate_pxphysical_characteristic(cpc_characteristic_t
 	 * 3. Check if PXADDRTYPE is defined. If not set it to "IPV4"
 	 */
 
-	prv_rm_dup_char(characteristic, CPC_CT_PORT, CPC_PT_PORTNBR);
+	prv_rm_dup_child(characteristic, CPC_CT_PORT, CPC_PT_PORTNBR);
 	prv_rm_extra_domains(characteristic);
 
 	return prv_add_default_utf8_param(characteristic,
@@ -2118,9 +2572,8 @@ static int prv_validate_napdef_characteristic(cpc_characteristic_t
 	cpc_parameter_t *param = NULL;
 	int index = -1;
 
-	prv_rm_dup_char(characteristic, CPC_CT_NAPAUTHINFO,
-					  CPC_PT_AUTHTYPE);
-	prv_rm_dup_char(characteristic, CPC_CT_VALIDITY, CPC_PT_COUNTRY);
+	prv_rm_dup_child(characteristic, CPC_CT_NAPAUTHINFO, CPC_PT_AUTHTYPE);
+	prv_rm_dup_child(characteristic, CPC_CT_VALIDITY, CPC_PT_COUNTRY);
 
 	if (cpc_find_param(characteristic, CPC_PT_NAP_ADDRESS, 0) != -1){
 		CPC_FAIL(prv_add_default_utf8_param(characteristic,
@@ -2143,9 +2596,9 @@ static int prv_validate_napdef_characteristic(cpc_characteristic_t
 
 	param = cpc_get_param(characteristic, index);
 
-	if (!(xmlStrEqual(param->utf8_value, (const xmlChar *)"GSM-CSD") ||
-	      xmlStrEqual(param->utf8_value, (const xmlChar *)"GSM-GPRS"))) {
-		CPC_LOGF("Unsupported Bearer %s", param->utf8_value);
+	if (!(xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"GSM-CSD") ||
+	      xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"GSM-GPRS"))) {
+		CPC_LOGF("Unsupported Bearer %s", cpc_get_utf8(param));
 		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 	}
 
@@ -2244,7 +2697,7 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 	cpc_characteristic_t *wap_char = NULL;
 	int j = 0;
 	int appArraySize = sizeof(g_supported_applications) /
-				sizeof(const xmlChar *);
+				sizeof(cpc_app_type_map_t);
 	int i = cpc_find_param(characteristic, CPC_PT_APPID, 0);
 	int index = -1;
 
@@ -2252,8 +2705,8 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 
 	param = cpc_get_param(characteristic, i);
-	for (j = 0; j < appArraySize && !xmlStrEqual(param->utf8_value,
-				  g_supported_applications[j]); ++j) ;
+	for (j = 0; j < appArraySize && !xmlStrEqual(cpc_get_utf8(param),
+				  g_supported_applications[j].appid); ++j) ;
 
 	/* Check the length of the NAME and the Provider ID params. */
 
@@ -2262,11 +2715,11 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 
 	if (j == appArraySize) {
 		CPC_LOGF("Unsupported Application Type %s",
-			      param->utf8_value);
+			      cpc_get_utf8(param));
 		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 	}
-	if (!xmlStrEqual(param->utf8_value, (const xmlChar *)"w2")
-	    && !xmlStrEqual(param->utf8_value, (const xmlChar *)"DL")) {
+	if (!xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"w2")
+	    && !xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"DL")) {
 		if (cpc_find_param(characteristic, CPC_PT_ADDR, 0) == -1
 		    && cpc_find_char(characteristic, CPC_CT_APPADDR, 0)
 		    == -1) {
@@ -2275,7 +2728,7 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 		}
 	}
 
-	if (xmlStrEqual(param->utf8_value, (const xmlChar *)"w7")) {
+	if (xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"w7")) {
 		index = cpc_find_param(characteristic, CPC_PT_PROVIDER_ID, 0);
 		if (index == -1) {
 			CPC_LOGF("DM Account needs ProviderID");
@@ -2283,26 +2736,26 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 		} else {
 			/* Check added by Intel */
 			prov_id = cpc_get_param(characteristic, index);
-			if (!prov_id->utf8_value[0]) {
+			if (!cpc_get_utf8(prov_id)[0]) {
 				CPC_LOGF("DM Account needs ProviderID");
 				CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 			}
 		}
-	} else if (xmlStrEqual(param->utf8_value, (const xmlChar *)"25")) {
+	} else if (xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"25")) {
 		if ((cpc_find_param(characteristic, CPC_PT_FROM, 0)
 		     == -1) || !prv_contains_port(characteristic)) {
 			CPC_LOGF("Either EMAIL ADDRESS or PORT number"
 				     " is mssing from SMTP account");
 			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 		}
-	} else if (xmlStrEqual(param->utf8_value, (const xmlChar *)"110") ||
-		   xmlStrEqual(param->utf8_value, (const xmlChar *)"143"))
+	} else if (xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"110") ||
+		   xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"143"))
 	{
 		if (!prv_contains_port(characteristic)) {
 			CPC_LOGF("Port number is missing");
 			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 		}
-	} else if (xmlStrEqual(param->utf8_value,(const xmlChar *)"w5")) {
+	} else if (xmlStrEqual(cpc_get_utf8(param),(const xmlChar *)"w5")) {
 
 		/*
 		 * All w5 characteristic must have at least one resource
@@ -2316,9 +2769,7 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 			wap_char = cpc_get_char(characteristic, index);
 			if (cpc_find_param(wap_char, CPC_PT_AACCEPT, 0)
 			    == -1) {
-				cpc_ptr_array_delete(&characteristic->
-							      characteristics,
-							      index);
+				prv_delete_char(characteristic, index);
 				CPC_LOGF("RESOURCE missing AACCEPT param."
 					     " Deleting");
 			} else
@@ -2334,7 +2785,7 @@ static int prv_validate_application_characteristic(cpc_characteristic_t
 				     "resource");
 			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 		}
-	} else  if (xmlStrEqual(param->utf8_value, (const xmlChar *)"wA")) {
+	} else  if (xmlStrEqual(cpc_get_utf8(param), (const xmlChar *)"wA")) {
 		if (cpc_find_param(characteristic, CPC_PT_AACCEPT, 0)
 		    == -1) {
 			CPC_LOGF("IM account requires an AACCEPT "
@@ -2359,8 +2810,7 @@ static int prv_validate_specific_characteristic(cpc_characteristic_t
 			prv_validate_access_characteristic(characteristic);
 		break;
 	case CPC_CT_APPADDR:
-		prv_rm_dup_char(characteristic, CPC_CT_PORT,
-						  CPC_PT_PORTNBR);
+		prv_rm_dup_child(characteristic, CPC_CT_PORT, CPC_PT_PORTNBR);
 		break;
 	case CPC_CT_APPLICATION:
 		CPC_ERR =
@@ -2416,12 +2866,12 @@ static bool prv_remove_refs_from_other(cpc_characteristic_t *characteristic,
 	while (i != -1) {
 		param = cpc_ptr_array_get(&characteristic->parameters, i);
 		if (xmlStrEqual
-		    ((const xmlChar *)"INTERNET", param->utf8_value))
+		    ((const xmlChar *)"INTERNET", cpc_get_utf8(param)))
 			++i;
 		else {
 			napid_count = cpc_ptr_array_get_size(napd_ids);
 			for (j = 0; j < napid_count && !xmlStrEqual(
-				     param->utf8_value,
+				     cpc_get_utf8(param),
 				     cpc_ptr_array_get(napd_ids, j));
 			     ++j);
 
@@ -2430,9 +2880,7 @@ static bool prv_remove_refs_from_other(cpc_characteristic_t *characteristic,
 			else {
 				CPC_LOGF(
 					"Deleting Invalid TO-NAPID.");
-				cpc_ptr_array_delete(&characteristic->
-							      parameters,
-							      i);
+				prv_delete_param(characteristic, i);
 				++deleted;
 			}
 		}
@@ -2473,9 +2921,7 @@ static bool prv_remove_refs_from_pxl(cpc_characteristic_t *characteristic,
 			if (!prv_remove_invalid_napdef_refs
 			    (wap_char, napd_ids)) {
 				++deleted;
-				cpc_ptr_array_delete(&characteristic->
-							      characteristics,
-							      j);
+				prv_delete_char(characteristic, j);
 				--j;
 			}
 			++found;
@@ -2487,21 +2933,26 @@ static bool prv_remove_refs_from_pxl(cpc_characteristic_t *characteristic,
 	return retval;
 }
 
-static void prv_remove_refs_from_root(cpc_characteristic_t *characteristic,
+static void prv_remove_refs_from_root(cpc_root_index_t *index,
 				      cpc_ptr_array_t *napd_ids)
 {
+	static const cpc_characteristic_type_t referrers[] = {
+		CPC_CT_ACCESS, CPC_CT_APPLICATION, CPC_CT_PXLOGICAL
+	};
+	unsigned int i = 0;
 	unsigned int j = 0;
-	cpc_characteristic_t *wap_char = NULL;
-
-	for (j = 0; j < cpc_get_char_count(characteristic); ++j) {
-		wap_char = cpc_get_char(characteristic, j);
-		if (!prv_remove_invalid_napdef_refs(wap_char, napd_ids)) {
-			CPC_LOGF("Removal of NAPDEFs renders Characteristic "
-				 "invalid.");
-			cpc_ptr_array_delete(&characteristic->
-						      characteristics,
-						      j);
-			--j;
+	cpc_ptr_array_t *chars;
+
+	for (i = 0; i < sizeof(referrers) / sizeof(referrers[0]); ++i) {
+		chars = &index->chars[referrers[i]];
+		for (j = 0; j < cpc_ptr_array_get_size(chars); ++j) {
+			if (!prv_remove_invalid_napdef_refs(
+				    cpc_ptr_array_get(chars, j), napd_ids)) {
+				CPC_LOGF("Removal of NAPDEFs renders "
+					 "Characteristic invalid.");
+				cpc_ptr_array_delete(chars, j);
+				--j;
+			}
 		}
 	}
 }
@@ -2517,41 +2968,39 @@ static bool prv_remove_invalid_napdef_refs(cpc_characteristic_t *characteristic,
 		retval = prv_remove_refs_from_other(characteristic, napd_ids);
 	else if (characteristic->type == CPC_CT_PXLOGICAL)
 		retval = prv_remove_refs_from_pxl(characteristic, napd_ids);
-	else if (characteristic->type == CPC_CT_ROOT)
-		prv_remove_refs_from_root(characteristic, napd_ids);
 
 	return retval;
 }
 
-static int prv_validate_napdef_refs(cpc_characteristic_t *root)
+static int prv_validate_napdef_refs(cpc_root_index_t *index)
 {
 	CPC_ERR_MANAGE;
 	cpc_characteristic_t *wap_char = NULL;
 	cpc_parameter_t *wap_parameter = NULL;
+	cpc_ptr_array_t *napdefs = &index->chars[CPC_CT_NAPDEF];
 	cpc_ptr_array_t napids;
-	int i = -1, j = -1;
+	unsigned int i = 0;
+	int j = -1;
 
 	cpc_ptr_array_make(&napids, 4, NULL);
-	i = cpc_find_char(root, CPC_CT_NAPDEF, 0);
 
-	while (i != -1) {
-		wap_char = (cpc_characteristic_t *)
-		    cpc_ptr_array_get(&root->characteristics, i);
+	for (i = 0; i < cpc_ptr_array_get_size(napdefs); ++i) {
+		wap_char = cpc_ptr_array_get(napdefs, i);
 		j = cpc_find_param(wap_char, CPC_PT_NAPID, 0);
 		if (j != -1) {
 			wap_parameter = (cpc_parameter_t *)
 			    cpc_ptr_array_get(&wap_char->parameters, j);
 			CPC_FAIL(
 				cpc_ptr_array_append(
-					&napids, wap_parameter->utf8_value));
+					&napids, (xmlChar *)
+					cpc_get_utf8(wap_parameter)));
 		}
-		i = cpc_find_char(root, CPC_CT_NAPDEF, i + 1);
 	}
 
 CPC_ON_ERR:
 
 	if (CPC_ERR == CPC_ERR_NONE)
-		(void) prv_remove_invalid_napdef_refs(root, &napids);
+		prv_remove_refs_from_root(index, &napids);
 
 	cpc_ptr_array_free(&napids);
 
@@ -2566,19 +3015,20 @@ static int prv_remove_dup_rule(cpc_characteristic_t *wap_char, int* from,
 	cpc_parameter_t *wap_parameter = NULL;
 	unsigned int k = 0;
 	int j = *from;
-	xmlChar *rule_name;
+	const xmlChar *rule_name;
 	unsigned int access_param_size = 0;
 
 	wap_parameter =  cpc_ptr_array_get(&wap_char->parameters, j);
 	rule_name = (wap_parameter->data_type == CPC_WPDT_UTF8) ?
-		wap_parameter->utf8_value : (xmlChar *) "";
+		cpc_get_utf8(wap_parameter) : (const xmlChar *) "";
 
 	for (k = 0; k < cpc_ptr_array_get_size(rule_names) &&
 		     !xmlStrEqual(rule_name, cpc_ptr_array_get(
 					  rule_names, k)); ++k);
 
 	if (k == cpc_ptr_array_get_size(rule_names)) {
-		CPC_FAIL(cpc_ptr_array_append(rule_names, rule_name));
+		CPC_FAIL(cpc_ptr_array_append(rule_names,
+					      (xmlChar *) rule_name));
 		++j;
 	} else {
 		/* We need to remove the invalid rule */
@@ -2587,7 +3037,7 @@ static int prv_remove_dup_rule(cpc_characteristic_t *wap_char, int* from,
 
 		do {
 			k = j;
-			cpc_ptr_array_delete(&wap_char->parameters, k);
+			prv_delete_param(wap_char, k);
 			access_param_size = cpc_get_param_count(wap_char);
 			if (k < access_param_size)
 				wap_parameter = cpc_ptr_array_get(
@@ -2608,19 +3058,19 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static int prv_validate_access_rules(cpc_characteristic_t *root)
+static int prv_validate_access_rules(cpc_root_index_t *index)
 {
 	CPC_ERR_MANAGE;
 	cpc_ptr_array_t rule_names;
+	cpc_ptr_array_t *accesses = &index->chars[CPC_CT_ACCESS];
 	cpc_characteristic_t *wap_char = NULL;
-	int i = -1, j = -1;
+	unsigned int i = 0;
+	int j = -1;
 
 	cpc_ptr_array_make(&rule_names, 8, NULL);
 
-	i = cpc_find_char(root, CPC_CT_ACCESS, 0);
-
-	while (i != -1) {
-		wap_char = cpc_ptr_array_get(&root->characteristics, i);
+	while (i < cpc_ptr_array_get_size(accesses)) {
+		wap_char = cpc_ptr_array_get(accesses, i);
 
 		j = cpc_find_param(wap_char, CPC_PT_RULE, 0);
 
@@ -2632,11 +3082,9 @@ static int prv_validate_access_rules(cpc_characteristic_t *root)
 
 		if (cpc_find_param(wap_char, CPC_PT_RULE, 0) == -1) {
 			CPC_LOGF("No valid rules left. Deleting ACCESS");
-			cpc_ptr_array_delete(&root->characteristics, i);
+			cpc_ptr_array_delete(accesses, i);
 		} else
 			++i;
-
-		i = cpc_find_char(root, CPC_CT_ACCESS, i);
 	}
 
 CPC_ON_ERR:
@@ -2650,7 +3098,7 @@ static int prv_validate_non_root_char(cpc_characteristic_t *characteristic)
 {
 	CPC_ERR_MANAGE;
 	cpc_valid_param_t *param_list = NULL;
-	unsigned int i = 0, j = 0;
+	unsigned int i = 0;
 	unsigned int param_list_count = 0;
 	cpc_valid_characteristic_t *char_list = NULL;
 	unsigned int char_list_count = 0;
@@ -2664,14 +3112,8 @@ static int prv_validate_non_root_char(cpc_characteristic_t *characteristic)
 		    && param_list[i].occurence != CPC_WP_OCCUR_ONE_OR_MORE)
 			continue;
 
-		for (j = 0; j < cpc_get_param_count(characteristic)
-			     && ((cpc_parameter_t *)
-				 cpc_ptr_array_get(&characteristic->
-							    parameters,
-							    j))->type !=
-			     param_list[i].type; ++j) ;
-
-		if (j == cpc_get_param_count(characteristic))
+		if (cpc_find_param(characteristic, param_list[i].type, 0) ==
+		    -1)
 			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 	}
 
@@ -2684,15 +3126,7 @@ static int prv_validate_non_root_char(cpc_characteristic_t *characteristic)
 		    char_list[i].occurence != CPC_WP_OCCUR_ONE_OR_MORE)
 			continue;
 
-		for (j = 0;
-		     j < cpc_get_char_count(characteristic)
-			     && ((cpc_characteristic_t *)
-				 cpc_ptr_array_get(&characteristic->
-							    characteristics,
-							    j))->type !=
-			     char_list[i].type; ++j) ;
-
-		if (j == cpc_get_char_count(characteristic))
+		if (cpc_find_char(characteristic, char_list[i].type, 0) == -1)
 			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 	}
 
@@ -2709,63 +3143,13 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static int prv_validate_cpc_characteristic(cpc_characteristic_t *characteristic)
-{
-	/*
-	 * This function is called after we have parsed the xml file and we have
-	 * an in memory model of the xml file in memory (non DOM). Now we can
-	 * perform the remaining checks which are:
-	 *
-	 * 1) Check the ONCE and ONE_OR_MORE occurence properties for params
-	 *    and chars.
-	 * 2) Perform characteristic/parameter specific checks.
-	 *
-	 * This function can return three values:
-	 *    CPC_ERR_NONE: Node is fine
-	 *    CPC_ERR_CORRUPT: Node is corrupt and must be deleted by
-	 *                            caller
-	 *    CPC_ERR_OOM: Memory failure. We must stop processing the
-	 *                        tree.
-	 */
-
-	CPC_ERR_MANAGE;
-	unsigned int i = 0;
-	int child_ret_val = CPC_ERR_NONE;
-
-	/*
-	 * We need to check the children first as we may have to delete some
-	 * of them.
-	 */
-
-	while (i < cpc_get_char_count(characteristic)) {
-		child_ret_val = prv_validate_cpc_characteristic(
-			cpc_ptr_array_get(&characteristic->characteristics, i));
-
-		if (child_ret_val == CPC_ERR_OOM)
-			CPC_FAIL_FORCE(child_ret_val);
-		else if (child_ret_val == CPC_ERR_CORRUPT)
-			cpc_ptr_array_delete(&characteristic->characteristics,
-					     i);
-		else
-			++i;
-	}
-
-	if (characteristic->type != CPC_CT_ROOT)
-		CPC_FAIL(prv_validate_non_root_char(characteristic));
-	else if (cpc_get_char_count(characteristic) == 0)
-		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
-
-CPC_ON_ERR:
-
-	return CPC_ERR;
-}
-
-static int prv_find_matching_access(cpc_characteristic_t *root,
+static int prv_find_matching_access(cpc_root_index_t *index,
 				    cpc_characteristic_t *wap_char,
 				    bool *matching)
 {
 	CPC_ERR_MANAGE;
-	int j = -1;
+	cpc_ptr_array_t *accesses = &index->chars[CPC_CT_ACCESS];
+	unsigned int j = 0;
 	int appid1;
 	int appid2;
 	bool matching_access = false;
@@ -2778,10 +3162,9 @@ static int prv_find_matching_access(cpc_characteristic_t *root,
 
 	matching_access = false;
 
-	j = cpc_find_char(root, CPC_CT_ACCESS, 0);
-
-	while (j != -1 && !matching_access) {
-		access = cpc_get_char(root, j);
+	for (j = 0; j < cpc_ptr_array_get_size(accesses) && !matching_access;
+	     ++j) {
+		access = cpc_ptr_array_get(accesses, j);
 		appid2 = cpc_find_param(access, CPC_PT_APPID, 0);
 		matching_access = (appid2 == -1);
 
@@ -2791,9 +3174,6 @@ static int prv_find_matching_access(cpc_characteristic_t *root,
 			appid2 = cpc_find_param(access, CPC_PT_APPID,
 						     appid2 + 1);
 		}
-
-		if (!matching_access)
-			j = cpc_find_char(root, CPC_CT_ACCESS, j + 1);
 	}
 
 	*matching = matching_access;
@@ -2831,9 +3211,9 @@ static int prv_bind_app(cpc_characteristic_t *root,
 
 			connectoid = cpc_get_param(connector, j);
 
-			CPC_FAIL(prv_add_default_utf8_param(
-					      wap_char, CPC_PT_TO_PROXY,
-					      (char *) connectoid->utf8_value));
+			CPC_FAIL(prv_add_default_utf8_ref(wap_char,
+							  CPC_PT_TO_PROXY,
+							  connectoid));
 		} else if (connector->type == CPC_CT_NAPDEF) {
 			j = cpc_find_param(connector, CPC_PT_NAPID, 0);
 
@@ -2842,9 +3222,9 @@ static int prv_bind_app(cpc_characteristic_t *root,
 
 			connectoid = cpc_get_param(connector, j);
 
-			CPC_FAIL(prv_add_default_utf8_param(
-					      wap_char, CPC_PT_TO_NAPID,
-					      (char *)connectoid->utf8_value));
+			CPC_FAIL(prv_add_default_utf8_ref(wap_char,
+							  CPC_PT_TO_NAPID,
+							  connectoid));
 		}
 	}
 
@@ -2853,17 +3233,17 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static int prv_bind_unlinked_apps(cpc_characteristic_t *root)
+static int prv_bind_unlinked_apps(cpc_characteristic_t *root,
+				  cpc_root_index_t *index)
 {
 	CPC_ERR_MANAGE;
-	int i = -1;
+	cpc_ptr_array_t *apps = &index->chars[CPC_CT_APPLICATION];
+	unsigned int i = 0;
 	cpc_characteristic_t *wap_char = NULL;
 	bool matching_access = false;
 
-	i = cpc_find_char(root, CPC_CT_APPLICATION, 0);
-
-	while (i != -1) {
-		wap_char = cpc_get_char(root, i);
+	for (i = 0; i < cpc_ptr_array_get_size(apps); ++i) {
+		wap_char = cpc_ptr_array_get(apps, i);
 
 		if ((cpc_find_param(wap_char, CPC_PT_TO_NAPID, 0) ==
 		     -1) &&
@@ -2875,14 +3255,12 @@ static int prv_bind_unlinked_apps(cpc_characteristic_t *root)
 			 * Are there any mactching access rules.
 			 */
 
-			CPC_FAIL(prv_find_matching_access(root, wap_char,
+			CPC_FAIL(prv_find_matching_access(index, wap_char,
 							  &matching_access));
 
 			if (!matching_access)
 				CPC_FAIL(prv_bind_app(root, wap_char));
 		}
-
-		i = cpc_find_char(root, CPC_CT_APPLICATION, i + 1);
 	}
 
 CPC_ON_ERR:
@@ -2890,7 +3268,27 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static int prv_perform_global_checks(cpc_characteristic_t *root)
+static void prv_sweep_root(cpc_characteristic_t *root)
+{
+	unsigned int i = 0;
+	unsigned int live = 0;
+	cpc_characteristic_t *wap_char = NULL;
+
+	for (i = 0; i < cpc_get_char_count(root); ++i) {
+		wap_char = cpc_get_char(root, i);
+		if (wap_char->deleted)
+			prv_wap_char_free(wap_char);
+		else
+			cpc_ptr_array_get(&root->characteristics, live++) =
+				wap_char;
+	}
+
+	root->characteristics.size = live;
+	prv_char_index_reset(root);
+}
+
+static int prv_perform_global_checks(cpc_characteristic_t *root,
+				     cpc_root_index_t *index)
 {
 	/*
 	 * Perform global checks on the document:
@@ -2901,32 +3299,41 @@ static int prv_perform_global_checks(cpc_characteristic_t *root)
 	 * 4. Ensure the NAME of each VENDORCONFIG is unique.
 	 * 5. Ensure that there is only one bootstrap with a PROVURL.
 	 * 6. Ensure that all TO-NAPIDs refer to valid NAPDEFs.
+	 *
+	 * The checks work on the lists of root characteristics collected
+	 * in index while the document was parsed.  Removing a
+	 * characteristic from one of these lists only marks it as deleted.
+	 * Deleted characteristics are removed from root in a single pass once
+	 * all the checks that can delete characteristics have run.
 	 */
 
 	CPC_ERR_MANAGE;
-	int i = -1, j = -1;
+	cpc_ptr_array_t *apps = &index->chars[CPC_CT_APPLICATION];
+	cpc_ptr_array_t *bootstraps = &index->chars[CPC_CT_BOOTSTRAP];
+	unsigned int i = 0;
+	int j = -1;
 	cpc_characteristic_t *wap_char = NULL;
 
-	prv_rm_dup_char(root, CPC_CT_NAPDEF, CPC_PT_NAPID);
-	prv_rm_dup_char(root, CPC_CT_CLIENTIDENTITY, CPC_PT_CLIENT_ID);
-	prv_rm_dup_char(root, CPC_CT_VENDORCONFIG, CPC_PT_NAME);
-
-	prv_rm_dup_app(root, "w2", CPC_PT_NAME);
-	prv_rm_dup_app(root, "w4", CPC_PT_APPID);
-	prv_rm_dup_app(root, "w5", CPC_PT_PROVIDER_ID);
-	prv_rm_dup_app(root, "w7", CPC_PT_PROVIDER_ID);
-	prv_rm_dup_app(root, "25", CPC_PT_PROVIDER_ID);
-	prv_rm_dup_app(root, "143", CPC_PT_PROVIDER_ID);
-	prv_rm_dup_app(root, "110", CPC_PT_PROVIDER_ID);
-	prv_rm_dup_app(root, "wA", CPC_PT_PROVIDER_ID);
-	prv_rm_dup_app(root, "ap0004", CPC_PT_PROVIDER_ID);
-
-	i = cpc_find_char(root, CPC_CT_BOOTSTRAP, 0);
-
-	while (i != -1 && j == -1) {
-		wap_char = cpc_get_char(root, i);
+	prv_rm_dup_char(&index->chars[CPC_CT_NAPDEF], CPC_CT_NAPDEF,
+			CPC_PT_NAPID);
+	prv_rm_dup_char(&index->chars[CPC_CT_CLIENTIDENTITY],
+			CPC_CT_CLIENTIDENTITY, CPC_PT_CLIENT_ID);
+	prv_rm_dup_char(&index->chars[CPC_CT_VENDORCONFIG],
+			CPC_CT_VENDORCONFIG, CPC_PT_NAME);
+
+	prv_rm_dup_app(apps, "w2", CPC_PT_NAME);
+	prv_rm_dup_app(apps, "w4", CPC_PT_APPID);
+	prv_rm_dup_app(apps, "w5", CPC_PT_PROVIDER_ID);
+	prv_rm_dup_app(apps, "w7", CPC_PT_PROVIDER_ID);
+	prv_rm_dup_app(apps, "25", CPC_PT_PROVIDER_ID);
+	prv_rm_dup_app(apps, "143", CPC_PT_PROVIDER_ID);
+	prv_rm_dup_app(apps, "110", CPC_PT_PROVIDER_ID);
+	prv_rm_dup_app(apps, "wA", CPC_PT_PROVIDER_ID);
+	prv_rm_dup_app(apps, "ap0004", CPC_PT_PROVIDER_ID);
+
+	for (; i < cpc_ptr_array_get_size(bootstraps) && j == -1; ++i) {
+		wap_char = cpc_ptr_array_get(bootstraps, i);
 		j = cpc_find_param(wap_char, CPC_PT_PROVURL, 0);
-		i = cpc_find_char(root, CPC_CT_BOOTSTRAP, i + 1);
 	}
 
 	if (j != -1) {
@@ -2935,34 +3342,32 @@ static int prv_perform_global_checks(cpc_characteristic_t *root)
 		 * a provurl parameter.
 		 */
 
-		while (i != -1) {
-			wap_char = cpc_get_char(root, i);
+		while (i < cpc_ptr_array_get_size(bootstraps)) {
+			wap_char = cpc_ptr_array_get(bootstraps, i);
 			if (cpc_find_param
 			    (wap_char, CPC_PT_PROVURL, 0) != -1) {
-				cpc_ptr_array_delete(&root->
-							   characteristics,
-							   i);
+				cpc_ptr_array_delete(bootstraps, i);
 				CPC_LOGF("Deleting BOOTSTRAP. Only one "
 					 "PROVURL allowed ");
 			} else
 				++i;
-
-			i = cpc_find_char(root, CPC_CT_BOOTSTRAP,
-					       i);
 		}
 	}
 
-	CPC_FAIL(prv_resolve_dup_characteristics(root, CPC_CT_PXLOGICAL,
-						 CPC_PT_PROXY_ID,
-		    prv_merge_pxlogical_characteristics));
+	CPC_FAIL(prv_resolve_dup_characteristics(
+			 &index->chars[CPC_CT_PXLOGICAL], CPC_CT_PXLOGICAL,
+			 CPC_PT_PROXY_ID,
+			 prv_merge_pxlogical_characteristics));
+
+	CPC_FAIL(prv_validate_napdef_refs(index));
+	CPC_FAIL(prv_validate_access_rules(index));
 
-	CPC_FAIL(prv_validate_napdef_refs(root));
-	CPC_FAIL(prv_validate_access_rules(root));
+	prv_sweep_root(root);
 
 	if (cpc_get_char_count(root) == 0)
 		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 
-	CPC_FAIL_FORCE(prv_bind_unlinked_apps(root));
+	CPC_FAIL_FORCE(prv_bind_unlinked_apps(root, index));
 
 CPC_ON_ERR:
 
@@ -3016,7 +3421,7 @@ static void prv_dump_characteristic(cpc_characteristic_t *root,
 				CPC_LOGUF("%sParameter: %s  \"%s\"",
 					       depth_str,
 					       g_param_string_map[l].string,
-					       param->utf8_value,transient);
+					       cpc_get_utf8(param),transient);
 		}
 	}
 
@@ -3030,27 +3435,72 @@ static void prv_dump_characteristic(cpc_characteristic_t *root,
 
 #endif
 
-static int prv_parse_characteristic(const char *prov_data,
-				    int data_length,
+/*
+ * Reads the document with pread so that the file offset, which may be shared
+ * with another process, is left untouched.  Falls back to read for
+ * descriptors that are not seekable.
+ */
+
+static int prv_read_fd(void *context, char *buffer, int len)
+{
+	cpc_fd_input_t *input = context;
+	ssize_t rcvd_len;
+
+	for (;;) {
+		if (input->offset != -1)
+			rcvd_len = pread(input->fd, buffer, len,
+					 input->offset);
+		else
+			rcvd_len = read(input->fd, buffer, len);
+
+		if (rcvd_len >= 0)
+			break;
+		else if (errno == ESPIPE && input->offset != -1)
+			input->offset = -1;
+		else if (errno != EINTR)
+			break;
+	}
+
+	if (rcvd_len < 0) {
+		CPC_LOGF("Error: Cannot read from fd %d", input->fd);
+		return -1;
+	}
+
+	if (input->offset != -1)
+		input->offset += rcvd_len;
+
+	return (int) rcvd_len;
+}
+
+/*
+ * Takes ownership of reader_ptr, which may be NULL if it could not be
+ * created.
+ */
+
+static int prv_parse_characteristic(xmlTextReaderPtr reader_ptr,
+				    cpc_provisioned_set mask,
 				    cpc_characteristic_t *root)
 {
 	CPC_ERR_MANAGE;
-	xmlTextReaderPtr reader_ptr = 0;
 	int process_node_ret = CPC_ERR_NONE;
 	int ret = 0;
 	cpc_ptr_array_t char_stack;
 	int depth_of_current_char = -1;
+	cpc_xml_error_t xml_error;
+	cpc_root_index_t index;
 
 	cpc_ptr_array_make(&char_stack, 4, NULL);
-
-	reader_ptr = xmlReaderForMemory(prov_data, data_length, "", NULL,
-				       XML_PARSE_NOENT | XML_PARSE_NOBLANKS);
+	prv_root_index_make(&index);
+	xml_error.code = XML_ERR_OK;
 
 	if (!reader_ptr) {
 		CPC_LOGF("Unable to create XMLReader");
 		CPC_FAIL_FORCE(CPC_ERR_OOM);
 	}
 
+	xmlTextReaderSetStructuredErrorHandler(reader_ptr, prv_xml_error,
+					       &xml_error);
+
 	CPC_FAIL(cpc_ptr_array_append(&char_stack, root));
 
 	do {
@@ -3058,19 +3508,24 @@ static int prv_parse_characteristic(const char *prov_data,
 		if (ret == 1)
 			process_node_ret =
 				prv_process_node(reader_ptr, &char_stack,
-						 &depth_of_current_char);
+						 &depth_of_current_char,
+						 mask, &index);
 	} while (ret == 1 && process_node_ret == CPC_ERR_NONE);
 
 	if (ret == 0 || ret == 1)
 		CPC_ERR = process_node_ret;
-	else if (xmlLastError.code == XML_ERR_NO_MEMORY)
+	else if (xml_error.code == XML_ERR_NO_MEMORY)
 		CPC_ERR = CPC_ERR_OOM;
+	else
+		CPC_ERR = CPC_ERR_CORRUPT;
 
 	if (CPC_ERR != CPC_ERR_NONE)
 		goto CPC_ON_ERR;
 
-	CPC_FAIL(prv_validate_cpc_characteristic(root));
-	CPC_FAIL(prv_perform_global_checks(root));
+	if (cpc_get_char_count(root) == 0)
+		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
+
+	CPC_FAIL(prv_perform_global_checks(root, &index));
 
 #ifdef CPC_LOGGING
 	prv_dump_characteristic(root, 0);
@@ -3078,8 +3533,10 @@ static int prv_parse_characteristic(const char *prov_data,
 
 CPC_ON_ERR:
 
-	xmlFreeTextReader(reader_ptr);
+	if (reader_ptr)
+		xmlFreeTextReader(reader_ptr);
 	cpc_ptr_array_free(&char_stack);
+	prv_root_index_free(&index);
 
 #ifdef CPC_LOGGING
 	if (CPC_ERR != CPC_ERR_NONE)
@@ -3089,17 +3546,21 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-int cpc_characteristic_new(const char *prov_data, int data_length,
-			   cpc_characteristic_t **characteristic)
+static int prv_characteristic_new(xmlTextReaderPtr reader_ptr,
+				  cpc_provisioned_set mask,
+				  cpc_characteristic_t **characteristic)
 {
 	CPC_ERR_MANAGE;
-	cpc_characteristic_t *root;
+	cpc_characteristic_t *root = NULL;
 
 	CPC_FAIL_NULL(root, malloc(sizeof(cpc_characteristic_t)), CPC_ERR_OOM);
 
 	prv_characteristic_make(root, CPC_CT_ROOT);
+	CPC_FAIL_NULL(root->strings, xmlDictCreate(), CPC_ERR_OOM);
 
-	CPC_FAIL(prv_parse_characteristic(prov_data, data_length, root));
+	CPC_ERR = prv_parse_characteristic(reader_ptr, mask, root);
+	reader_ptr = NULL;
+	CPC_FAIL(CPC_ERR);
 
 	*characteristic = root;
 
@@ -3107,13 +3568,161 @@ int cpc_characteristic_new(const char *prov_data, int data_length,
 
 CPC_ON_ERR:
 
+	if (reader_ptr)
+		xmlFreeTextReader(reader_ptr);
 	prv_wap_char_free(root);
 
 	return CPC_ERR;
 }
 
+int cpc_characteristic_new(const char *prov_data, int data_length,
+			   cpc_provisioned_set mask,
+			   cpc_characteristic_t **characteristic)
+{
+	return prv_characteristic_new(
+		xmlReaderForMemory(prov_data, data_length, "", NULL,
+				   XML_PARSE_NOENT | XML_PARSE_NOBLANKS),
+		mask, characteristic);
+}
+
+int cpc_characteristic_new_from_fd(int fd, cpc_provisioned_set mask,
+				   cpc_characteristic_t **characteristic)
+{
+	cpc_fd_input_t input;
+
+	input.fd = fd;
+	input.offset = 0;
+
+	return prv_characteristic_new(
+		xmlReaderForIO(prv_read_fd, NULL, &input, "", NULL,
+			       XML_PARSE_NOENT | XML_PARSE_NOBLANKS),
+		mask, characteristic);
+}
+
+static void prv_measure_characteristic(cpc_characteristic_t *characteristic,
+				       unsigned int *node_count,
+				       unsigned int *param_count)
+{
+	unsigned int i;
+
+	++*node_count;
+	*param_count += cpc_get_param_count(characteristic);
+
+	for (i = 0; i < cpc_get_char_count(characteristic); ++i)
+		prv_measure_characteristic(cpc_get_char(characteristic, i),
+					   node_count, param_count);
+}
+
+static void prv_freeze_characteristic(cpc_freezer_t *freezer,
+				      cpc_characteristic_t *from,
+				      cpc_characteristic_t *to)
+{
+	unsigned int i;
+	unsigned int count;
+	void **pointers;
+	cpc_parameter_t *param;
+	cpc_characteristic_t *children;
+
+	to->type = from->type;
+	to->deleted = false;
+	to->frozen = true;
+	to->param_index = NULL;
+	to->char_index = NULL;
+	to->strings = from->strings;
+
+	count = cpc_get_param_count(from);
+	pointers = freezer->pointers;
+	freezer->pointers += count;
+
+	for (i = 0; i < count; ++i) {
+		param = freezer->params++;
+		*param = *cpc_get_param(from, i);
+		pointers[i] = param;
+	}
+
+	cpc_ptr_array_make_from(&to->parameters, pointers, count, 8, NULL);
+
+	count = cpc_get_char_count(from);
+	pointers = freezer->pointers;
+	freezer->pointers += count;
+	children = freezer->nodes;
+	freezer->nodes += count;
+
+	for (i = 0; i < count; ++i)
+		pointers[i] = &children[i];
+
+	cpc_ptr_array_make_from(&to->characteristics, pointers, count, 4,
+				NULL);
+
+	for (i = 0; i < count; ++i)
+		prv_freeze_characteristic(freezer, cpc_get_char(from, i),
+					  &children[i]);
+}
+
+int cpc_characteristic_freeze(cpc_characteristic_t **characteristic)
+{
+	CPC_ERR_MANAGE;
+	cpc_frozen_char_t *frozen;
+	cpc_freezer_t freezer;
+	unsigned int node_count = 0;
+	unsigned int param_count = 0;
+	size_t nodes_size;
+
+	if ((*characteristic)->frozen)
+		goto CPC_ON_ERR;
+
+	prv_measure_characteristic(*characteristic, &node_count,
+				   &param_count);
+
+	nodes_size = offsetof(cpc_frozen_char_t, nodes) +
+		node_count * sizeof(cpc_characteristic_t);
+
+	CPC_FAIL_NULL(frozen,
+		      malloc(nodes_size +
+			     (node_count - 1 + param_count) * sizeof(void *) +
+			     param_count * sizeof(cpc_parameter_t)),
+		      CPC_ERR_OOM);
+
+	frozen->node_count = node_count;
+
+	freezer.nodes = &frozen->nodes[1];
+	freezer.pointers = (void **) ((char *) frozen + nodes_size);
+	freezer.params = (cpc_parameter_t *)
+		(freezer.pointers + node_count - 1 + param_count);
+
+	prv_freeze_characteristic(&freezer, *characteristic,
+				  &frozen->nodes[0]);
+
+	(*characteristic)->strings = NULL;
+	prv_wap_char_free(*characteristic);
+	*characteristic = &frozen->nodes[0];
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+static void prv_frozen_free(cpc_characteristic_t *characteristic)
+{
+	cpc_frozen_char_t *frozen = (cpc_frozen_char_t *)
+		((char *) characteristic - offsetof(cpc_frozen_char_t, nodes));
+	unsigned int i;
+
+	for (i = 0; i < frozen->node_count; ++i) {
+		free(frozen->nodes[i].param_index);
+		free(frozen->nodes[i].char_index);
+	}
+
+	if (frozen->nodes[0].strings)
+		xmlDictFree(frozen->nodes[0].strings);
+	free(frozen);
+}
+
 void cpc_characteristic_delete(cpc_characteristic_t *characteristic)
 {
-	prv_wap_char_free(characteristic);
+	if (characteristic && characteristic->frozen)
+		prv_frozen_free(characteristic);
+	else
+		prv_wap_char_free(characteristic);
 }
 
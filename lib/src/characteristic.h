@@ -46,10 +46,12 @@ extern "C" {
 #include <stdbool.h>
 #include <libxml/xmlreader.h>
 #include <libxml/xmlerror.h>
+#include <libxml/dict.h>
 
 #include <stdint.h>
 
 #include "ptr-array.h"
+#include "context.h"
 
 enum cpc_characteristic_type_t_ {
 	CPC_CT_ACCESS,
@@ -176,7 +178,8 @@ enum cpc_param_type_t_ {
 	CPC_PT_T_BIT,
 	CPC_PT_URI,
 	CPC_PT_VALIDUNTIL,
-	CPC_PT_WSP_VERSION
+	CPC_PT_WSP_VERSION,
+	CPC_PT_MAX
 };
 
 typedef enum cpc_param_type_t_ cpc_param_type_t;
@@ -191,22 +194,53 @@ enum cpc_param_data_type_t_ {
 
 typedef enum cpc_param_data_type_t_ cpc_param_data_type_t;
 
+/*
+ * Most parameter values are short, e.g., ids, port numbers and APPIDs.
+ * UTF8 values that fit in CPC_PARAM_INLINE_SIZE bytes, including the
+ * terminating NUL, are stored inside the parameter itself.  Longer values
+ * are interned in the string pool of the document, so parameters with the
+ * same value share a single read only copy.  Use cpc_get_utf8 to read
+ * either.
+ */
+
+#define CPC_PARAM_INLINE_SIZE 16
+
 typedef struct cpc_parameter_t_ cpc_parameter_t;
 struct cpc_parameter_t_ {
 	cpc_param_type_t type;
 	cpc_param_data_type_t data_type;
 	bool transient;
+	bool utf8_is_inline;
 	union {
 		unsigned int int_value;
-		xmlChar *utf8_value;
+		const xmlChar *utf8_shared;
+		xmlChar utf8_inline[CPC_PARAM_INLINE_SIZE];
 	};
 };
 
 typedef struct cpc_characteristic_t_ cpc_characteristic_t;
 struct cpc_characteristic_t_ {
 	cpc_characteristic_type_t type;
+	bool deleted;
+	bool frozen;
 	cpc_ptr_array_t parameters;
 	cpc_ptr_array_t characteristics;
+
+	/*
+	 * Indices used by cpc_find_param and cpc_find_char.  They are built
+	 * on demand and discarded whenever parameters or characteristics are
+	 * modified.
+	 */
+
+	int16_t *param_index;
+	int16_t *char_index;
+
+	/*
+	 * The pool holding the values of all the parameters in the document
+	 * that are too long to be stored inline.  Only set on the root.
+	 */
+
+	xmlDictPtr strings;
 };
 
 
@@ -225,6 +259,9 @@ void cpc_characteristic_delete(cpc_characteristic_t *characteristic);
  *
  * @param prov_data a pointer to an in memory document.
  * @param data_length length in bytes of the in memory XML document
+ * @param mask the types of application to keep.  APPLICATION
+ * characteristics whose APPID maps to a type outside of mask are skipped
+ * as they are read.
  * @param characteristic The in memory model is returned via this parameter,
  * if the function succeeds.  The caller needs to delete this model by calling
  * cpc_characteristic_delete when it is finished with it.
@@ -239,10 +276,49 @@ void cpc_characteristic_delete(cpc_characteristic_t *characteristic);
  */
 
 int cpc_characteristic_new(const char *prov_data, int data_length,
+			   cpc_provisioned_set mask,
 			   cpc_characteristic_t **characteristic);
 
+/*!
+ * @brief Like cpc_characteristic_new but reads the XML document from fd in
+ * small chunks, so that the document never needs to be held in memory in
+ * its entirety.
+ *
+ * @param fd A descriptor from which the document is read.  The document is
+ * read from offset 0 if fd is seekable, in which case the file offset of fd
+ * is not modified.  fd is not closed.
+ * @param mask the types of application to keep.
+ * @param characteristic The in memory model is returned via this parameter,
+ * if the function succeeds.
+ *
+ * @return CPC_ERR_NONE, CPC_ERR_OOM or CPC_ERR_CORRUPT as for
+ * cpc_characteristic_new.  Read errors are reported as CPC_ERR_CORRUPT.
+ */
+
+int cpc_characteristic_new_from_fd(int fd, cpc_provisioned_set mask,
+				   cpc_characteristic_t **characteristic);
+
 
 
+/*!
+ * @brief Replaces a parsed characteristic tree with a compact, read only
+ * copy.
+ *
+ * All the nodes of the copy are stored in a single array, in which the
+ * children of each node are adjacent.  The parameters are stored in the
+ * same allocation, so walking the tree touches far fewer cache lines.
+ * The copy takes over the string pool of the original document.  It can
+ * be read with the usual accessors but must not be modified.
+ *
+ * @param characteristic The root of the tree to freeze.  On success it is
+ * deleted and replaced by the root of the copy.  On failure it is left
+ * untouched and remains valid.
+ *
+ * @return CPC_ERR_NONE or CPC_ERR_OOM.
+ */
+
+int cpc_characteristic_freeze(cpc_characteristic_t **characteristic);
+
 /*!
  * @brief Returns the number of parameters defined for a given characteristic
  *
@@ -267,6 +343,19 @@ int cpc_characteristic_new(const char *prov_data, int data_length,
 	((cpc_parameter_t*) \
 	 cpc_ptr_array_get(&(characteristic)->parameters,index))
 
+/*!
+ * @brief Retrieves the value of a UTF8 parameter
+ *
+ * @param param Parameter whose data_type is CPC_WPDT_UTF8
+ *
+ * @return The value of the parameter.  It is owned by param or by the
+ * document and must not be modified.
+ */
+
+#define cpc_get_utf8(param) \
+	((param)->utf8_is_inline ? (const xmlChar *) (param)->utf8_inline : \
+	 (param)->utf8_shared)
+
 /*!
  * @brief Returns the number of child characteristics owned by a given
  * characteristic
@@ -300,6 +389,10 @@ int cpc_characteristic_new(const char *prov_data, int data_length,
  * @param index The posisition from which to begin the search.
  *              E.g., a value of 5 means start checking from the 5th parameter.
  *
+ * The first call builds an index of the parameters of characteristic by
+ * type, so that subsequent calls only visit parameters of the requested
+ * type.
+ *
  * @return -1 indicates that a parameter of the specified type cannot be found
  * @return >=0 the index of the parameter.
  */
@@ -526,16 +526,16 @@ static int prv_map_napauth(cpc_napdef_t *napdef,
 			prv_map_string_to_uint(auth_type_map,
 					       sizeof(auth_type_map)/
 					       sizeof(string_int_map_t),
-					       param->utf8_value,
+					       cpc_get_utf8(param),
 					       CPC_ND_AUTHTYPE_NOT_SET,
 					       &nd_auth->auth_type);
 		} else if (param->type == CPC_PT_AUTHNAME) {
 			CPC_FAIL_NULL(nd_auth->auth_id,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 		} else if (param->type == CPC_PT_AUTHSECRET) {
 			CPC_FAIL_NULL(nd_auth->auth_pw,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 		}
 	}
@@ -628,7 +628,7 @@ static int prv_map_proxy_ports(cpc_physical_proxy_t *pxp,
 						service_map,
 						sizeof(service_map)/
 						sizeof(string_int_map_t),
-						param->utf8_value,
+						cpc_get_utf8(param),
 						CPC_PROXY_PORTSERVICE_NOT_SET,
 						&port->service);
 					++services;
@@ -737,7 +737,7 @@ static int prv_map_physical_proxy(cpc_context_t *context,
 		case CPC_PT_PXADDR:
 		{
 			CPC_FAIL_NULL(pxp->address,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 
 			break;
@@ -748,7 +748,7 @@ static int prv_map_physical_proxy(cpc_context_t *context,
 			prv_map_string_to_uint(px_type_map,
 					       sizeof(px_type_map)/
 					       sizeof(string_int_map_t),
-					       param->utf8_value,
+					       cpc_get_utf8(param),
 					       CPC_PROXY_ADDRTYPE_NOT_SET,
 					       &pxp->address_type);
 			break;
@@ -758,7 +758,7 @@ static int prv_map_physical_proxy(cpc_context_t *context,
 		{
 			CPC_FAIL(prv_map_to_napid(context, &pxp->napdefs,
 						  (const char*)
-						  param->utf8_value));
+						  cpc_get_utf8(param)));
 			break;
 		}
 
@@ -806,21 +806,21 @@ static int prv_map_proxy(cpc_context_t *context, cpc_characteristic_t *cristic)
 		case CPC_PT_PROXY_ID:
 		{
 			CPC_FAIL_NULL(proxy->id,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
 		case CPC_PT_NAME:
 		{
 			CPC_FAIL_NULL(proxy->name,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
 		case CPC_PT_STARTPAGE:
 		{
 			CPC_FAIL_NULL(proxy->start_page,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
@@ -841,16 +841,16 @@ static int prv_map_proxy(cpc_context_t *context, cpc_characteristic_t *cristic)
 			{
 			case CPC_PT_PXAUTH_ID:
 			{
-				CPC_FAIL_NULL(proxy->auth_id,
-					      strdup((char*) param->utf8_value),
+				CPC_FAIL_NULL(proxy->auth_id, strdup((char *)
+				      cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 
 				break;
 			}
 			case CPC_PT_PXAUTH_PW:
 			{
-				CPC_FAIL_NULL(proxy->auth_pw,
-					      strdup((char*) param->utf8_value),
+				CPC_FAIL_NULL(proxy->auth_pw, strdup((char *)
+				      cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			}
@@ -860,7 +860,7 @@ static int prv_map_proxy(cpc_context_t *context, cpc_characteristic_t *cristic)
 					px_type_map,
 					sizeof(px_type_map)/
 					sizeof(string_int_map_t),
-					param->utf8_value,
+					cpc_get_utf8(param),
 					CPC_PROXY_AUTHTYPE_NOT_SET,
 					&proxy->auth_type);
 				break;
@@ -932,7 +932,7 @@ static int prv_map_napdef(cpc_context_t *context,
 			prv_map_string_to_uint(bearer_map,
 					       sizeof(bearer_map)/
 					       sizeof(string_int_map_t),
-					       param->utf8_value,
+					       cpc_get_utf8(param),
 					       CPC_ND_BEARER_NOT_SET,
 					       &napdef->bearer);
 				++bearers;
@@ -941,14 +941,14 @@ static int prv_map_napdef(cpc_context_t *context,
 		case CPC_PT_NAME:
 		{
 			CPC_FAIL_NULL(napdef->name,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
 		case CPC_PT_NAP_ADDRESS:
 		{
 			CPC_FAIL_NULL(napdef->address,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
@@ -957,7 +957,7 @@ static int prv_map_napdef(cpc_context_t *context,
 			prv_map_string_to_uint(address_type_map,
 					       sizeof(address_type_map)/
 					       sizeof(string_int_map_t),
-					       param->utf8_value,
+					       cpc_get_utf8(param),
 					       CPC_ND_ADDRESSTYPE_NOT_SET,
 					       &napdef->address_type);
 			break;
@@ -965,7 +965,7 @@ static int prv_map_napdef(cpc_context_t *context,
 		case CPC_PT_LOCAL_ADDR:
 		{
 			CPC_FAIL_NULL(napdef->local_address,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
@@ -974,7 +974,7 @@ static int prv_map_napdef(cpc_context_t *context,
 			prv_map_string_to_uint(local_address_type_map,
 					       sizeof(local_address_type_map)/
 					       sizeof(string_int_map_t),
-					       param->utf8_value,
+					       cpc_get_utf8(param),
 					       CPC_ND_LOCALADDRESSTYPE_NOT_SET,
 					       &napdef->local_address_type);
 			break;
@@ -987,7 +987,7 @@ static int prv_map_napdef(cpc_context_t *context,
 		case CPC_PT_DNS_ADDR:
 		{
 			CPC_FAIL_NULL(buffer,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			CPC_FAIL(cpc_ptr_array_append(&napdef->dns_addresses,
 						      buffer));
@@ -999,7 +999,7 @@ static int prv_map_napdef(cpc_context_t *context,
 			/* Can only be one and it must exist */
 
 			CPC_FAIL_NULL(napdef->id,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
@@ -1056,7 +1056,7 @@ static int prv_map_mms(cpc_context_t *context,
 			{
 				CPC_FAIL_NULL(mms->mms.mmsc,
 					      strdup((const char*)
-						     param->utf8_value),
+						     cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				++addr;
 			}
@@ -1067,7 +1067,7 @@ static int prv_map_mms(cpc_context_t *context,
 			CPC_FAIL(prv_map_to_proxyid(context,
 						    &mms->mms.connectoids,
 						    (const char*)
-						    param->utf8_value));
+						    cpc_get_utf8(param)));
 			break;
 		}
 		case CPC_PT_TO_NAPID:
@@ -1075,7 +1075,7 @@ static int prv_map_mms(cpc_context_t *context,
 			CPC_FAIL(prv_map_to_napid(context,
 						  &mms->mms.connectoids,
 						  (const char*)
-						  param->utf8_value));
+						  cpc_get_utf8(param)));
 			break;
 		}
 		default:
@@ -1134,8 +1134,8 @@ static int prv_add_email_account(cpc_ptr_array_t *accounts, bool incoming,
 				continue;
 
 			provid1 = cpc_get_param(*dst, param_index);
-			if (xmlStrcmp(provid1->utf8_value, provid2->utf8_value)
-			    == 0) {
+			if (xmlStrcmp(cpc_get_utf8(provid1),
+				      cpc_get_utf8(provid2)) == 0) {
 				duplicate = true;
 				break;
 			} else {
@@ -1150,7 +1150,8 @@ static int prv_add_email_account(cpc_ptr_array_t *accounts, bool incoming,
 		provid1 = cpc_get_param(src, param_index);
 
 
-		if (xmlStrcmp(provid1->utf8_value, provid2->utf8_value) == 0)
+		if (xmlStrcmp(cpc_get_utf8(provid1),
+			      cpc_get_utf8(provid2)) == 0)
 			break;
 	}
 
@@ -1190,7 +1191,7 @@ static void prv_get_app_address_and_port(cpc_characteristic_t *cristic,
 	index = cpc_find_param(cristic, CPC_PT_ADDR, 0);
 	if (index != -1) {
 		param = cpc_get_param(cristic, index);
-		addr = (const char *) param->utf8_value;
+		addr = (const char *) cpc_get_utf8(param);
 	}
 
 	index = cpc_find_char(cristic, CPC_CT_APPADDR, 0);
@@ -1202,7 +1203,7 @@ static void prv_get_app_address_and_port(cpc_characteristic_t *cristic,
 			index = cpc_find_param(wap_char, CPC_PT_ADDR, 0);
 			if (index != -1) {
 				param = cpc_get_param(wap_char, index);
-				addr = (const char *) param->utf8_value;
+				addr = (const char *) cpc_get_utf8(param);
 			}
 		}
 
@@ -1221,7 +1222,7 @@ static void prv_get_app_address_and_port(cpc_characteristic_t *cristic,
 			if (index != -1)
 			{
 				param = cpc_get_param(wap_char,index);
-				svc = (const char *)param->utf8_value;
+				svc = (const char *)cpc_get_utf8(param);
 			}
 		}
 	}
@@ -1276,7 +1277,7 @@ static int prv_map_email_transport(cpc_context_t *context,
 		{
 			param = cpc_get_param(wap_char, index);
 			CPC_FAIL_NULL(transport->user_name,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 		}
 
@@ -1285,7 +1286,7 @@ static int prv_map_email_transport(cpc_context_t *context,
 		{
 			param = cpc_get_param(wap_char, index);
 			CPC_FAIL_NULL(transport->password,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 		}
 
@@ -1296,7 +1297,7 @@ static int prv_map_email_transport(cpc_context_t *context,
 			prv_map_string_to_uint(auth_type_map,
 					       sizeof(auth_type_map)/
 					       sizeof(string_int_map_t),
-					       param->utf8_value,
+					       cpc_get_utf8(param),
 					       CPC_EMAIL_AUTH_TYPE_NOT_SET,
 					       &transport->auth_type);
 		}
@@ -1327,7 +1328,7 @@ static int prv_map_email(cpc_context_t *context, email_account_t *acc)
 
 		index = cpc_find_param(acc->incoming, CPC_PT_APPID, 0);
 		param = cpc_get_param(acc->incoming, index);
-		if (xmlStrcmp(param->utf8_value, (const xmlChar*) "110")) {
+		if (xmlStrcmp(cpc_get_utf8(param), (const xmlChar*) "110")) {
 			email->email.incoming->server_type =
 				CPC_EMAIL_SERVER_IMAP;
 			ssl_service = "993";
@@ -1345,7 +1346,7 @@ static int prv_map_email(cpc_context_t *context, email_account_t *acc)
 		{
 			param = cpc_get_param(acc->incoming, index);
 			CPC_FAIL_NULL(email->email.name,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 		}
 
@@ -1354,7 +1355,7 @@ static int prv_map_email(cpc_context_t *context, email_account_t *acc)
 		{
 			param = cpc_get_param(acc->incoming, index);
 			CPC_FAIL_NULL(email->email.id,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 		}
 	}
@@ -1375,7 +1376,7 @@ static int prv_map_email(cpc_context_t *context, email_account_t *acc)
 					continue;
 				CPC_FAIL_NULL(email->email.name,
 					      strdup((const char*)
-						     param->utf8_value),
+						     cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			case CPC_PT_PROVIDER_ID:
@@ -1383,13 +1384,13 @@ static int prv_map_email(cpc_context_t *context, email_account_t *acc)
 					continue;
 				CPC_FAIL_NULL(email->email.id,
 					      strdup((const char*)
-						     param->utf8_value),
+						     cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			case CPC_PT_FROM:
 				CPC_FAIL_NULL(email->email.email_address,
 					      strdup((const char*)
-						     param->utf8_value),
+						     cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			default:
@@ -1433,18 +1434,18 @@ static int prv_set_syncml_cred(cpc_syncml_creds_t *cred,
 			param = cpc_get_param(app_auth, i);
 			switch (param->type) {
 			case CPC_PT_AAUTHDATA:
-				CPC_FAIL_NULL(cred->nonce,
-					      strdup((char*) param->utf8_value),
+				CPC_FAIL_NULL(cred->nonce, strdup((char *)
+				      cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			case CPC_PT_AAUTHNAME:
-				CPC_FAIL_NULL(cred->user_name,
-					      strdup((char*) param->utf8_value),
+				CPC_FAIL_NULL(cred->user_name, strdup((char *)
+				      cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			case CPC_PT_AAUTHSECRET:
-				CPC_FAIL_NULL(cred->password,
-					      strdup((char*) param->utf8_value),
+				CPC_FAIL_NULL(cred->password, strdup((char *)
+				      cpc_get_utf8(param)),
 					      CPC_ERR_OOM);
 				break;
 			case CPC_PT_AAUTHTYPE:
@@ -1452,7 +1453,7 @@ static int prv_set_syncml_cred(cpc_syncml_creds_t *cred,
 					auth_type_map,
 					sizeof(auth_type_map)/
 					sizeof(string_int_map_t),
-					param->utf8_value,
+					cpc_get_utf8(param),
 					CPC_SYNCML_AUTH_TYPE_NOT_SET,
 					&cred->auth_type);
 				break;
@@ -1487,10 +1488,10 @@ static int prv_add_syncml_creds(cpc_context_t *context,
 			CPC_FAIL(prv_set_syncml_cred(http, wap_char));
 		else {
 			param = cpc_get_param(wap_char, param_index);
-			if (xmlStrcmp(param->utf8_value,
+			if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "APPSRV") == 0)
 				CPC_FAIL(prv_set_syncml_cred(server, wap_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 					   (const xmlChar*) "CLIENT") == 0)
 				CPC_FAIL(prv_set_syncml_cred(client, wap_char));
 		}
@@ -1515,22 +1516,22 @@ static int prv_add_omads_db(cpc_characteristic_t *wap_char, cpc_syncml_db_t *db)
 		switch (param->type) {
 		case CPC_PT_AACCEPT:
 			CPC_FAIL_NULL(db->accept_types,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_URI:
 			CPC_FAIL_NULL(db->uri,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_CLIURI:
 			CPC_FAIL_NULL(db->cli_uri,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_NAME:
 			CPC_FAIL_NULL(db->name,
-				      strdup((char*) param->utf8_value),
+				      strdup((char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 
 			break;
@@ -1595,14 +1596,14 @@ static int prv_add_syncml_settings(cpc_context_t *context,
 		case CPC_PT_NAME:
 		{
 			CPC_FAIL_NULL(syncml->name, strdup((const char*)
-							   param->utf8_value),
+							   cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
 		case CPC_PT_PROVIDER_ID:
 		{
 			CPC_FAIL_NULL(syncml->server_id,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		}
@@ -1611,7 +1612,7 @@ static int prv_add_syncml_settings(cpc_context_t *context,
 			CPC_FAIL(prv_map_to_proxyid(context,
 						    &syncml->connectoids,
 						    (const char*)
-						    param->utf8_value));
+						    cpc_get_utf8(param)));
 			break;
 		}
 		case CPC_PT_TO_NAPID:
@@ -1619,7 +1620,7 @@ static int prv_add_syncml_settings(cpc_context_t *context,
 			CPC_FAIL(prv_map_to_napid(context,
 						  &syncml->connectoids,
 						  (const char*)
-						  param->utf8_value));
+						  cpc_get_utf8(param)));
 			break;
 		}
 
@@ -1709,22 +1710,22 @@ static int prv_add_bookmark(cpc_browser_t *browser,
 		{
 		case CPC_PT_NAME:
 			CPC_FAIL_NULL(bookmark->name, strdup((const char*)
-							     param->utf8_value),
+						      cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_URI:
 			CPC_FAIL_NULL(bookmark->url, strdup((const char*)
-							    param->utf8_value),
+						      cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_AAUTHNAME:
 			CPC_FAIL_NULL(bookmark->user_name,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_AAUTHSECRET:
 			CPC_FAIL_NULL(bookmark->password,
-				      strdup((const char*) param->utf8_value),
+				      strdup((const char*) cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_STARTPAGE:
@@ -1771,20 +1772,20 @@ static int prv_add_browser_settings(cpc_context_t *context,
 		{
 		case CPC_PT_NAME:
 			CPC_FAIL_NULL(browser->name, strdup((const char*)
-							    param->utf8_value),
+						      cpc_get_utf8(param)),
 				      CPC_ERR_OOM);
 			break;
 		case CPC_PT_TO_PROXY:
 			CPC_FAIL(prv_map_to_proxyid(context,
 						    &browser->connectoids,
 						    (const char*)
-						    param->utf8_value));
+						    cpc_get_utf8(param)));
 			break;
 		case CPC_PT_TO_NAPID:
 			CPC_FAIL(prv_map_to_napid(context,
 						  &browser->connectoids,
 						  (const char*)
-						  param->utf8_value));
+						  cpc_get_utf8(param)));
 		default:
 			break;
 		}
@@ -1856,30 +1857,30 @@ static int prv_import_characteristic(cpc_context_t *context,
 
 			param = cpc_get_param(cp_char, param_index);
 
-			if (xmlStrcmp(param->utf8_value,
+			if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "w4") == 0)
 				CPC_FAIL(prv_map_mms(context, cp_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "110") == 0)
 				CPC_FAIL(prv_add_email_account(&email_accounts,
 							       true, cp_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "143") == 0)
 				CPC_FAIL(prv_add_email_account(&email_accounts,
 							       true, cp_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "25") == 0)
 				CPC_FAIL(prv_add_email_account(&email_accounts,
 							       false, cp_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "w5") == 0)
 				CPC_FAIL(prv_add_omads_account(context,
 							       cp_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 				      (const xmlChar*) "w7") == 0)
 				CPC_FAIL(prv_add_omadm_account(context,
 							       cp_char));
-			else if (xmlStrcmp(param->utf8_value,
+			else if (xmlStrcmp(cpc_get_utf8(param),
 					   (const xmlChar*) "w2") == 0)
 				CPC_FAIL(prv_add_browser_settings(context,
 								  cp_char));
@@ -2163,12 +2164,13 @@ static void prv_context_dump(cpc_context_t *context)
 }
 #endif
 
-int cpc_context_new(const char *prov_data, int data_length,
-		    cpc_context_t **context)
+/* Takes ownership of cristic */
+
+static int prv_context_new(cpc_characteristic_t *cristic,
+			   cpc_context_t **context)
 {
 	CPC_ERR_MANAGE;
 	cpc_context_t *retval;
-	cpc_characteristic_t *cristic = NULL;
 
 	CPC_FAIL_NULL(retval, malloc(sizeof(*retval)), CPC_ERR_OOM);
 	cpc_ptr_array_make(&retval->napdefs, CPC_CONTEXT_BLOCK_SIZE,
@@ -2178,7 +2180,14 @@ int cpc_context_new(const char *prov_data, int data_length,
 	cpc_ptr_array_make(&retval->applications, CPC_CONTEXT_BLOCK_SIZE,
 			   prv_application_delete);
 
-	CPC_FAIL(cpc_characteristic_new(prov_data, data_length, &cristic));
+	/*
+	 * The tree is only read from now on.  Mapping a compact copy is
+	 * faster, and if there is not enough memory to make one we simply
+	 * map the original.
+	 */
+
+	(void) cpc_characteristic_freeze(&cristic);
+
 	CPC_FAIL(prv_import_characteristic(retval, cristic));
 
 #ifdef CPC_LOGGING
@@ -2196,6 +2205,35 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
+int cpc_context_new(const char *prov_data, int data_length,
+		    cpc_provisioned_set mask, cpc_context_t **context)
+{
+	CPC_ERR_MANAGE;
+	cpc_characteristic_t *cristic;
+
+	CPC_FAIL(cpc_characteristic_new(prov_data, data_length, mask,
+					&cristic));
+	CPC_FAIL(prv_context_new(cristic, context));
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+int cpc_context_new_from_fd(int fd, cpc_provisioned_set mask,
+			    cpc_context_t **context)
+{
+	CPC_ERR_MANAGE;
+	cpc_characteristic_t *cristic;
+
+	CPC_FAIL(cpc_characteristic_new_from_fd(fd, mask, &cristic));
+	CPC_FAIL(prv_context_new(cristic, context));
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
 void cpc_provisioned_set_iterator_make(cpc_provisioned_set set,
 					 cpc_provisioned_set_iter* iter)
 {
@@ -2268,3 +2306,115 @@ CPC_ON_ERR:
 
 	return CPC_ERR;
 }
+
+/*
+ * Computes the same summary as cpc_context_analyse, directly from the
+ * characteristic tree.  The rules mirror prv_import_characteristic: every
+ * NAPDEF and PXLOGICAL characteristic is mapped, applications are identified
+ * by their first APPID and a DM account's server id is its last PROVIDER-ID.
+ */
+
+static int prv_summarise_characteristic(cpc_characteristic_t *cristic,
+					cpc_provisioned_set *set,
+					cpc_ptr_array_t *sessions)
+{
+	CPC_ERR_MANAGE;
+	unsigned int i;
+	unsigned int j;
+	int param_index;
+	cpc_characteristic_t *cp_char;
+	cpc_parameter_t *param;
+	const xmlChar *appid;
+	const xmlChar *server_id;
+	char *session;
+
+	for (i = 0; i < cpc_get_char_count(cristic); ++i) {
+		cp_char = cpc_get_char(cristic, i);
+
+		if (cp_char->type == CPC_CT_NAPDEF) {
+			*set |= CPC_TYPE_CONNECTION_PROFILE;
+			continue;
+		} else if (cp_char->type == CPC_CT_PXLOGICAL) {
+			*set |= CPC_TYPE_PROXY;
+			continue;
+		} else if (cp_char->type != CPC_CT_APPLICATION) {
+			continue;
+		}
+
+		param_index = cpc_find_param(cp_char, CPC_PT_APPID, 0);
+		if (param_index == -1)
+			continue;
+
+		appid = cpc_get_utf8(cpc_get_param(cp_char, param_index));
+
+		if (xmlStrcmp(appid, (const xmlChar*) "w4") == 0) {
+			*set |= CPC_TYPE_MMS;
+		} else if ((xmlStrcmp(appid, (const xmlChar*) "110") == 0) ||
+			   (xmlStrcmp(appid, (const xmlChar*) "143") == 0) ||
+			   (xmlStrcmp(appid, (const xmlChar*) "25") == 0)) {
+			*set |= CPC_TYPE_EMAIL;
+		} else if (xmlStrcmp(appid, (const xmlChar*) "w5") == 0) {
+			*set |= CPC_TYPE_OMADS;
+		} else if (xmlStrcmp(appid, (const xmlChar*) "w2") == 0) {
+			*set |= CPC_TYPE_BROWSER;
+		} else if (xmlStrcmp(appid, (const xmlChar*) "w7") == 0) {
+			*set |= CPC_TYPE_OMADM;
+			if (cpc_find_param(cp_char, CPC_PT_INIT, 0) == -1)
+				continue;
+
+			server_id = NULL;
+			for (j = 0; j < cpc_get_param_count(cp_char); ++j) {
+				param = cpc_get_param(cp_char, j);
+				if (param->type == CPC_PT_PROVIDER_ID)
+					server_id = cpc_get_utf8(param);
+			}
+
+			if (!server_id)
+				continue;
+
+			CPC_FAIL_NULL(session, strdup((const char*) server_id),
+				      CPC_ERR_OOM);
+			CPC_ERR = cpc_ptr_array_append(sessions, session);
+			if (CPC_ERR != CPC_ERR_NONE) {
+				free(session);
+				goto CPC_ON_ERR;
+			}
+		}
+	}
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+int cpc_context_summarise(const char *prov_data, int data_length,
+			  cpc_provisioned_set mask, cpc_provisioned_set *set,
+			  cpc_ptr_array_t **start_sessions)
+{
+	CPC_ERR_MANAGE;
+	cpc_characteristic_t *cristic = NULL;
+	cpc_ptr_array_t *sessions = NULL;
+
+	CPC_FAIL(cpc_characteristic_new(prov_data, data_length, mask,
+					&cristic));
+
+	CPC_FAIL_NULL(sessions, malloc(sizeof(*sessions)), CPC_ERR_OOM);
+	cpc_ptr_array_make(sessions, 4, free);
+
+	*set = 0;
+	CPC_FAIL(prv_summarise_characteristic(cristic, set, sessions));
+
+	*start_sessions = sessions;
+	sessions = NULL;
+
+CPC_ON_ERR:
+
+	if (sessions) {
+		cpc_ptr_array_free(sessions);
+		free(sessions);
+	}
+
+	cpc_characteristic_delete(cristic);
+
+	return CPC_ERR;
+}
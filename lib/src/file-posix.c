@@ -36,14 +36,18 @@
  * modified and the formatting has been changed to match the cpclient coding
  * standards.
  *
- * cpc_file_get_binary is new Intel code.
+ * cpc_file_get_binary, cpc_file_map, cpc_file_map_fd and cpc_file_unmap are
+ * new Intel code.
  *****************************************************************************/
 
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -52,6 +56,17 @@
 #include "log.h"
 #include "file-peer.h"
 
+/* Only exposed by glibc when _GNU_SOURCE is defined */
+
+#if defined(__linux__) && !defined(F_GET_SEALS)
+#define F_GET_SEALS 1034
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
 static int prv_file_open_and_get_size(const char *path, int *fd,
 				      size_t *file_len)
 {
@@ -146,3 +161,151 @@ CPC_ON_ERR:
 
 	return CPC_ERR;
 }
+
+/*
+ * The buffer has room for one byte more than size_hint so that, when the
+ * hint is right, end of file is read without growing the buffer.
+ */
+
+static int prv_read_all(int fd, size_t size_hint, cpc_file_map_t *map)
+{
+	CPC_ERR_MANAGE;
+	uint8_t *buffer = NULL;
+	uint8_t *new_buffer;
+	size_t capacity = 4096;
+	size_t length = 0;
+	ssize_t rcvd_len;
+
+	if (size_hint > 0 && size_hint < SIZE_MAX)
+		capacity = size_hint + 1;
+
+	CPC_FAIL_NULL(buffer, malloc(capacity), CPC_ERR_OOM);
+
+	for (;;) {
+		if (length == capacity) {
+			capacity *= 2;
+			CPC_FAIL_NULL(new_buffer, realloc(buffer, capacity),
+				      CPC_ERR_OOM);
+			buffer = new_buffer;
+		}
+
+		rcvd_len = read(fd, buffer + length, capacity - length);
+		if (rcvd_len < 0) {
+			if (errno == EINTR)
+				continue;
+			CPC_LOGF("Error: Cannot read from fd %d", fd);
+			CPC_FAIL_FORCE(CPC_ERR_READ);
+		} else if (rcvd_len == 0) {
+			break;
+		}
+
+		length += rcvd_len;
+	}
+
+	map->data = buffer;
+	map->length = length;
+	map->mapped = false;
+
+	return CPC_ERR_NONE;
+
+CPC_ON_ERR:
+
+	free(buffer);
+
+	return CPC_ERR;
+}
+
+static bool prv_is_sealed(int fd)
+{
+#ifdef F_GET_SEALS
+	int seals = fcntl(fd, F_GET_SEALS);
+
+	return seals != -1 && (seals & F_SEAL_SHRINK);
+#else
+	return false;
+#endif
+}
+
+static int prv_map_fd(int fd, bool sealed_only, int flags,
+		      cpc_file_map_t *map)
+{
+	CPC_ERR_MANAGE;
+	struct stat stats;
+	void *data;
+
+	if (fstat(fd, &stats) < 0) {
+		CPC_LOGF("Failed to stat fd %d", fd);
+		CPC_FAIL_FORCE(CPC_ERR_OPEN);
+	}
+
+	if (S_ISREG(stats.st_mode) && stats.st_size > 0 &&
+	    (uintmax_t) stats.st_size <= SIZE_MAX &&
+	    (!sealed_only || prv_is_sealed(fd))) {
+		data = mmap(NULL, stats.st_size, PROT_READ,
+			    MAP_PRIVATE | flags, fd, 0);
+		if (data != MAP_FAILED) {
+			map->data = data;
+			map->length = stats.st_size;
+			map->mapped = true;
+			goto CPC_ON_ERR;
+		}
+		CPC_LOGF("Unable to map fd %d.  Reading instead", fd);
+	}
+
+	if (S_ISREG(stats.st_mode) && lseek(fd, 0, SEEK_SET) < 0)
+		CPC_FAIL_FORCE(CPC_ERR_READ);
+
+	CPC_FAIL(prv_read_all(fd, S_ISREG(stats.st_mode) ? stats.st_size : 0,
+			      map));
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+int cpc_file_map_fd(int fd, bool sealed_only, cpc_file_map_t *map)
+{
+	return prv_map_fd(fd, sealed_only, 0, map);
+}
+
+int cpc_file_map(const char *path, cpc_file_map_t *map)
+{
+	CPC_ERR_MANAGE;
+	int fd;
+	struct stat stats;
+	bool sealed_only;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		CPC_LOGF("Failed to open file %s", path);
+		CPC_FAIL_FORCE(CPC_ERR_OPEN);
+	}
+
+	/*
+	 * Anyone who can write to the file could truncate it while it is
+	 * mapped, and the process would be killed with SIGBUS.  Unless the
+	 * file belongs to us, it is only mapped if it is sealed.
+	 */
+
+	sealed_only = fstat(fd, &stats) < 0 || stats.st_uid != geteuid();
+
+	/* The whole file is about to be parsed so fault it in up front. */
+
+	CPC_ERR = prv_map_fd(fd, sealed_only, MAP_POPULATE, map);
+	close(fd);
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+void cpc_file_unmap(cpc_file_map_t *map)
+{
+	if (map->mapped)
+		(void) munmap(map->data, map->length);
+	else
+		free(map->data);
+
+	map->data = NULL;
+	map->length = 0;
+}
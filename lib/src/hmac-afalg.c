@@ -0,0 +1,125 @@
+/*
+ * CPClient
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file <hmac-afalg.c>
+ *
+ * @brief Contains a function that computes a SHA1 HMAC using the Linux
+ *        kernel crypto API (AF_ALG).  This allows the HMAC to be offloaded
+ *        to a hardware crypto engine on platforms that have one.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "hmac-peer.h"
+#include "error.h"
+#include "error-macros.h"
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+#define CPC_HMAC_AFALG_SHA1_LEN 20
+
+int cpc_hmac_afalg_compute(const uint8_t *key, size_t key_len,
+			   const uint8_t *data, size_t data_len, void **hmac,
+			   size_t *hmac_buffer_len)
+{
+	CPC_ERR_MANAGE;
+
+	void *hmac_buffer = NULL;
+	struct sockaddr_alg sa;
+	int tfm_fd;
+	int op_fd = -1;
+	ssize_t written;
+	ssize_t read_len;
+
+	tfm_fd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+	if (tfm_fd == -1)
+		CPC_FAIL_FORCE_LABEL(CPC_ERR_DENIED, no_socket);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	strcpy((char *) sa.salg_type, "hash");
+	strcpy((char *) sa.salg_name, "hmac(sha1)");
+
+	if (bind(tfm_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+		CPC_FAIL_FORCE(CPC_ERR_DENIED);
+
+	if (setsockopt(tfm_fd, SOL_ALG, ALG_SET_KEY, key, key_len) == -1)
+		CPC_FAIL_FORCE(CPC_ERR_DENIED);
+
+	op_fd = accept(tfm_fd, NULL, 0);
+	if (op_fd == -1)
+		CPC_FAIL_FORCE(CPC_ERR_DENIED);
+
+	CPC_FAIL_NULL(hmac_buffer, malloc(CPC_HMAC_AFALG_SHA1_LEN),
+		      CPC_ERR_OOM);
+
+	while (data_len > 0) {
+		written = send(op_fd, data, data_len, MSG_MORE);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+			CPC_FAIL_FORCE(CPC_ERR_DENIED);
+		}
+		data += written;
+		data_len -= written;
+	}
+
+	do
+		read_len = read(op_fd, hmac_buffer, CPC_HMAC_AFALG_SHA1_LEN);
+	while (read_len == -1 && errno == EINTR);
+
+	if (read_len != CPC_HMAC_AFALG_SHA1_LEN)
+		CPC_FAIL_FORCE(CPC_ERR_DENIED);
+
+	*hmac = hmac_buffer;
+	*hmac_buffer_len = CPC_HMAC_AFALG_SHA1_LEN;
+	hmac_buffer = NULL;
+
+CPC_ON_ERR:
+
+	free(hmac_buffer);
+	if (op_fd != -1)
+		close(op_fd);
+	close(tfm_fd);
+
+no_socket:
+
+	return CPC_ERR;
+}
@@ -38,8 +38,9 @@
 #include "error.h"
 #include "error-macros.h"
 
-int cpc_hmac_compute(const uint8_t *key, size_t key_len, const uint8_t *data,
-		     size_t data_len, void **hmac, size_t *hmac_buffer_len)
+int cpc_hmac_gnutls_compute(const uint8_t *key, size_t key_len,
+			    const uint8_t *data, size_t data_len, void **hmac,
+			    size_t *hmac_buffer_len)
 {
 	CPC_ERR_MANAGE;
 
@@ -0,0 +1,62 @@
+/*
+ * CPClient
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file <hmac-nettle.c>
+ *
+ * @brief Contains a function that computes a SHA1 HMAC using nettle
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <nettle/hmac.h>
+
+#include <stdlib.h>
+
+#include "hmac-peer.h"
+#include "error.h"
+#include "error-macros.h"
+
+int cpc_hmac_nettle_compute(const uint8_t *key, size_t key_len,
+			    const uint8_t *data, size_t data_len, void **hmac,
+			    size_t *hmac_buffer_len)
+{
+	CPC_ERR_MANAGE;
+
+	void *hmac_buffer = NULL;
+	struct hmac_sha1_ctx ctx;
+
+	CPC_FAIL_NULL(hmac_buffer, malloc(SHA1_DIGEST_SIZE), CPC_ERR_OOM);
+
+	hmac_sha1_set_key(&ctx, key_len, key);
+	hmac_sha1_update(&ctx, data_len, data);
+	hmac_sha1_digest(&ctx, SHA1_DIGEST_SIZE, hmac_buffer);
+
+	*hmac = hmac_buffer;
+	*hmac_buffer_len = SHA1_DIGEST_SIZE;
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
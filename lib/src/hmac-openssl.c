@@ -0,0 +1,68 @@
+/*
+ * CPClient
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file <hmac-openssl.c>
+ *
+ * @brief Contains a function that computes a SHA1 HMAC using OpenSSL's
+ *        libcrypto
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <stdlib.h>
+
+#include "hmac-peer.h"
+#include "error.h"
+#include "error-macros.h"
+
+int cpc_hmac_openssl_compute(const uint8_t *key, size_t key_len,
+			     const uint8_t *data, size_t data_len, void **hmac,
+			     size_t *hmac_buffer_len)
+{
+	CPC_ERR_MANAGE;
+
+	void *hmac_buffer = NULL;
+	unsigned int hmac_buffer_size = 0;
+
+	CPC_FAIL_NULL(hmac_buffer, malloc(EVP_MAX_MD_SIZE), CPC_ERR_OOM);
+
+	if (!HMAC(EVP_sha1(), key, (int) key_len, data, data_len, hmac_buffer,
+		  &hmac_buffer_size))
+		CPC_FAIL_FORCE(CPC_ERR_DENIED);
+
+	*hmac = hmac_buffer;
+	*hmac_buffer_len = hmac_buffer_size;
+
+	return CPC_ERR_NONE;
+
+CPC_ON_ERR:
+
+	free(hmac_buffer);
+
+	return CPC_ERR;
+}
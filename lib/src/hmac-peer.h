@@ -23,7 +23,12 @@
 /*!
  * @file <hmac-peer.h>
  *
- * @brief Prototype function for computing sha1 hmacs
+ * @brief Prototype functions for computing sha1 hmacs
+ *
+ * Each HMAC backend exports its own function so that several backends can
+ * be linked into the same program, e.g., cpc-bench-hmac.  The backend used
+ * by the CPClient itself is selected at configure time with --with-hmac and
+ * is accessed via cpc_hmac_compute.
  *
  ******************************************************************************/
 
@@ -32,7 +37,29 @@
 
 #include <stdint.h>
 
-int cpc_hmac_compute(const uint8_t *key, size_t key_len, const uint8_t *data,
-		     size_t data_len, void **hmac, size_t *hmac_buffer_len);
+#include <stddef.h>
+
+int cpc_hmac_gnutls_compute(const uint8_t *key, size_t key_len,
+			    const uint8_t *data, size_t data_len, void **hmac,
+			    size_t *hmac_buffer_len);
+int cpc_hmac_nettle_compute(const uint8_t *key, size_t key_len,
+			    const uint8_t *data, size_t data_len, void **hmac,
+			    size_t *hmac_buffer_len);
+int cpc_hmac_openssl_compute(const uint8_t *key, size_t key_len,
+			     const uint8_t *data, size_t data_len, void **hmac,
+			     size_t *hmac_buffer_len);
+int cpc_hmac_afalg_compute(const uint8_t *key, size_t key_len,
+			   const uint8_t *data, size_t data_len, void **hmac,
+			   size_t *hmac_buffer_len);
+
+#if defined(CPC_HMAC_NETTLE)
+#define cpc_hmac_compute cpc_hmac_nettle_compute
+#elif defined(CPC_HMAC_OPENSSL)
+#define cpc_hmac_compute cpc_hmac_openssl_compute
+#elif defined(CPC_HMAC_AFALG)
+#define cpc_hmac_compute cpc_hmac_afalg_compute
+#else
+#define cpc_hmac_compute cpc_hmac_gnutls_compute
+#endif
 
 #endif
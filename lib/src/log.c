@@ -64,7 +64,11 @@ void cpc_logf(bool decorate, const char *message, ...)
 	const char *file_name;
 
 	if (!g_log_file)
-		goto on_error;
+		return;
+
+	/* Keep lines logged from different threads from being interleaved */
+
+	flockfile(g_log_file);
 
 	va_start(args, message);
 	if (decorate) {
@@ -81,12 +85,12 @@ void cpc_logf(bool decorate, const char *message, ...)
 	if (fprintf(g_log_file, "\n") < 0)
 		goto on_error;
 
-	va_end(args);
 	(void) fflush(g_log_file);
 
 on_error:
 
-	return;
+	va_end(args);
+	funlockfile(g_log_file);
 }
 
 void cpc_logb(const uint8_t *data, unsigned int data_len)
@@ -103,7 +107,9 @@ void cpc_logb(const uint8_t *data, unsigned int data_len)
 	unsigned int buffer_index;
 
 	if (!g_log_file)
-		goto on_error;
+		return;
+
+	flockfile(g_log_file);
 
 	while (bytes_left > 0) {
 		data_index = master_data_index;
@@ -144,7 +150,7 @@ void cpc_logb(const uint8_t *data, unsigned int data_len)
 
 on_error:
 
-	return;
+	funlockfile(g_log_file);
 }
 
 
@@ -234,6 +234,41 @@ cpc_sec_t cpc_wp_security(cpc_wp_t *context)
 	return context->sec;
 }
 
+const char *cpc_wp_mac(const cpc_wp_t *context)
+{
+	return context->mac;
+}
+
+const uint8_t *cpc_wp_body(const cpc_wp_t *context, size_t *length)
+{
+	*length = context->body_len;
+
+	return context->body;
+}
+
+int cpc_wp_compact(cpc_wp_t *context)
+{
+	CPC_ERR_MANAGE;
+	size_t mac_len = context->mac ? strlen(context->mac) + 1 : 0;
+	uint8_t *message;
+
+	CPC_FAIL_NULL(message, malloc(mac_len + context->body_len + 1),
+		      CPC_ERR_OOM);
+
+	if (context->mac)
+		memcpy(message, context->mac, mac_len);
+	memcpy(message + mac_len, context->body, context->body_len);
+
+	free(context->message);
+	context->message = message;
+	context->mac = context->mac ? (char *) message : NULL;
+	context->body = message + mac_len;
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
 static void prv_hex_to_hex_str(char *dest_str, const uint8_t *src,
 			       size_t src_len)
 {
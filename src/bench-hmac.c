@@ -0,0 +1,226 @@
+/*
+ * CPClient
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file <bench-hmac.c>
+ *
+ * @brief Main file for cpc-bench-hmac.  Times each of the HMAC backends
+ *        available on the build machine over a range of message body sizes
+ *        typical of OMA CP WAP Push messages.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "error.h"
+#include "error-macros.h"
+#include "hmac-peer.h"
+
+#define CPC_BENCH_DEFAULT_ITERATIONS 10000
+#define CPC_BENCH_MAX_BODY 16384
+
+typedef int (*cpc_bench_hmac_fn_t)(const uint8_t *key, size_t key_len,
+				   const uint8_t *data, size_t data_len,
+				   void **hmac, size_t *hmac_buffer_len);
+
+typedef struct cpc_bench_backend_t_ cpc_bench_backend_t;
+struct cpc_bench_backend_t_ {
+	const char *name;
+	cpc_bench_hmac_fn_t fn;
+};
+
+static const cpc_bench_backend_t g_backends[] = {
+#ifdef HAVE_HMAC_GNUTLS
+	{ "gnutls", cpc_hmac_gnutls_compute },
+#endif
+#ifdef HAVE_HMAC_NETTLE
+	{ "nettle", cpc_hmac_nettle_compute },
+#endif
+#ifdef HAVE_HMAC_OPENSSL
+	{ "openssl", cpc_hmac_openssl_compute },
+#endif
+#ifdef HAVE_HMAC_AFALG
+	{ "afalg", cpc_hmac_afalg_compute },
+#endif
+	{ NULL, NULL }
+};
+
+/*
+ * Bodies of real OMA CP messages range from a couple of hundred bytes for
+ * a single NAPDEF to a few kilobytes for a full set of application settings.
+ */
+
+static const size_t g_body_sizes[] = { 128, 512, 1024, 4096,
+				       CPC_BENCH_MAX_BODY };
+
+/* NETWPIN keys are derived from the IMSI, USERPIN keys from a short PIN */
+
+static const uint8_t g_key[] = { 0x29, 0x04, 0x01, 0x32, 0x54, 0x76,
+				 0x98, 0xf0 };
+
+static double prv_elapsed(const struct timespec *start,
+			  const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int prv_check_backends(const uint8_t *body, size_t body_len,
+			      bool *usable)
+{
+	CPC_ERR_MANAGE;
+	unsigned int i;
+	void *reference = NULL;
+	size_t reference_len = 0;
+	const char *reference_name = NULL;
+	void *hmac = NULL;
+	size_t hmac_len;
+
+	for (i = 0; g_backends[i].name; ++i) {
+		if (!usable[i])
+			continue;
+
+		if (g_backends[i].fn(g_key, sizeof(g_key), body, body_len,
+				     &hmac, &hmac_len) != CPC_ERR_NONE) {
+			fprintf(stderr, "%s: unable to compute HMAC, skipping\n",
+				g_backends[i].name);
+			usable[i] = false;
+			continue;
+		}
+
+		if (!reference) {
+			reference = hmac;
+			reference_len = hmac_len;
+			reference_name = g_backends[i].name;
+		} else {
+			if (hmac_len != reference_len ||
+			    memcmp(hmac, reference, hmac_len)) {
+				fprintf(stderr, "%s: HMAC differs from %s\n",
+					g_backends[i].name, reference_name);
+				CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
+			}
+			free(hmac);
+		}
+		hmac = NULL;
+	}
+
+	if (!reference)
+		CPC_FAIL_FORCE(CPC_ERR_NOT_FOUND);
+
+CPC_ON_ERR:
+
+	free(hmac);
+	free(reference);
+
+	return CPC_ERR;
+}
+
+static int prv_time_backend(const cpc_bench_backend_t *backend,
+			    const uint8_t *body, size_t body_len,
+			    unsigned int iterations, double *seconds)
+{
+	CPC_ERR_MANAGE;
+	struct timespec start;
+	struct timespec end;
+	unsigned int i;
+	void *hmac;
+	size_t hmac_len;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; ++i) {
+		CPC_FAIL(backend->fn(g_key, sizeof(g_key), body, body_len,
+				     &hmac, &hmac_len));
+		free(hmac);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	*seconds = prv_elapsed(&start, &end);
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+int main(int argc, char *argv[])
+{
+	CPC_ERR_MANAGE;
+	uint8_t *body = NULL;
+	unsigned int iterations = CPC_BENCH_DEFAULT_ITERATIONS;
+	bool usable[sizeof(g_backends) / sizeof(cpc_bench_backend_t)];
+	unsigned int i;
+	unsigned int j;
+	double seconds;
+
+	if (argc > 2 || (argc == 2 && (iterations = atoi(argv[1])) == 0)) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	if (!g_backends[0].name) {
+		fprintf(stderr, "No HMAC backends were compiled in\n");
+		return 1;
+	}
+
+	CPC_FAIL_NULL(body, malloc(CPC_BENCH_MAX_BODY), CPC_ERR_OOM);
+	for (i = 0; i < CPC_BENCH_MAX_BODY; ++i)
+		body[i] = (uint8_t) (i * 31 + 7);
+
+	for (i = 0; g_backends[i].name; ++i)
+		usable[i] = true;
+
+	for (i = 0; i < sizeof(g_body_sizes) / sizeof(size_t); ++i)
+		CPC_FAIL(prv_check_backends(body, g_body_sizes[i], usable));
+
+	printf("%-10s %8s %12s %12s\n", "backend", "bytes", "us/hmac",
+	       "MB/s");
+
+	for (i = 0; g_backends[i].name; ++i) {
+		if (!usable[i])
+			continue;
+		for (j = 0; j < sizeof(g_body_sizes) / sizeof(size_t); ++j) {
+			CPC_FAIL(prv_time_backend(&g_backends[i], body,
+						  g_body_sizes[j], iterations,
+						  &seconds));
+			printf("%-10s %8zu %12.2f %12.2f\n", g_backends[i].name,
+			       g_body_sizes[j], seconds * 1e6 / iterations,
+			       (g_body_sizes[j] * (double) iterations) /
+			       (seconds * 1e6));
+		}
+	}
+
+CPC_ON_ERR:
+
+	free(body);
+
+	if (CPC_ERR != CPC_ERR_NONE)
+		fprintf(stderr, "Benchmark failed: %d\n", CPC_ERR);
+
+	return CPC_ERR == CPC_ERR_NONE ? 0 : 1;
+}
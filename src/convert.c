@@ -0,0 +1,571 @@
+/*
+ * CPClient
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file <convert.c>
+ *
+ * @brief Main file for cpc-convert.  Converts OMA CP XML documents and WAP
+ *        Push messages into the settings and meta data that the CPClient
+ *        would pass to Provman, without the need for a running CPClient or
+ *        Provman.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <libxml/parser.h>
+
+#include "error.h"
+#include "error-macros.h"
+#include "file-peer.h"
+#include "context.h"
+#include "wp.h"
+#include "settings.h"
+
+typedef struct cpc_convert_job_t_ cpc_convert_job_t;
+struct cpc_convert_job_t_ {
+	gchar *path;
+	gchar *name;
+	gchar *output;
+	int result;
+};
+
+static gchar *g_format = NULL;
+static gchar *g_output_dir = NULL;
+static gint g_jobs = 0;
+static gboolean g_gvariant = FALSE;
+
+static GOptionEntry g_options[] = {
+	{ "format", 'f', 0, G_OPTION_ARG_STRING, &g_format,
+	  "Output format, json (default) or gvariant", "FORMAT" },
+	{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &g_output_dir,
+	  "Write one file per input to DIR instead of stdout", "DIR" },
+	{ "jobs", 'j', 0, G_OPTION_ARG_INT, &g_jobs,
+	  "Number of files to convert in parallel (default: number of CPUs)",
+	  "N" },
+	{ NULL }
+};
+
+static const char *prv_error_string(int error)
+{
+	switch (error) {
+	case CPC_ERR_OOM:
+		return "out of memory";
+	case CPC_ERR_CORRUPT:
+		return "corrupt document";
+	case CPC_ERR_OPEN:
+		return "unable to open file";
+	case CPC_ERR_READ:
+		return "unable to read file";
+	case CPC_ERR_IO:
+		return "unable to write output";
+	default:
+		return "unknown error";
+	}
+}
+
+/*
+ * WAP Push messages start with a binary WSP header, so anything that starts
+ * like an XML document is treated as an OMA CP XML file.
+ */
+
+static bool prv_is_xml(const uint8_t *data, size_t length)
+{
+	size_t i = 0;
+
+	if (length >= 3 && data[0] == 0xEF && data[1] == 0xBB &&
+	    data[2] == 0xBF)
+		i = 3;
+
+	while (i < length && (data[i] == ' ' || data[i] == '\t' ||
+			      data[i] == '\r' || data[i] == '\n'))
+		++i;
+
+	return (length - i >= 5 && !memcmp(&data[i], "<?xml", 5)) ||
+		(length - i >= 20 &&
+		 !memcmp(&data[i], "<wap-provisioningdoc", 20));
+}
+
+static int prv_load_context(const gchar *path, cpc_context_t **context)
+{
+	CPC_ERR_MANAGE;
+	cpc_file_map_t map = { NULL, 0, false };
+	cpc_wp_t *wp = NULL;
+	char *prov_doc = NULL;
+	unsigned int prov_doc_size;
+
+	CPC_FAIL(cpc_file_map(path, &map));
+
+	if (map.length > INT_MAX)
+		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
+
+	if (prv_is_xml(map.data, map.length)) {
+		CPC_FAIL(cpc_context_new((const char *) map.data, map.length,
+					 CPC_TYPE_ALL, context));
+	} else {
+		CPC_FAIL(cpc_wp_new(map.data, map.length, &wp));
+		CPC_FAIL(cpc_get_prov_doc(wp, &prov_doc, &prov_doc_size));
+		if (prov_doc_size > INT_MAX)
+			CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
+		CPC_FAIL(cpc_context_new(prov_doc, prov_doc_size,
+					 CPC_TYPE_ALL, context));
+	}
+
+CPC_ON_ERR:
+
+	free(prov_doc);
+	cpc_wp_delete(wp);
+	cpc_file_unmap(&map);
+
+	return CPC_ERR;
+}
+
+static GList *prv_sorted_keys(GHashTable *hash_table)
+{
+	GList *keys = NULL;
+
+	if (hash_table) {
+		keys = g_hash_table_get_keys(hash_table);
+		keys = g_list_sort(keys, (GCompareFunc) strcmp);
+	}
+
+	return keys;
+}
+
+static void prv_json_string(GString *out, const gchar *str)
+{
+	g_string_append_c(out, '"');
+	for (; *str; ++str) {
+		switch (*str) {
+		case '"':
+			g_string_append(out, "\\\"");
+			break;
+		case '\\':
+			g_string_append(out, "\\\\");
+			break;
+		case '\n':
+			g_string_append(out, "\\n");
+			break;
+		case '\r':
+			g_string_append(out, "\\r");
+			break;
+		case '\t':
+			g_string_append(out, "\\t");
+			break;
+		default:
+			if ((guchar) *str < 0x20)
+				g_string_append_printf(out, "\\u%04x",
+						       (guchar) *str);
+			else
+				g_string_append_c(out, *str);
+			break;
+		}
+	}
+	g_string_append_c(out, '"');
+}
+
+static void prv_json_settings(GString *out, const gchar *name,
+			      GHashTable *settings)
+{
+	GList *keys = prv_sorted_keys(settings);
+	GList *ptr;
+
+	g_string_append_printf(out, "  \"%s\": {", name);
+	for (ptr = keys; ptr; ptr = ptr->next) {
+		g_string_append(out, ptr == keys ? "\n    " : ",\n    ");
+		prv_json_string(out, ptr->data);
+		g_string_append(out, ": ");
+		prv_json_string(out, g_hash_table_lookup(settings, ptr->data));
+	}
+	g_string_append(out, keys ? "\n  }" : "}");
+	g_list_free(keys);
+}
+
+static void prv_json_meta(GString *out, const gchar *name, GPtrArray *meta)
+{
+	unsigned int i;
+	cpc_meta_prop_t *prop;
+
+	g_string_append_printf(out, "  \"%s\": [", name);
+	for (i = 0; meta && i < meta->len; ++i) {
+		prop = g_ptr_array_index(meta, i);
+		g_string_append(out, i == 0 ? "\n    { \"key\": " :
+				",\n    { \"key\": ");
+		prv_json_string(out, prop->key);
+		g_string_append(out, ", \"prop\": ");
+		prv_json_string(out, prop->prop);
+		g_string_append(out, ", \"value\": ");
+		prv_json_string(out, prop->value);
+		g_string_append(out, " }");
+	}
+	g_string_append(out, meta && meta->len ? "\n  ]" : "]");
+}
+
+static gchar *prv_to_json(const gchar *path, cpc_settings_t *settings)
+{
+	GString *out = g_string_new("{\n  \"file\": ");
+
+	prv_json_string(out, path);
+	g_string_append(out, ",\n");
+	prv_json_settings(out, "system-settings", settings->system_settings);
+	g_string_append(out, ",\n");
+	prv_json_meta(out, "system-meta", settings->system_meta);
+	g_string_append(out, ",\n");
+	prv_json_settings(out, "session-settings",
+			  settings->session_settings);
+	g_string_append(out, ",\n");
+	prv_json_meta(out, "session-meta", settings->session_meta);
+	g_string_append(out, "\n}\n");
+
+	return g_string_free(out, FALSE);
+}
+
+static GVariant *prv_settings_variant(GHashTable *settings)
+{
+	GVariantBuilder vb;
+	GList *keys = prv_sorted_keys(settings);
+	GList *ptr;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{ss}"));
+	for (ptr = keys; ptr; ptr = ptr->next)
+		g_variant_builder_add(&vb, "{ss}", ptr->data,
+				      g_hash_table_lookup(settings,
+							  ptr->data));
+	g_list_free(keys);
+
+	return g_variant_builder_end(&vb);
+}
+
+static GVariant *prv_meta_variant(GPtrArray *meta)
+{
+	GVariantBuilder vb;
+	unsigned int i;
+	cpc_meta_prop_t *prop;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a(sss)"));
+	for (i = 0; meta && i < meta->len; ++i) {
+		prop = g_ptr_array_index(meta, i);
+		g_variant_builder_add(&vb, "(sss)", prop->key, prop->prop,
+				      prop->value);
+	}
+
+	return g_variant_builder_end(&vb);
+}
+
+/*
+ * The types match those of the Provman SetAll and SetMultipleMeta methods,
+ * so the output can be fed to Provman directly, e.g., by gdbus call.
+ */
+
+static gchar *prv_to_gvariant(const gchar *path, cpc_settings_t *settings)
+{
+	GVariant *variant;
+	gchar *text;
+	gchar *retval;
+
+	variant = g_variant_new("(s@a{ss}@a(sss)@a{ss}@a(sss))", path,
+				prv_settings_variant(
+					settings->system_settings),
+				prv_meta_variant(settings->system_meta),
+				prv_settings_variant(
+					settings->session_settings),
+				prv_meta_variant(settings->session_meta));
+	g_variant_ref_sink(variant);
+	text = g_variant_print(variant, TRUE);
+	g_variant_unref(variant);
+
+	retval = g_strconcat(text, "\n", NULL);
+	g_free(text);
+
+	return retval;
+}
+
+static gchar *prv_output_path(cpc_convert_job_t *job)
+{
+	gchar *file_name;
+	gchar *out_path;
+
+	file_name = g_strconcat(job->name, g_gvariant ? ".gvariant" : ".json",
+				NULL);
+	out_path = g_build_filename(g_output_dir, file_name, NULL);
+	g_free(file_name);
+
+	return out_path;
+}
+
+static int prv_write_output(cpc_convert_job_t *job)
+{
+	CPC_ERR_MANAGE;
+	gchar *out_path;
+	gchar *out_dir;
+
+	out_path = prv_output_path(job);
+	out_dir = g_path_get_dirname(out_path);
+
+	if (g_mkdir_with_parents(out_dir, 0755) ||
+	    !g_file_set_contents(out_path, job->output, -1, NULL))
+		CPC_ERR = CPC_ERR_IO;
+
+	g_free(out_dir);
+	g_free(out_path);
+
+	return CPC_ERR;
+}
+
+static void prv_convert(gpointer data, gpointer user_data)
+{
+	CPC_ERR_MANAGE;
+	cpc_convert_job_t *job = data;
+	cpc_context_t *context = NULL;
+	cpc_settings_t settings;
+
+	CPC_FAIL(prv_load_context(job->path, &context));
+
+	cpc_settings_init(&settings, context);
+	if (g_gvariant)
+		job->output = prv_to_gvariant(job->path, &settings);
+	else
+		job->output = prv_to_json(job->path, &settings);
+	cpc_settings_free(&settings);
+
+	if (g_output_dir) {
+		CPC_FAIL(prv_write_output(job));
+		g_free(job->output);
+		job->output = NULL;
+	}
+
+CPC_ON_ERR:
+
+	cpc_context_delete(context);
+	job->result = CPC_ERR;
+}
+
+static gint prv_compare_names(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar **) a, *(const gchar **) b);
+}
+
+/*
+ * With --output-dir, the output of a file named on the command line is
+ * named after the file.  The output of a file found in a directory is
+ * written to a sub directory named after that directory, so that files with
+ * the same name in different directories do not overwrite each other.
+ */
+
+static void prv_add_inputs(GPtrArray *jobs, const gchar *path)
+{
+	GDir *dir;
+	const gchar *name;
+	GPtrArray *names;
+	cpc_convert_job_t *job;
+	gchar *dir_name;
+	unsigned int i;
+
+	dir = g_dir_open(path, 0, NULL);
+	if (!dir) {
+		job = g_new0(cpc_convert_job_t, 1);
+		job->path = g_strdup(path);
+		job->name = g_path_get_basename(path);
+		g_ptr_array_add(jobs, job);
+		return;
+	}
+
+	dir_name = g_path_get_basename(path);
+	if (!strcmp(dir_name, ".") || !strcmp(dir_name, "..") ||
+	    !strcmp(dir_name, G_DIR_SEPARATOR_S)) {
+		g_free(dir_name);
+		dir_name = g_strdup("");
+	}
+
+	names = g_ptr_array_new();
+	while ((name = g_dir_read_name(dir)))
+		g_ptr_array_add(names, g_build_filename(path, name, NULL));
+	g_dir_close(dir);
+
+	g_ptr_array_sort(names, prv_compare_names);
+	for (i = 0; i < names->len; ++i) {
+		name = g_ptr_array_index(names, i);
+		if (g_file_test(name, G_FILE_TEST_IS_REGULAR)) {
+			job = g_new0(cpc_convert_job_t, 1);
+			job->path = (gchar *) name;
+			job->name = g_build_filename(
+				dir_name, strrchr(name, G_DIR_SEPARATOR) + 1,
+				NULL);
+			g_ptr_array_add(jobs, job);
+		} else {
+			g_free((gchar *) name);
+		}
+	}
+	g_ptr_array_free(names, TRUE);
+	g_free(dir_name);
+}
+
+/*
+ * Inputs that would still be written to the same output file, e.g., two
+ * directories with the same name, are rejected before anything is
+ * converted.
+ */
+
+static bool prv_check_names(GPtrArray *jobs)
+{
+	GHashTable *names;
+	cpc_convert_job_t *job;
+	cpc_convert_job_t *other;
+	gchar *out_path;
+	bool retval = true;
+	unsigned int i;
+
+	names = g_hash_table_new(g_str_hash, g_str_equal);
+	for (i = 0; i < jobs->len; ++i) {
+		job = g_ptr_array_index(jobs, i);
+		other = g_hash_table_lookup(names, job->name);
+		if (other) {
+			out_path = prv_output_path(job);
+			fprintf(stderr, "%s and %s would both be written to "
+				"%s\n", other->path, job->path, out_path);
+			g_free(out_path);
+			retval = false;
+		} else {
+			g_hash_table_insert(names, job->name, job);
+		}
+	}
+	g_hash_table_unref(names);
+
+	return retval;
+}
+
+static void prv_job_free(gpointer data)
+{
+	cpc_convert_job_t *job = data;
+
+	g_free(job->path);
+	g_free(job->name);
+	g_free(job->output);
+	g_free(job);
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *option_context;
+	GError *error = NULL;
+	GPtrArray *jobs;
+	GThreadPool *pool;
+	cpc_convert_job_t *job;
+	unsigned int failures = 0;
+	unsigned int outputs = 0;
+	unsigned int i;
+	int j;
+	long cpus;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+	xmlInitParser();
+
+	option_context = g_option_context_new("FILE|DIR... - convert OMA CP "
+					      "documents to Provman settings");
+	g_option_context_add_main_entries(option_context, g_options, NULL);
+	if (!g_option_context_parse(option_context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(option_context);
+		return 2;
+	}
+	g_option_context_free(option_context);
+
+	if (argc < 2) {
+		fprintf(stderr, "No input files specified.  See --help.\n");
+		return 2;
+	}
+
+	if (g_format && !strcmp(g_format, "gvariant")) {
+		g_gvariant = TRUE;
+	} else if (g_format && strcmp(g_format, "json")) {
+		fprintf(stderr, "Unknown format %s\n", g_format);
+		return 2;
+	}
+
+	if (g_jobs <= 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		g_jobs = cpus > 0 ? (gint) cpus : 1;
+	}
+
+	jobs = g_ptr_array_new_with_free_func(prv_job_free);
+	for (j = 1; j < argc; ++j)
+		prv_add_inputs(jobs, argv[j]);
+
+	if (g_output_dir && !prv_check_names(jobs)) {
+		g_ptr_array_unref(jobs);
+		return 2;
+	}
+
+	pool = g_thread_pool_new(prv_convert, NULL, g_jobs, TRUE, &error);
+	if (!pool) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_ptr_array_unref(jobs);
+		return 2;
+	}
+
+	for (i = 0; i < jobs->len; ++i)
+		g_thread_pool_push(pool, g_ptr_array_index(jobs, i), NULL);
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	/*
+	 * JSON written to stdout is a single array with one object per
+	 * converted input, however many inputs there are.  The GVariant
+	 * text of each input is a single line.
+	 */
+
+	for (i = 0; i < jobs->len; ++i) {
+		job = g_ptr_array_index(jobs, i);
+		if (job->result != CPC_ERR_NONE) {
+			fprintf(stderr, "%s: %s (%d)\n", job->path,
+				prv_error_string(job->result), job->result);
+			++failures;
+		} else if (job->output && g_gvariant) {
+			fputs(job->output, stdout);
+		} else if (job->output) {
+			fputs(outputs++ ? ",\n" : "[\n", stdout);
+			fwrite(job->output, 1, strlen(job->output) - 1, stdout);
+		}
+	}
+
+	if (!g_output_dir && !g_gvariant)
+		fputs(outputs ? "\n]\n" : "[]\n", stdout);
+
+	g_ptr_array_unref(jobs);
+	g_free(g_format);
+	g_free(g_output_dir);
+
+	return failures ? 1 : 0;
+}
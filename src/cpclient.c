@@ -35,20 +35,37 @@
 #include <string.h>
 #include <stdbool.h>
 #include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <syslog.h>
+#include <unistd.h>
+
+#include <gio/gunixfdlist.h>
 
 #include "log.h"
 #include "error.h"
 #include "error-macros.h"
+#include "dbus-error.h"
 #include "pm-manager.h"
 
 #include "tasks.h"
 
 #define CPC_INTERFACE_GET_VERSION "GetVersion"
+#define CPC_INTERFACE_GET_USAGE "GetUsage"
 #define CPC_INTERFACE_PARSECP "ParseCP"
+#define CPC_INTERFACE_PARSECP_FD "ParseCPFd"
 #define CPC_INTERFACE_FN "filename"
+#define CPC_INTERFACE_FD "fd"
+#define CPC_INTERFACE_PARSECP_DIRECTORY "ParseCPDirectory"
+#define CPC_INTERFACE_DIRECTORY "directory"
+#define CPC_INTERFACE_PARSECP_FILES "ParseCPFiles"
+#define CPC_INTERFACE_FILENAMES "filenames"
 #define CPC_INTERFACE_CREATE_PUSH_MESSAGE "CreatePushMessage"
+#define CPC_INTERFACE_CREATE_PUSH_MESSAGE_FD "CreatePushMessageFd"
+#define CPC_INTERFACE_CREATE_PUSH_MESSAGES "CreatePushMessages"
+#define CPC_INTERFACE_CREATE_AND_APPLY "CreateAndApply"
+#define CPC_INTERFACE_BYTE_ARRAYS "byte-arrays"
+#define CPC_INTERFACE_PATHS "Paths"
 #define CPC_INTERFACE_BYTE_ARRAY "byte-array"
 #define CPC_INTERFACE_APPLY "Apply"
 #define CPC_INTERFACE_PIN "Pin"
@@ -62,6 +79,9 @@
 
 #define CPC_TIMEOUT 30*1000
 
+/* Maximum time, in microseconds, spent starting tasks per idle callback */
+#define CPC_DISPATCH_BUDGET 5*1000
+
 typedef struct cpc_context_t_ cpc_context_t;
 struct cpc_context_t_ {
 	int error;
@@ -72,13 +92,47 @@ struct cpc_context_t_ {
 	GMainLoop *main_loop;
 	GDBusConnection *connection;
 	guint timeout_id;
-	GPtrArray *tasks;
+	GQueue tasks;
+	GQueue waiting;
+	GHashTable *waiting_paths;
+	unsigned int sync_queued;
 	guint idle_id;
-	cpc_tasks_handle_t cp_handle;
-	cpc_tasks_handle_t apply_handle;
+	GPtrArray *running;
 	bool quitting;
 	cpc_pm_manager_t *pm_manager;
-	GHashTable *watchers;
+	GHashTable *clients;
+};
+
+typedef struct cpc_client_t_ cpc_client_t;
+struct cpc_client_t_ {
+	guint watcher_id;
+	GQueue tasks;
+};
+
+/*
+ * A queued task is linked into both the global task queue and the queue of
+ * the client that sent it.  The links are embedded so that a task can be
+ * removed from either queue in constant time.  ParseCP and Apply tasks that
+ * cannot start because CPC_MAX_TASKS are already running are moved from the
+ * global task queue to the waiting queue.  waiting_paths counts the Apply
+ * tasks in the waiting queue by object path.
+ */
+
+typedef struct cpc_queued_task_t_ cpc_queued_task_t;
+struct cpc_queued_task_t_ {
+	cpc_task_t *task;
+	cpc_client_t *client;
+	bool waiting;
+	GList link;
+	GList client_link;
+};
+
+typedef struct cpc_running_task_t_ cpc_running_task_t;
+struct cpc_running_task_t_ {
+	cpc_context_t *context;
+	cpc_task_type_t type;
+	gchar *path;
+	cpc_tasks_handle_t handle;
 };
 
 static const gchar g_cpc_introspection[] =
@@ -88,16 +142,49 @@ static const gchar g_cpc_introspection[] =
 	"      <arg type='s' name='"CPC_INTERFACE_VERSION"'"
 	"           direction='out'/>"
 	"    </method>"
+	"    <method name='"CPC_INTERFACE_GET_USAGE"'>"
+	"      <arg type='a{st}' name='"CPC_INTERFACE_DICT"'"
+	"           direction='out'/>"
+	"    </method>"
 	"    <method name='"CPC_INTERFACE_PARSECP"'>"
 	"      <arg type='s' name='"CPC_INTERFACE_FN"'"
 	" direction='in'/>"
 	"    </method>"
+	"    <method name='"CPC_INTERFACE_PARSECP_FD"'>"
+	"      <arg type='h' name='"CPC_INTERFACE_FD"' direction='in'/>"
+	"    </method>"
+	"    <method name='"CPC_INTERFACE_PARSECP_DIRECTORY"'>"
+	"      <arg type='s' name='"CPC_INTERFACE_DIRECTORY"'"
+	" direction='in'/>"
+	"    </method>"
+	"    <method name='"CPC_INTERFACE_PARSECP_FILES"'>"
+	"      <arg type='as' name='"CPC_INTERFACE_FILENAMES"'"
+	" direction='in'/>"
+	"    </method>"
 	"    <method name='"CPC_INTERFACE_CREATE_PUSH_MESSAGE"'>"
 	"      <arg type='ay' name='"CPC_INTERFACE_BYTE_ARRAY"'"
 	" direction='in'/>"
 	"      <arg type='o' name='"CPC_INTERFACE_PATH"'"
 	"           direction='out'/>"
 	"    </method>"
+	"    <method name='"CPC_INTERFACE_CREATE_PUSH_MESSAGE_FD"'>"
+	"      <arg type='h' name='"CPC_INTERFACE_FD"' direction='in'/>"
+	"      <arg type='o' name='"CPC_INTERFACE_PATH"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"CPC_INTERFACE_CREATE_PUSH_MESSAGES"'>"
+	"      <arg type='aay' name='"CPC_INTERFACE_BYTE_ARRAYS"'"
+	" direction='in'/>"
+	"      <arg type='ao' name='"CPC_INTERFACE_PATHS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"CPC_INTERFACE_CREATE_AND_APPLY"'>"
+	"      <arg type='ay' name='"CPC_INTERFACE_BYTE_ARRAY"'"
+	" direction='in'/>"
+	"      <arg type='s' name='"CPC_INTERFACE_PIN"' direction='in'/>"
+	"      <arg type='a{ss}' name='"CPC_INTERFACE_DICT"'"
+	"           direction='out'/>"
+	"    </method>"
 	"  </interface>"
 	"  <interface name='"CPC_INTERFACE_PUSH_MESSAGE"'>"
 	"    <method name='"CPC_INTERFACE_APPLY"'>"
@@ -114,34 +201,38 @@ static const gchar g_cpc_introspection[] =
 
 static gboolean prv_process_task(gpointer user_data);
 
-static bool prv_async_in_progress(cpc_context_t *context)
+static void prv_free_running_task(gpointer data)
 {
-	return context->cp_handle != NULL && context->apply_handle != NULL;
+	cpc_running_task_t *running = data;
+
+	g_free(running->path);
+	g_free(running);
 }
 
-static void prv_free_cpc_task(gpointer data)
+static void prv_schedule(cpc_context_t *context)
 {
-	cpc_task_free(data);
+	if (!context->quitting && !context->idle_id)
+		context->idle_id = g_idle_add(prv_process_task, context);
 }
 
-static void prv_parsecp_task_finished(int result, void* user_data)
+static void prv_running_task_finished(int result, void* user_data)
 {
-	cpc_context_t *context = user_data;
-	context->cp_handle = NULL;
-	if (context->quitting)
-		g_main_loop_quit(context->main_loop);
-	else
-		context->idle_id = g_idle_add(prv_process_task, context);
+	cpc_running_task_t *running = user_data;
+	cpc_context_t *context = running->context;
+
+	(void) g_ptr_array_remove_fast(context->running, running);
+
+	if (context->quitting) {
+		if (context->running->len == 0)
+			g_main_loop_quit(context->main_loop);
+	} else {
+		prv_schedule(context);
+	}
 }
 
-static void prv_apply_task_finished(int result, void* user_data)
+static void prv_create_pm_task_finished(int result, void* user_data)
 {
-	cpc_context_t *context = user_data;
-	context->apply_handle = NULL;
-	if (context->quitting)
-		g_main_loop_quit(context->main_loop);
-	else
-		context->idle_id = g_idle_add(prv_process_task, context);
+	prv_schedule(user_data);
 }
 
 static gboolean prv_timeout(gpointer user_data)
@@ -156,74 +247,267 @@ static gboolean prv_timeout(gpointer user_data)
 	return FALSE;
 }
 
+static bool prv_is_parsecp_task(cpc_task_type_t type)
+{
+	return type == CPC_TASK_PARSECP || type == CPC_TASK_PARSECP_FD ||
+		type == CPC_TASK_PARSECP_DIR || type == CPC_TASK_PARSECP_FILES;
+}
+
+static bool prv_is_async_task(cpc_task_t *task)
+{
+	return prv_is_parsecp_task(task->type) ||
+		task->type == CPC_TASK_APPLY ||
+		task->type == CPC_TASK_CREATE_AND_APPLY;
+}
+
+static bool prv_is_pm_task(cpc_task_type_t type)
+{
+	return type == CPC_TASK_APPLY || type == CPC_TASK_CLOSE_PM ||
+		type == CPC_TASK_GET_PROPS;
+}
+
+static void prv_count_waiting(cpc_context_t *context, cpc_task_t *task,
+			      int delta)
+{
+	guint count;
+
+	if (!prv_is_pm_task(task->type))
+		return;
+
+	count = GPOINTER_TO_UINT(g_hash_table_lookup(context->waiting_paths,
+						     task->path)) + delta;
+	if (count > 0)
+		g_hash_table_insert(context->waiting_paths,
+				    g_strdup(task->path),
+				    GUINT_TO_POINTER(count));
+	else
+		(void) g_hash_table_remove(context->waiting_paths, task->path);
+}
+
+static void prv_park_task(cpc_context_t *context, cpc_queued_task_t *queued)
+{
+	g_queue_unlink(&context->tasks, &queued->link);
+	g_queue_push_tail_link(&context->waiting, &queued->link);
+	queued->waiting = true;
+	prv_count_waiting(context, queued->task, 1);
+}
+
+static void prv_dequeue_task(cpc_context_t *context,
+			     cpc_queued_task_t *queued)
+{
+	if (!queued->waiting) {
+		g_queue_unlink(&context->tasks, &queued->link);
+		if (!prv_is_async_task(queued->task))
+			--context->sync_queued;
+	} else {
+		g_queue_unlink(&context->waiting, &queued->link);
+		prv_count_waiting(context, queued->task, -1);
+	}
+	g_queue_unlink(&queued->client->tasks, &queued->client_link);
+	cpc_task_free(queued->task);
+	g_free(queued);
+}
+
+/*
+ * Tasks that operate on a push message object are run in the order in
+ * which they were received and never while an Apply on the same object is
+ * in progress.  Otherwise tasks are independent of each other, so anything
+ * else can overtake a blocked task.  Apply and ParseCP tasks that touch the
+ * same provman instance are serialized by cpc_provision_apply, which allows
+ * their proxy creation, IMSI retrieval and authentication to overlap.
+ *
+ * skipped contains the object paths of the push message tasks that have
+ * already been passed over in the current walk.  It is only created once
+ * a task is passed over.  Tasks in the global task queue are also blocked
+ * by the Apply tasks in the waiting queue, which were received before
+ * them.
+ */
+
+static bool prv_task_blocked(cpc_context_t *context,
+			     cpc_queued_task_t *queued, GHashTable **skipped)
+{
+	cpc_task_t *task = queued->task;
+	cpc_running_task_t *running;
+	bool blocked = false;
+	unsigned int i;
+
+	if (!prv_is_pm_task(task->type))
+		return false;
+
+	if (*skipped && g_hash_table_lookup_extended(*skipped, task->path,
+						     NULL, NULL))
+		blocked = true;
+	else if (!queued->waiting &&
+		 g_hash_table_lookup(context->waiting_paths, task->path))
+		blocked = true;
+
+	for (i = 0; !blocked && i < context->running->len; ++i) {
+		running = g_ptr_array_index(context->running, i);
+		if (prv_is_pm_task(running->type) &&
+		    !strcmp(running->path, task->path))
+			blocked = true;
+	}
+
+	if (blocked) {
+		if (!*skipped)
+			*skipped = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(*skipped, task->path, NULL);
+	}
+
+	return blocked;
+}
+
+static void prv_start_task(cpc_context_t *context, cpc_task_t *task)
+{
+	cpc_running_task_t *running = NULL;
+	bool started = false;
+
+	if (prv_is_async_task(task)) {
+		running = g_new0(cpc_running_task_t, 1);
+		running->context = context;
+		running->type = task->type;
+		running->path = g_strdup(task->path);
+		g_ptr_array_add(context->running, running);
+	}
+
+	switch (task->type) {
+	case CPC_TASK_PARSECP:
+	case CPC_TASK_PARSECP_FD:
+	case CPC_TASK_PARSECP_DIR:
+	case CPC_TASK_PARSECP_FILES:
+		started = cpc_tasks_parsecp(task, prv_running_task_finished,
+					    running, &running->handle);
+		break;
+	case CPC_TASK_APPLY:
+		started = cpc_tasks_apply(task, context->pm_manager,
+					  prv_running_task_finished, running,
+					  &running->handle);
+		break;
+	case CPC_TASK_CREATE_AND_APPLY:
+		cpc_tasks_create_and_apply(task, context->pm_manager,
+					   prv_running_task_finished, running,
+					   &running->handle);
+		started = true;
+		break;
+	case CPC_TASK_CREATE_PM:
+	case CPC_TASK_CREATE_PM_FD:
+		cpc_tasks_create_pm(task, context->pm_manager,
+				    prv_create_pm_task_finished, context);
+		break;
+	case CPC_TASK_CREATE_PMS:
+		cpc_tasks_create_pms(task, context->pm_manager,
+				     prv_create_pm_task_finished, context);
+		break;
+	case CPC_TASK_CLOSE_PM:
+		cpc_tasks_close_pm(task->invocation, context->pm_manager,
+				   task->path);
+		task->invocation = NULL;
+		break;
+	case CPC_TASK_GET_PROPS:
+		cpc_tasks_get_props(task->invocation, context->pm_manager,
+				    task->path);
+		task->invocation = NULL;
+		break;
+	default:
+		break;
+	}
+
+	if (running && !started)
+		(void) g_ptr_array_remove_fast(context->running, running);
+}
+
+/*
+ * Starts every task that is not blocked.  The waiting queue is walked
+ * first, but only while fewer than CPC_MAX_TASKS tasks are running.  ParseCP
+ * and Apply tasks in the global task queue that find no free slot are moved
+ * to the waiting queue, unless an earlier task on the same object is still
+ * blocked.  Once no slot is free and only such tasks are left the walk
+ * stops, so that a burst of them is not walked again each time one
+ * finishes.  If the walk takes longer than CPC_DISPATCH_BUDGET it is
+ * resumed in the next idle callback, so that large bursts of requests do
+ * not starve the main loop.
+ */
+
 static gboolean prv_process_task(gpointer user_data)
 {
 	cpc_context_t *context = user_data;
-	cpc_task_t *task;
-	bool async_task = false;
+	GList *link;
+	GList *next;
+	cpc_queued_task_t *queued;
+	GHashTable *skipped = NULL;
+	unsigned int sync_left = context->sync_queued;
+	gint64 deadline;
 	gboolean retval = FALSE;
 
-	if (context->tasks->len > 0) {
-		task = g_ptr_array_index(context->tasks, 0);
-		if (task) {
-			switch (task->type) {
-			case CPC_TASK_PARSECP:
-				async_task =
-					cpc_tasks_parsecp(
-						task,
-						prv_parsecp_task_finished,
-						user_data,
-						&context->cp_handle);
-				break;
-			case CPC_TASK_APPLY:
-				async_task =
-					cpc_tasks_apply(
-						task, context->pm_manager,
-						prv_apply_task_finished,
-						user_data,
-						&context->apply_handle);
-				break;
-			case CPC_TASK_GET_VERSION:
-				cpc_tasks_get_version(task);
-				break;
-			case CPC_TASK_CREATE_PM:
-				cpc_tasks_create_pm(task, context->pm_manager);
-				break;
-			case CPC_TASK_CLOSE_PM:
-				cpc_tasks_close_pm(task, context->pm_manager);
-				break;
-			case CPC_TASK_GET_PROPS:
-				cpc_tasks_get_props(task, context->pm_manager);
-			default:
-				break;
-			}
+	deadline = g_get_monotonic_time() + CPC_DISPATCH_BUDGET;
+
+	for (link = context->waiting.head;
+	     link && context->running->len < CPC_MAX_TASKS; link = next) {
+		next = link->next;
+		queued = link->data;
+
+		if (prv_task_blocked(context, queued, &skipped))
+			continue;
+
+		prv_start_task(context, queued->task);
+		prv_dequeue_task(context, queued);
+
+		if (g_get_monotonic_time() >= deadline) {
+			retval = TRUE;
+			goto on_budget;
 		}
-		g_ptr_array_remove_index(context->tasks, 0);
 	}
 
-	if (!async_task) {
-		if ((context->tasks->len == 0) &&
-		    (cpc_pm_manager_message_count(context->pm_manager) == 0)) {
-			if (!context->timeout_id) {
-				CPC_LOGF("Nothing left to do. "
-					 "Exiting in %u millseconds",
-					 CPC_TIMEOUT);
-				context->timeout_id =
-					g_timeout_add(CPC_TIMEOUT,
-						      prv_timeout,
-						      context);
-			}
-			context->idle_id = 0;
-		} else if (context->tasks->len > 0) {
-			retval =  TRUE;
-		} else {
-			context->idle_id = 0;
+	for (link = context->tasks.head; link; link = next) {
+		next = link->next;
+		queued = link->data;
+
+		if (!prv_is_async_task(queued->task)) {
+			--sync_left;
+		} else if (context->running->len >= CPC_MAX_TASKS) {
+			if (sync_left == 0)
+				break;
+			if (!prv_is_pm_task(queued->task->type) || !skipped ||
+			    !g_hash_table_lookup_extended(skipped,
+							  queued->task->path,
+							  NULL, NULL))
+				prv_park_task(context, queued);
+			continue;
+		}
+
+		if (prv_task_blocked(context, queued, &skipped))
+			continue;
+
+		prv_start_task(context, queued->task);
+		prv_dequeue_task(context, queued);
+
+		if (next && g_get_monotonic_time() >= deadline) {
+			retval = TRUE;
+			break;
 		}
-	} else {
-		context->idle_id = 0;
 	}
 
-	return retval;
+on_budget:
+
+	if (skipped)
+		g_hash_table_unref(skipped);
+
+	if (retval)
+		return TRUE;
+
+	if ((context->tasks.length == 0) && (context->waiting.length == 0) &&
+	    (context->running->len == 0) &&
+	    (cpc_pm_manager_message_count(context->pm_manager) == 0) &&
+	    !context->timeout_id) {
+		CPC_LOGF("Nothing left to do. Exiting in %u millseconds",
+			 CPC_TIMEOUT);
+		context->timeout_id = g_timeout_add(CPC_TIMEOUT, prv_timeout,
+						    context);
+	}
+
+	context->idle_id = 0;
+
+	return FALSE;
 }
 
 static void prv_cpc_method_call(GDBusConnection *connection,
@@ -265,14 +549,23 @@ static void prv_cpc_context_init(cpc_context_t *context)
 
 static void prv_cpc_context_free(cpc_context_t *context)
 {
-	if (context->watchers)
-		g_hash_table_unref(context->watchers);
+	while (context->tasks.head)
+		prv_dequeue_task(context, context->tasks.head->data);
+
+	while (context->waiting.head)
+		prv_dequeue_task(context, context->waiting.head->data);
+
+	if (context->waiting_paths)
+		g_hash_table_unref(context->waiting_paths);
+
+	if (context->clients)
+		g_hash_table_unref(context->clients);
 
 	if (context->pm_manager)
 		cpc_pm_manager_delete(context->pm_manager);
 
-	if (context->tasks)
-		g_ptr_array_unref(context->tasks);
+	if (context->running)
+		g_ptr_array_unref(context->running);
 
 	if (context->idle_id)
 		(void) g_source_remove(context->idle_id);
@@ -307,29 +600,24 @@ static void prv_lost_client(GDBusConnection *connection, const gchar *name,
 			    gpointer user_data)
 {
 	cpc_context_t *context = user_data;
-	unsigned int i;
-	const gchar *client_name;
-	cpc_task_t *task;
+	cpc_client_t *client;
+	cpc_queued_task_t *queued;
 
 	cpc_pm_manager_lost_client(context->pm_manager, name);
 
-	i = 0;
-	while (i < context->tasks->len) {
-		task = g_ptr_array_index(context->tasks, i);
-		client_name =
-			g_dbus_method_invocation_get_sender(task->invocation);
-		if (!strcmp(name, client_name)) {
-			task->invocation = NULL;
-			g_ptr_array_remove_index(context->tasks, i);
+	client = g_hash_table_lookup(context->clients, name);
+	if (client) {
+		while (client->tasks.head) {
+			queued = client->tasks.head->data;
+			queued->task->invocation = NULL;
+			prv_dequeue_task(context, queued);
 		}
-		else
-			++i;
 	}
 
 	if (!context->quitting && !context->timeout_id &&
-	    ((context->tasks->len == 0) &&
-				   (cpc_pm_manager_message_count(
-					   context->pm_manager) == 0))) {
+	    (context->tasks.length == 0) && (context->waiting.length == 0) &&
+	    (context->running->len == 0) &&
+	    (cpc_pm_manager_message_count(context->pm_manager) == 0)) {
 		CPC_LOGF("Nothing left to do. Exiting in %u millseconds",
 			 CPC_TIMEOUT);
 		context->timeout_id = g_timeout_add(CPC_TIMEOUT,
@@ -337,34 +625,45 @@ static void prv_lost_client(GDBusConnection *connection, const gchar *name,
 						    context);
 	}
 
-	(void) g_hash_table_remove(context->watchers, name);
+	(void) g_hash_table_remove(context->clients, name);
 }
 
 static void prv_add_task(cpc_context_t *context, cpc_task_t *task)
 {
 	const gchar *client_name;
-	guint watcher_id;
+	cpc_client_t *client;
+	cpc_queued_task_t *queued;
 
 	client_name = g_dbus_method_invocation_get_sender(task->invocation);
 
-	if (!g_hash_table_lookup(context->watchers, client_name)) {
-		watcher_id = g_bus_watch_name(G_BUS_TYPE_SESSION, client_name,
-					      G_BUS_NAME_WATCHER_FLAGS_NONE,
-					      NULL, prv_lost_client, context,
-					      NULL);
-		g_hash_table_insert(context->watchers, g_strdup(client_name),
-				    GUINT_TO_POINTER(watcher_id));
+	client = g_hash_table_lookup(context->clients, client_name);
+	if (!client) {
+		client = g_new0(cpc_client_t, 1);
+		client->watcher_id =
+			g_bus_watch_name(G_BUS_TYPE_SESSION, client_name,
+					 G_BUS_NAME_WATCHER_FLAGS_NONE,
+					 NULL, prv_lost_client, context,
+					 NULL);
+		g_hash_table_insert(context->clients, g_strdup(client_name),
+				    client);
 	}
 
-	g_ptr_array_add(context->tasks, task);
+	queued = g_new0(cpc_queued_task_t, 1);
+	queued->task = task;
+	queued->client = client;
+	queued->link.data = queued;
+	queued->client_link.data = queued;
+	g_queue_push_tail_link(&context->tasks, &queued->link);
+	g_queue_push_tail_link(&client->tasks, &queued->client_link);
+	if (!prv_is_async_task(task))
+		++context->sync_queued;
 
 	if (context->timeout_id) {
 		(void) g_source_remove(context->timeout_id);
 		context->timeout_id = 0;
 	}
 
-	if (!context->idle_id && !prv_async_in_progress(context))
-		context->idle_id = g_idle_add(prv_process_task, context);
+	prv_schedule(context);
 }
 
 static void prv_add_parsecp_task(cpc_context_t *context,
@@ -384,6 +683,37 @@ static void prv_add_parsecp_task(cpc_context_t *context,
 	prv_add_task(context, task);
 }
 
+static void prv_add_parsecp_dir_task(cpc_context_t *context,
+				     GDBusMethodInvocation *invocation,
+				     GVariant *parameters)
+{
+	cpc_task_t *task = g_new0(cpc_task_t, 1);
+	gchar *dirname;
+
+	g_variant_get(parameters, "(s)", &dirname);
+
+	CPC_LOGF("Add Task to parse directory %s", dirname);
+
+	task->type = CPC_TASK_PARSECP_DIR;
+	task->invocation = invocation;
+	task->path = dirname;
+	prv_add_task(context, task);
+}
+
+static void prv_add_parsecp_files_task(cpc_context_t *context,
+				       GDBusMethodInvocation *invocation,
+				       GVariant *parameters)
+{
+	cpc_task_t *task = g_new0(cpc_task_t, 1);
+
+	CPC_LOGF("Add Task to parse several files");
+
+	task->type = CPC_TASK_PARSECP_FILES;
+	task->invocation = invocation;
+	g_variant_get(parameters, "(^as)", &task->files);
+	prv_add_task(context, task);
+}
+
 static void prv_add_create_pm_task(cpc_context_t *context,
 				   GDBusMethodInvocation *invocation,
 				   GVariant *parameters)
@@ -391,33 +721,154 @@ static void prv_add_create_pm_task(cpc_context_t *context,
 	cpc_task_t *task = g_new0(cpc_task_t, 1);
 	GVariant *array;
 	const uint8_t *wp_message;
+	gsize length;
 
 	CPC_LOGF("Add Task to create WP message");
 
 	array = g_variant_get_child_value(parameters, 0);
 	task->type = CPC_TASK_CREATE_PM;
 	task->invocation = invocation;
-	wp_message = g_variant_get_fixed_array(array,
-					       &task->wp_message_len,
+	wp_message = g_variant_get_fixed_array(array, &length,
 					       sizeof(uint8_t));
-	task->wp_message = g_new(uint8_t, task->wp_message_len);
-	memcpy(task->wp_message, wp_message, task->wp_message_len);
+	task->wp_message_len = length;
+	task->wp_message = g_new(uint8_t, length);
+	memcpy(task->wp_message, wp_message, length);
+	g_variant_unref(array);
 
 	prv_add_task(context, task);
 }
 
-static void prv_add_get_version_task(cpc_context_t *context,
-				     GDBusMethodInvocation *invocation)
+/*
+ * Extracts the descriptor passed as the only argument of a method call.  Only
+ * regular files and memfds are accepted, as reads from pipes or sockets could
+ * block the worker thread indefinitely.  An error is returned to the caller
+ * if the descriptor is missing or unsuitable.
+ */
+
+static int prv_get_fd(GDBusMethodInvocation *invocation,
+		      GVariant *parameters)
+{
+	GDBusMessage *message;
+	GUnixFDList *fd_list;
+	gint32 index;
+	int fd = -1;
+	struct stat st;
+
+	g_variant_get(parameters, "(h)", &index);
+
+	message = g_dbus_method_invocation_get_message(invocation);
+	fd_list = g_dbus_message_get_unix_fd_list(message);
+	if (fd_list)
+		fd = g_unix_fd_list_get(fd_list, index, NULL);
+
+	if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		if (fd != -1)
+			close(fd);
+		g_dbus_method_invocation_return_dbus_error(
+			invocation, cpc_dbus_error_map(CPC_ERR_OPEN), "");
+		fd = -1;
+	}
+
+	return fd;
+}
+
+static void prv_add_fd_task(cpc_context_t *context,
+			    GDBusMethodInvocation *invocation,
+			    GVariant *parameters, cpc_task_type_t type)
+{
+	cpc_task_t *task;
+	int fd;
+
+	fd = prv_get_fd(invocation, parameters);
+	if (fd == -1) {
+		prv_schedule(context);
+		return;
+	}
+
+	CPC_LOGF("Add Task for fd %d", fd);
+
+	task = g_new0(cpc_task_t, 1);
+	task->type = type;
+	task->invocation = invocation;
+	task->fd = fd;
+	prv_add_task(context, task);
+}
+
+static void prv_add_create_pms_task(cpc_context_t *context,
+				    GDBusMethodInvocation *invocation,
+				    GVariant *parameters)
+{
+	cpc_task_t *task = g_new0(cpc_task_t, 1);
+
+	CPC_LOGF("Add Task to create WP messages");
+
+	task->type = CPC_TASK_CREATE_PMS;
+	task->invocation = invocation;
+	task->messages = g_variant_get_child_value(parameters, 0);
+
+	prv_add_task(context, task);
+}
+
+static void prv_add_create_and_apply_task(cpc_context_t *context,
+					  GDBusMethodInvocation *invocation,
+					  GVariant *parameters)
 {
 	cpc_task_t *task = g_new0(cpc_task_t, 1);
+	GVariant *array;
+	const uint8_t *wp_message;
+	gsize length;
 
-	CPC_LOGF("Add Task to Get CPClient Version");
+	CPC_LOGF("Add Task to create and apply WP message");
 
-	task->type = CPC_TASK_GET_VERSION;
+	array = g_variant_get_child_value(parameters, 0);
+	task->type = CPC_TASK_CREATE_AND_APPLY;
 	task->invocation = invocation;
+	wp_message = g_variant_get_fixed_array(array, &length,
+					       sizeof(uint8_t));
+	task->wp_message_len = length;
+	task->wp_message = g_new(uint8_t, length);
+	memcpy(task->wp_message, wp_message, length);
+	g_variant_unref(array);
+	g_variant_get_child(parameters, 1, "s", &task->pin);
+
 	prv_add_task(context, task);
 }
 
+/*
+ * Close and GetProps are answered immediately unless an earlier request on
+ * the same push message object is still queued, or, for Close, is running.
+ * The queue is only needed to keep them ordered with respect to those
+ * requests.
+ */
+
+static bool prv_pm_busy(cpc_context_t *context, const gchar *client_name,
+			const gchar *object_path, bool check_running)
+{
+	cpc_client_t *client;
+	cpc_task_t *task;
+	cpc_running_task_t *running;
+	GList *link;
+	unsigned int i;
+
+	client = g_hash_table_lookup(context->clients, client_name);
+	for (link = client ? client->tasks.head : NULL; link;
+	     link = link->next) {
+		task = ((cpc_queued_task_t *) link->data)->task;
+		if (prv_is_pm_task(task->type) &&
+		    !strcmp(task->path, object_path))
+			return true;
+	}
+
+	for (i = 0; check_running && i < context->running->len; ++i) {
+		running = g_ptr_array_index(context->running, i);
+		if (prv_is_pm_task(running->type) &&
+		    !strcmp(running->path, object_path))
+			return true;
+	}
+
+	return false;
+}
+
 static void prv_add_close_pm_task(cpc_context_t *context,
 				  GDBusMethodInvocation *invocation,
 				  const gchar *object_path)
@@ -478,13 +929,36 @@ static void prv_cpc_method_call(GDBusConnection *connection,
 		context->timeout_id = 0;
 	}
 
-	if (g_strcmp0(method_name, CPC_INTERFACE_PARSECP) == 0)
+	if (g_strcmp0(method_name, CPC_INTERFACE_PARSECP) == 0) {
 		prv_add_parsecp_task(context, invocation, parameters);
-	else if (g_strcmp0(method_name,
-			   CPC_INTERFACE_CREATE_PUSH_MESSAGE) == 0)
+	} else if (g_strcmp0(method_name, CPC_INTERFACE_PARSECP_FD) == 0) {
+		prv_add_fd_task(context, invocation, parameters,
+				CPC_TASK_PARSECP_FD);
+	} else if (g_strcmp0(method_name,
+			     CPC_INTERFACE_PARSECP_DIRECTORY) == 0) {
+		prv_add_parsecp_dir_task(context, invocation, parameters);
+	} else if (g_strcmp0(method_name, CPC_INTERFACE_PARSECP_FILES) == 0) {
+		prv_add_parsecp_files_task(context, invocation, parameters);
+	} else if (g_strcmp0(method_name,
+			     CPC_INTERFACE_CREATE_PUSH_MESSAGE) == 0) {
 		prv_add_create_pm_task(context, invocation, parameters);
-	else if (g_strcmp0(method_name, CPC_INTERFACE_GET_VERSION) == 0)
-		prv_add_get_version_task(context, invocation);
+	} else if (g_strcmp0(method_name,
+			     CPC_INTERFACE_CREATE_PUSH_MESSAGE_FD) == 0) {
+		prv_add_fd_task(context, invocation, parameters,
+				CPC_TASK_CREATE_PM_FD);
+	} else if (g_strcmp0(method_name,
+			     CPC_INTERFACE_CREATE_PUSH_MESSAGES) == 0) {
+		prv_add_create_pms_task(context, invocation, parameters);
+	} else if (g_strcmp0(method_name,
+			     CPC_INTERFACE_CREATE_AND_APPLY) == 0) {
+		prv_add_create_and_apply_task(context, invocation, parameters);
+	} else if (g_strcmp0(method_name, CPC_INTERFACE_GET_VERSION) == 0) {
+		cpc_tasks_get_version(invocation);
+		prv_schedule(context);
+	} else if (g_strcmp0(method_name, CPC_INTERFACE_GET_USAGE) == 0) {
+		cpc_tasks_get_usage(invocation, context->pm_manager);
+		prv_schedule(context);
+	}
 }
 
 static void prv_cpc_pm_method_call(GDBusConnection *connection,
@@ -500,13 +974,26 @@ static void prv_cpc_pm_method_call(GDBusConnection *connection,
 
 	CPC_LOGF("%s called", method_name);
 
-	if (g_strcmp0(method_name, CPC_INTERFACE_CLOSE) == 0)
-		prv_add_close_pm_task(context, invocation, object_path);
-	else if (g_strcmp0(method_name, CPC_INTERFACE_GET_PROPS) == 0)
-		prv_add_get_props_task(context, invocation, object_path);
-	else if (g_strcmp0(method_name, CPC_INTERFACE_APPLY) == 0)
+	if (g_strcmp0(method_name, CPC_INTERFACE_CLOSE) == 0) {
+		if (prv_pm_busy(context, sender, object_path, true)) {
+			prv_add_close_pm_task(context, invocation,
+					      object_path);
+		} else {
+			cpc_tasks_close_pm(invocation, context->pm_manager,
+					   object_path);
+			prv_schedule(context);
+		}
+	} else if (g_strcmp0(method_name, CPC_INTERFACE_GET_PROPS) == 0) {
+		if (prv_pm_busy(context, sender, object_path, false))
+			prv_add_get_props_task(context, invocation,
+					       object_path);
+		else
+			cpc_tasks_get_props(invocation, context->pm_manager,
+					    object_path);
+	} else if (g_strcmp0(method_name, CPC_INTERFACE_APPLY) == 0) {
 		prv_add_apply_task(context, invocation, object_path,
 			parameters);
+	}
 }
 
 static void prv_bus_acquired(GDBusConnection *connection, const gchar *name,
@@ -534,16 +1021,28 @@ static void prv_bus_acquired(GDBusConnection *connection, const gchar *name,
 
 static void prv_quit(cpc_context_t *context)
 {
-	if (context->cp_handle) {
-		CPC_LOGF("Cancelling outstanding parsecp task");
+	cpc_running_task_t *running;
+	unsigned int i;
+
+	if (context->quitting)
+		return;
+
+	if (context->running->len > 0) {
+		CPC_LOGF("Cancelling %u outstanding tasks",
+			 context->running->len);
 
 		context->quitting = true;
-		cpc_tasks_parsecp_cancel(context->cp_handle);
-	} else if (context->apply_handle) {
-		CPC_LOGF("Cancelling outstanding apply task");
-		context->quitting = true;
-		cpc_tasks_apply_cancel(context->pm_manager,
-					    context->apply_handle);
+		for (i = 0; i < context->running->len; ++i) {
+			running = g_ptr_array_index(context->running, i);
+			if (prv_is_parsecp_task(running->type))
+				cpc_tasks_parsecp_cancel(running->handle);
+			else if (running->type == CPC_TASK_CREATE_AND_APPLY)
+				cpc_tasks_create_and_apply_cancel(
+					context->pm_manager, running->handle);
+			else
+				cpc_tasks_apply_cancel(context->pm_manager,
+						       running->handle);
+		}
 	} else {
 		context->error = CPC_ERR_UNKNOWN;
 		g_main_loop_quit(context->main_loop);
@@ -615,10 +1114,12 @@ CPC_ON_ERR:
 	return CPC_ERR;
 }
 
-static void prv_unregister_client(gpointer client)
+static void prv_unregister_client(gpointer data)
 {
-	guint id = GPOINTER_TO_UINT(client);
-	g_bus_unwatch_name(id);
+	cpc_client_t *client = data;
+
+	g_bus_unwatch_name(client->watcher_id);
+	g_free(client);
 }
 
 int main(int argc, char *argv[])
@@ -643,6 +1144,9 @@ int main(int argc, char *argv[])
 		CPC_FAIL_FORCE(CPC_ERR_IO);
 
 	g_type_init();
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
 
 #ifdef CPC_LOGGING
 	log_name_str = g_string_new(CPC_LOG_FILE);
@@ -673,12 +1177,14 @@ int main(int argc, char *argv[])
 					  prv_bus_acquired, NULL,
 					  prv_name_lost, &context, NULL);
 
-	context.tasks = g_ptr_array_new_with_free_func(prv_free_cpc_task);
+	context.running = g_ptr_array_new_with_free_func(prv_free_running_task);
+	context.waiting_paths = g_hash_table_new_full(g_str_hash, g_str_equal,
+						      g_free, NULL);
 
 	context.timeout_id = g_timeout_add(CPC_TIMEOUT, prv_timeout, &context);
 
-	context.watchers = g_hash_table_new_full(g_str_hash, g_str_equal,
-						 g_free, prv_unregister_client);
+	context.clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, prv_unregister_client);
 
 	CPC_FAIL(prv_init_signal_handler(mask, &context));
 
@@ -45,6 +45,7 @@
 #define CPC_ERR_DBUS_DENIED CPC_SERVICE".Error.Denied"
 #define CPC_ERR_DBUS_IN_PROGRESS CPC_SERVICE".Error.InProgress"
 #define CPC_ERR_DBUS_ALREADY_APPLIED CPC_SERVICE".Error.AlreadyApplied"
+#define CPC_ERR_DBUS_QUOTA CPC_SERVICE".Error.QuotaExceeded"
 
 const gchar *const g_dbus_errors[] = {
 	CPC_ERR_DBUS_UNKNOWN,
@@ -59,7 +60,8 @@ const gchar *const g_dbus_errors[] = {
 	CPC_ERR_DBUS_DIED,
 	CPC_ERR_DBUS_TOO_LARGE,
 	CPC_ERR_DBUS_IN_PROGRESS,
-	CPC_ERR_DBUS_ALREADY_APPLIED
+	CPC_ERR_DBUS_ALREADY_APPLIED,
+	CPC_ERR_DBUS_QUOTA
 };
 
 const gchar *cpc_dbus_error_map(int cpc_error)
@@ -30,37 +30,88 @@
 #include "config.h"
 
 #include <string.h>
+#include <unistd.h>
+
+#include <libxml/parser.h>
 
 #include "pm-manager.h"
+#include "file-peer.h"
+#include "wp.h"
 #include "provision-wp.h"
 #include "error.h"
 #include "error-macros.h"
 #include "log.h"
 
+/* Number of recently applied messages remembered for duplicate detection */
+
+#define CPC_APPLIED_CACHE_SIZE 16
+
 struct cpc_pm_manager_t_ {
 	GDBusInterfaceInfo *interface;
 	const GDBusInterfaceVTable *vtable;
 	gpointer user_data;
 	unsigned int counter;
 	GHashTable *objects;
+	GDBusConnection *connection;
+	guint subtree_id;
+	GThreadPool *parse_pool;
+	GPtrArray *jobs;
+	GAsyncQueue *parsed;
+	gint drain_scheduled;
+	GHashTable *live;
+	GHashTable *applied;
+	GQueue applied_order;
+	cpc_pm_usage_t usage;
+	GHashTable *client_usage;
+	GQueue lru;
 };
 
 typedef struct cpc_push_message_t_ cpc_push_message_t;
 struct cpc_push_message_t_ {
-	GDBusConnection *connection;
-	guint id;
+	guint number;
 	cpc_provision_wp_t *provision;
 	cpc_cb_t finished;
 	void *finished_data;
 	gchar *client_name;
 	bool lost_client;
 	bool applied;
+	cpc_pm_manager_t *manager;
+	gchar *digest;
+	gchar *live_key;
+	size_t size;
+	unsigned int pins;
+	GList lru_link;
+};
+
+typedef struct cpc_parse_job_t_ cpc_parse_job_t;
+struct cpc_parse_job_t_ {
+	gchar *client_name;
+	GDBusConnection *connection;
+	uint8_t *data;
+	unsigned int length;
+	int fd;
+	cpc_provision_wp_t *provision;
+	int result;
+	bool lost_client;
+	cpc_pm_manager_new_cb_t finished;
+	void *finished_data;
+	gchar *pin;
+	bool cancelled;
+	bool applying;
+	cpc_pm_manager_apply_cb_t applied;
+	void *applied_data;
+	cpc_pm_manager_t *manager;
+	cpc_props_t props;
+	gchar *digest;
+	bool duplicate;
+	cpc_provision_wp_t *mapping;
+	guint number;
 };
 
 typedef struct cpc_apply_data_t_ cpc_apply_data_t;
 struct cpc_apply_data_t_ {
 	cpc_pm_manager_t *manager;
-	gchar *pm_path;
+	guint number;
 };
 
 void cpc_props_free(cpc_props_t *props)
@@ -71,10 +122,24 @@ void cpc_props_free(cpc_props_t *props)
 
 static void prv_apply_data_delete(cpc_apply_data_t *apply_data)
 {
-	if (apply_data) {
-		g_free(apply_data->pm_path);
-		g_free(apply_data);
-	}
+	g_free(apply_data);
+}
+
+static void prv_release_usage(cpc_pm_manager_t *manager,
+			      cpc_push_message_t *pm)
+{
+	cpc_pm_usage_t *client;
+
+	g_queue_unlink(&manager->lru, &pm->lru_link);
+
+	manager->usage.bytes -= pm->size;
+	--manager->usage.objects;
+
+	client = g_hash_table_lookup(manager->client_usage, pm->client_name);
+	client->bytes -= pm->size;
+	if (--client->objects == 0)
+		(void) g_hash_table_remove(manager->client_usage,
+					   pm->client_name);
 }
 
 static void prv_cpc_push_message_delete(gpointer message)
@@ -83,15 +148,264 @@ static void prv_cpc_push_message_delete(gpointer message)
 
 	if (message) {
 		pm = message;
-		if (pm->id)
-			(void) g_dbus_connection_unregister_object(
-				pm->connection, pm->id);
+		if (pm->lru_link.data)
+			prv_release_usage(pm->manager, pm);
+		if (pm->live_key &&
+		    g_hash_table_lookup(pm->manager->live, pm->live_key) == pm)
+			(void) g_hash_table_remove(pm->manager->live,
+						   pm->live_key);
 		cpc_provision_wp_delete(pm->provision);
 		g_free(pm->client_name);
+		g_free(pm->digest);
+		g_free(pm->live_key);
 		g_free(message);
 	}
 }
 
+static void prv_parse_job_delete(cpc_parse_job_t *job)
+{
+	if (job) {
+		cpc_props_free(&job->props);
+		g_free(job->pin);
+		cpc_provision_wp_delete(job->provision);
+		if (job->fd != -1)
+			close(job->fd);
+		g_free(job->data);
+		g_free(job->digest);
+		g_free(job->client_name);
+		if (job->connection)
+			g_object_unref(job->connection);
+		g_free(job);
+	}
+}
+
+static gboolean prv_drain_parsed(gpointer user_data);
+
+static gchar *prv_make_path(guint number)
+{
+	return g_strdup_printf("%s/%u", CPC_OBJECT, number);
+}
+
+/*
+ * Converts the final element of a push message object path back into the
+ * number it was created from.  Leading zeros are rejected so that each
+ * object has exactly one path.
+ */
+
+static bool prv_node_to_number(const gchar *node, guint *number)
+{
+	guint64 value;
+	gchar *end;
+
+	if (!node || !g_ascii_isdigit(node[0]) ||
+	    (node[0] == '0' && node[1]))
+		return false;
+
+	value = g_ascii_strtoull(node, &end, 10);
+	if (*end || value == 0 || value > G_MAXUINT)
+		return false;
+
+	*number = (guint) value;
+
+	return true;
+}
+
+static cpc_push_message_t *prv_lookup(cpc_pm_manager_t *manager,
+				      const gchar *path)
+{
+	size_t prefix_len = sizeof(CPC_OBJECT) - 1;
+	guint number;
+
+	if (strncmp(path, CPC_OBJECT, prefix_len) || path[prefix_len] != '/' ||
+	    !prv_node_to_number(path + prefix_len + 1, &number))
+		return NULL;
+
+	return g_hash_table_lookup(manager->objects, GUINT_TO_POINTER(number));
+}
+
+/*
+ * Identifies a push message by its security type, its MAC and its still
+ * encoded body.  The WSP transaction ID and other headers are ignored, as
+ * they may change when an operator retransmits a message.  Only the WSP
+ * headers are decoded, so this is much cheaper than parsing the message.
+ * Returns NULL if the headers are corrupt.  May be called from any thread.
+ */
+
+static gchar *prv_compute_digest(const uint8_t *data, size_t length)
+{
+	cpc_wp_t *wp;
+	cpc_sec_t sec;
+	const char *mac;
+	const uint8_t *body;
+	size_t body_len;
+	GChecksum *checksum;
+	gchar *digest;
+
+	if (cpc_wp_new(data, length, &wp) != CPC_ERR_NONE)
+		return NULL;
+
+	sec = cpc_wp_security(wp);
+	mac = cpc_wp_mac(wp);
+	body = cpc_wp_body(wp, &body_len);
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	g_checksum_update(checksum, &sec, sizeof(sec));
+	if (mac)
+		g_checksum_update(checksum, (const guchar *) mac,
+				  strlen(mac) + 1);
+	g_checksum_update(checksum, body, body_len);
+	digest = g_strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+
+	cpc_wp_delete(wp);
+
+	return digest;
+}
+
+static gchar *prv_make_live_key(const gchar *client_name, const gchar *digest)
+{
+	return g_strconcat(client_name, "/", digest, NULL);
+}
+
+/*
+ * Checks whether job duplicates a message that has recently been applied,
+ * in which case CPC_ERR_ALREADY_APPLIED is returned, or a message that the
+ * same client has already created, in which case the path of the existing
+ * object is returned in path.  Messages passed to
+ * cpc_pm_manager_create_and_apply are never matched against existing
+ * objects.
+ */
+
+static int prv_find_duplicate(cpc_pm_manager_t *manager, cpc_parse_job_t *job,
+			      gchar **path)
+{
+	CPC_ERR_MANAGE;
+	gchar *live_key;
+	cpc_push_message_t *pm;
+
+	*path = NULL;
+
+	if (!job->digest)
+		goto CPC_ON_ERR;
+
+	if (g_hash_table_lookup_extended(manager->applied, job->digest,
+					 NULL, NULL)) {
+		CPC_LOGF("Message %s already applied", job->digest);
+		CPC_FAIL_FORCE(CPC_ERR_ALREADY_APPLIED);
+	}
+
+	if (job->applied)
+		goto CPC_ON_ERR;
+
+	live_key = prv_make_live_key(job->client_name, job->digest);
+	pm = g_hash_table_lookup(manager->live, live_key);
+	g_free(live_key);
+
+	if (pm) {
+		*path = prv_make_path(pm->number);
+		CPC_LOGF("Message %s duplicates %s", job->digest, *path);
+	}
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+static void prv_remember_applied(cpc_pm_manager_t *manager,
+				 const gchar *digest)
+{
+	gchar *key;
+
+	if (!digest || g_hash_table_lookup_extended(manager->applied, digest,
+						    NULL, NULL))
+		return;
+
+	if (manager->applied_order.length == CPC_APPLIED_CACHE_SIZE) {
+		key = g_queue_pop_head(&manager->applied_order);
+		(void) g_hash_table_remove(manager->applied, key);
+	}
+
+	key = g_strdup(digest);
+	g_hash_table_insert(manager->applied, key, NULL);
+	g_queue_push_tail(&manager->applied_order, key);
+}
+
+/*
+ * Queues job for parsing.  Jobs that duplicate an existing message are
+ * passed straight back to the main context without being parsed.
+ */
+
+static void prv_queue_job(cpc_pm_manager_t *manager, cpc_parse_job_t *job)
+{
+	gchar *path = NULL;
+
+	g_ptr_array_add(manager->jobs, job);
+
+	if (job->data) {
+		job->digest = prv_compute_digest(job->data, job->length);
+		job->duplicate = prv_find_duplicate(manager, job, &path) !=
+			CPC_ERR_NONE || path;
+		g_free(path);
+	}
+
+	if (!job->duplicate) {
+		g_thread_pool_push(manager->parse_pool, job, NULL);
+	} else {
+		g_async_queue_push(manager->parsed, job);
+		if (g_atomic_int_compare_and_exchange(
+			    &manager->drain_scheduled, 0, 1))
+			(void) g_idle_add(prv_drain_parsed, manager);
+	}
+}
+
+/*
+ * Runs on one of the threads of the parse pool.  Only the job itself is
+ * touched here.  Everything else, including the registration of the new
+ * d-Bus object, is done back in the main context by prv_drain_parsed.
+ * Jobs with a mapping generate the settings of a message created lazily,
+ * which is being applied.
+ */
+
+static void prv_parse_job(gpointer data, gpointer user_data)
+{
+	cpc_parse_job_t *job = data;
+	cpc_pm_manager_t *manager = user_data;
+	cpc_file_map_t map;
+
+	if (job->mapping) {
+		job->result = cpc_provision_wp_map(job->mapping);
+	} else if (job->fd != -1) {
+		job->result = cpc_file_map_fd(job->fd, true, &map);
+		if (job->result == CPC_ERR_NONE) {
+			job->digest = prv_compute_digest(map.data, map.length);
+			job->result = (map.length > INT_MAX) ? CPC_ERR_CORRUPT :
+				cpc_provision_wp_new(map.data, map.length,
+						     !job->applied,
+						     &job->provision);
+			cpc_file_unmap(&map);
+		}
+		close(job->fd);
+		job->fd = -1;
+	} else {
+		job->result = cpc_provision_wp_new(job->data, job->length,
+						   !job->applied,
+						   &job->provision);
+		g_free(job->data);
+		job->data = NULL;
+	}
+
+	g_async_queue_push(manager->parsed, job);
+	if (g_atomic_int_compare_and_exchange(&manager->drain_scheduled, 0, 1))
+		(void) g_idle_add(prv_drain_parsed, manager);
+}
+
+static unsigned int prv_parse_pool_size(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cpus > 0 ? (unsigned int) cpus : 1;
+}
+
 void cpc_pm_manager_new(GDBusInterfaceInfo *interface,
 			const GDBusInterfaceVTable *vtable,
 			gpointer user_data, cpc_pm_manager_t **manager)
@@ -105,51 +419,442 @@ void cpc_pm_manager_new(GDBusInterfaceInfo *interface,
 	pm_manager->vtable = vtable;
 	pm_manager->user_data = user_data;
 	pm_manager->objects =
-		g_hash_table_new_full(g_str_hash, g_str_equal,
-				      g_free, prv_cpc_push_message_delete);
+		g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				      NULL, prv_cpc_push_message_delete);
+
+	/* libxml2 must be initialised before it is used from other threads */
+
+	xmlInitParser();
+
+	pm_manager->jobs = g_ptr_array_new();
+	pm_manager->live = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 g_free, NULL);
+	pm_manager->applied = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    g_free, NULL);
+	g_queue_init(&pm_manager->applied_order);
+	pm_manager->client_usage = g_hash_table_new_full(g_str_hash,
+							 g_str_equal,
+							 g_free, g_free);
+	g_queue_init(&pm_manager->lru);
+	pm_manager->parsed = g_async_queue_new();
+	pm_manager->parse_pool = g_thread_pool_new(prv_parse_job, pm_manager,
+						   prv_parse_pool_size(),
+						   FALSE, NULL);
 	*manager = pm_manager;
 }
 
-static int prv_prv_push_message_new(GDBusConnection *connection,
-				    const gchar *client_name,
-				    uint8_t *data, unsigned int length,
-				    cpc_push_message_t **message)
+/*
+ * Push message objects are not registered individually.  A single subtree
+ * rooted at CPC_OBJECT serves all of them, so creating or removing a message
+ * only touches the objects table.  Nodes are dispatched to without being
+ * enumerated, so prv_subtree_enumerate is only called when a client
+ * introspects the manager.
+ */
+
+static gchar **prv_subtree_enumerate(GDBusConnection *connection,
+				     const gchar *sender,
+				     const gchar *object_path,
+				     gpointer user_data)
+{
+	cpc_pm_manager_t *manager = user_data;
+	GHashTableIter iter;
+	gpointer key;
+	gchar **nodes;
+	unsigned int i = 0;
+
+	nodes = g_new(gchar *, g_hash_table_size(manager->objects) + 1);
+	g_hash_table_iter_init(&iter, manager->objects);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		nodes[i++] = g_strdup_printf("%u", GPOINTER_TO_UINT(key));
+	nodes[i] = NULL;
+
+	return nodes;
+}
+
+static bool prv_node_exists(cpc_pm_manager_t *manager, const gchar *node)
+{
+	guint number;
+
+	return prv_node_to_number(node, &number) &&
+		g_hash_table_lookup(manager->objects,
+				    GUINT_TO_POINTER(number));
+}
+
+static GDBusInterfaceInfo **prv_subtree_introspect(GDBusConnection *connection,
+						   const gchar *sender,
+						   const gchar *object_path,
+						   const gchar *node,
+						   gpointer user_data)
+{
+	cpc_pm_manager_t *manager = user_data;
+	GDBusInterfaceInfo **interfaces;
+
+	if (!prv_node_exists(manager, node))
+		return NULL;
+
+	interfaces = g_new(GDBusInterfaceInfo *, 2);
+	interfaces[0] = g_dbus_interface_info_ref(manager->interface);
+	interfaces[1] = NULL;
+
+	return interfaces;
+}
+
+static const GDBusInterfaceVTable *prv_subtree_dispatch(
+	GDBusConnection *connection, const gchar *sender,
+	const gchar *object_path, const gchar *interface_name,
+	const gchar *node, gpointer *out_user_data, gpointer user_data)
+{
+	cpc_pm_manager_t *manager = user_data;
+
+	if (!prv_node_exists(manager, node) ||
+	    strcmp(interface_name, manager->interface->name))
+		return NULL;
+
+	*out_user_data = manager->user_data;
+
+	return manager->vtable;
+}
+
+static const GDBusSubtreeVTable g_cpc_pm_subtree_vtable = {
+	prv_subtree_enumerate,
+	prv_subtree_introspect,
+	prv_subtree_dispatch
+};
+
+static int prv_register_subtree(cpc_pm_manager_t *manager,
+				GDBusConnection *connection)
 {
 	CPC_ERR_MANAGE;
+
+	if (manager->subtree_id) {
+		if (manager->connection != connection)
+			CPC_FAIL_FORCE(CPC_ERR_IO);
+		goto CPC_ON_ERR;
+	}
+
+	manager->subtree_id = g_dbus_connection_register_subtree(
+		connection, CPC_OBJECT, &g_cpc_pm_subtree_vtable,
+		G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+		manager, NULL, NULL);
+	if (!manager->subtree_id)
+		CPC_FAIL_FORCE(CPC_ERR_IO);
+
+	manager->connection = g_object_ref(connection);
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+static bool prv_over_limit(const cpc_pm_usage_t *usage, size_t max_bytes,
+			   unsigned int max_objects, size_t size)
+{
+	if (!usage)
+		return false;
+
+	return (max_objects && usage->objects >= max_objects) ||
+		(max_bytes && usage->bytes + size > max_bytes);
+}
+
+/*
+ * Removes the least recently used message that is neither being applied nor
+ * pinned.  If
+ * client_name is not NULL, only the messages of that client are considered.
+ */
+
+static bool prv_evict(cpc_pm_manager_t *manager, const gchar *client_name)
+{
+	GList *link;
 	cpc_push_message_t *pm;
 
-	pm = g_new0(cpc_push_message_t, 1);
-	CPC_FAIL(cpc_provision_wp_new(data, length, &pm->provision));
-	pm->connection = connection;
-	pm->client_name = g_strdup(client_name);
-	*message = pm;
-	pm = NULL;
+	for (link = manager->lru.head; link; link = link->next) {
+		pm = link->data;
+		if (pm->finished || pm->pins)
+			continue;
+		if (client_name && strcmp(client_name, pm->client_name))
+			continue;
+
+		CPC_LOGF("Evicting %s/%u of %s (%zu bytes)", CPC_OBJECT,
+			 pm->number, pm->client_name, pm->size);
+		(void) g_hash_table_remove(manager->objects,
+					   GUINT_TO_POINTER(pm->number));
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Evicts messages until a new message of size bytes belonging to
+ * client_name fits within both the per-client and the global limits.  The
+ * client's own messages are evicted first.  The messages of other clients
+ * are only evicted to stay within the global limits, once client_name has
+ * nothing left that can be evicted.  CPC_ERR_QUOTA is returned if this is
+ * not possible because the remaining messages are being applied.
+ */
+
+static int prv_make_room(cpc_pm_manager_t *manager, const gchar *client_name,
+			 size_t size)
+{
+	CPC_ERR_MANAGE;
+
+	if ((CPC_MAX_CLIENT_PM_BYTES && size > CPC_MAX_CLIENT_PM_BYTES) ||
+	    (CPC_MAX_PM_BYTES && size > CPC_MAX_PM_BYTES))
+		CPC_FAIL_FORCE(CPC_ERR_QUOTA);
+
+	while (prv_over_limit(g_hash_table_lookup(manager->client_usage,
+						  client_name),
+			      CPC_MAX_CLIENT_PM_BYTES, CPC_MAX_CLIENT_MESSAGES,
+			      size))
+		if (!prv_evict(manager, client_name))
+			CPC_FAIL_FORCE(CPC_ERR_QUOTA);
+
+	while (prv_over_limit(&manager->usage, CPC_MAX_PM_BYTES,
+			      CPC_MAX_MESSAGES, size))
+		if (!prv_evict(manager, client_name) &&
+		    !prv_evict(manager, NULL))
+			CPC_FAIL_FORCE(CPC_ERR_QUOTA);
 
 CPC_ON_ERR:
 
-	prv_cpc_push_message_delete(pm);
+	return CPC_ERR;
+}
+
+static void prv_touch(cpc_pm_manager_t *manager, cpc_push_message_t *pm)
+{
+	g_queue_unlink(&manager->lru, &pm->lru_link);
+	g_queue_push_tail_link(&manager->lru, &pm->lru_link);
+}
+
+static int prv_register_message(cpc_pm_manager_t *manager,
+				cpc_parse_job_t *job, gchar **path)
+{
+	CPC_ERR_MANAGE;
+	cpc_push_message_t *pm;
+	cpc_pm_usage_t *client;
+	size_t size;
+
+	CPC_FAIL(prv_register_subtree(manager, job->connection));
+
+	size = cpc_provision_wp_size(job->provision);
+	CPC_FAIL(prv_make_room(manager, job->client_name, size));
+
+	pm = g_new0(cpc_push_message_t, 1);
+	pm->provision = job->provision;
+	job->provision = NULL;
+	pm->client_name = g_strdup(job->client_name);
+	pm->manager = manager;
+	pm->number = manager->counter++;
+	pm->size = size;
+
+	client = g_hash_table_lookup(manager->client_usage, pm->client_name);
+	if (!client) {
+		client = g_new0(cpc_pm_usage_t, 1);
+		g_hash_table_insert(manager->client_usage,
+				    g_strdup(pm->client_name), client);
+	}
+	client->bytes += size;
+	++client->objects;
+	manager->usage.bytes += size;
+	++manager->usage.objects;
+	pm->lru_link.data = pm;
+	g_queue_push_tail_link(&manager->lru, &pm->lru_link);
+
+	g_hash_table_insert(manager->objects, GUINT_TO_POINTER(pm->number),
+			    pm);
+
+	if (job->digest) {
+		pm->digest = g_strdup(job->digest);
+		pm->live_key = prv_make_live_key(pm->client_name, pm->digest);
+		g_hash_table_replace(manager->live, g_strdup(pm->live_key),
+				     pm);
+	}
+	*path = prv_make_path(pm->number);
+
+CPC_ON_ERR:
 
 	return CPC_ERR;
 }
 
+static void prv_get_props(cpc_provision_wp_t *provision, cpc_props_t *props)
+{
+	props->pin_required = cpc_provision_wp_pin_required(provision);
+	props->settings = cpc_provision_wp_get_settings(provision);
+	props->sec_type = cpc_provision_wp_get_sec_type(provision);
+	props->start_sessions = cpc_provision_wp_get_sessions(provision);
+}
+
+static void prv_job_applied(int result, void *user_data)
+{
+	cpc_parse_job_t *job = user_data;
+
+	(void) g_ptr_array_remove_fast(job->manager->jobs, job);
+
+	if (job->lost_client && result == CPC_ERR_CANCELLED)
+		result = CPC_ERR_DIED;
+	else if (result == CPC_ERR_NONE)
+		prv_remember_applied(job->manager, job->digest);
+
+	job->applied(result, &job->props, job->applied_data);
+	prv_parse_job_delete(job);
+}
+
+/*
+ * Jobs created by cpc_pm_manager_create_and_apply are applied directly
+ * rather than being registered as d-Bus objects.  They stay in the jobs
+ * array until provisioning has finished.
+ */
+
+static void prv_apply_job(cpc_pm_manager_t *manager, cpc_parse_job_t *job)
+{
+	CPC_ERR_MANAGE;
+
+	if (job->lost_client)
+		CPC_FAIL_FORCE(CPC_ERR_DIED);
+
+	if (job->cancelled)
+		CPC_FAIL_FORCE(CPC_ERR_CANCELLED);
+
+	CPC_FAIL(job->result);
+
+	prv_get_props(job->provision, &job->props);
+
+	job->manager = manager;
+	CPC_FAIL(cpc_provision_wp_apply(job->provision, job->pin,
+					prv_job_applied, job, NULL, NULL));
+	job->applying = true;
+
+	return;
+
+CPC_ON_ERR:
+
+	(void) g_ptr_array_remove_fast(manager->jobs, job);
+	job->applied(CPC_ERR, NULL, job->applied_data);
+	prv_parse_job_delete(job);
+}
+
+/*
+ * The settings generated for a message created lazily count towards its
+ * size, so the usage of the manager and of the client are brought up to
+ * date before provisioning continues.
+ */
+
+static void prv_message_mapped(cpc_pm_manager_t *manager,
+			       cpc_parse_job_t *job)
+{
+	cpc_push_message_t *pm;
+	cpc_pm_usage_t *client;
+	size_t size;
+
+	pm = g_hash_table_lookup(manager->objects,
+				 GUINT_TO_POINTER(job->number));
+	if (pm) {
+		size = cpc_provision_wp_size(pm->provision);
+		client = g_hash_table_lookup(manager->client_usage,
+					     pm->client_name);
+		client->bytes += size - pm->size;
+		manager->usage.bytes += size - pm->size;
+		pm->size = size;
+		cpc_provision_wp_map_finished(pm->provision, job->result);
+	}
+
+	prv_parse_job_delete(job);
+}
+
+static void prv_parse_job_finished(cpc_pm_manager_t *manager,
+				   cpc_parse_job_t *job)
+{
+	CPC_ERR_MANAGE;
+	gchar *path = NULL;
+	bool created = false;
+
+	if (job->mapping) {
+		prv_message_mapped(manager, job);
+		return;
+	}
+
+	if (job->result == CPC_ERR_NONE && !job->lost_client &&
+	    !job->cancelled) {
+		job->result = prv_find_duplicate(manager, job, &path);
+		if (job->result == CPC_ERR_NONE && !path && !job->provision) {
+
+			/*
+			 * The message this job duplicated has gone away
+			 * since the job was queued, so it needs to be parsed
+			 * after all.
+			 */
+
+			job->duplicate = false;
+			g_thread_pool_push(manager->parse_pool, job, NULL);
+			return;
+		}
+	}
+
+	if (job->applied) {
+		prv_apply_job(manager, job);
+		return;
+	}
+
+	(void) g_ptr_array_remove_fast(manager->jobs, job);
+
+	if (job->lost_client)
+		CPC_FAIL_FORCE(CPC_ERR_DIED);
+
+	CPC_FAIL(job->result);
+	if (!path) {
+		CPC_FAIL(prv_register_message(manager, job, &path));
+		created = true;
+	}
+
+CPC_ON_ERR:
+
+	job->finished(CPC_ERR, path, created, job->finished_data);
+	g_free(path);
+	prv_parse_job_delete(job);
+}
+
+static gboolean prv_drain_parsed(gpointer user_data)
+{
+	cpc_pm_manager_t *manager = user_data;
+	cpc_parse_job_t *job;
+
+	g_atomic_int_set(&manager->drain_scheduled, 0);
+
+	while ((job = g_async_queue_try_pop(manager->parsed)))
+		prv_parse_job_finished(manager, job);
+
+	return FALSE;
+}
+
 void cpc_pm_manager_lost_client(cpc_pm_manager_t *manager, const gchar *name)
 {
 	cpc_push_message_t *pm;
+	cpc_parse_job_t *job;
+	unsigned int i;
 	GHashTableIter iter;
-	gpointer key;
 	gpointer value;
 
 	CPC_LOGF("Lost client %s", name);
 
+	for (i = 0; i < manager->jobs->len; ++i) {
+		job = g_ptr_array_index(manager->jobs, i);
+		if (!strcmp(name, job->client_name)) {
+			job->lost_client = true;
+			if (job->applying)
+				cpc_provision_wp_apply_cancel(job->provision);
+		}
+	}
+
 	g_hash_table_iter_init(&iter, manager->objects);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
 		pm = value;
 		if (!strcmp(name, pm->client_name)) {
-			CPC_LOGF("Client %s orphaned", key);
+			CPC_LOGF("Client of %s/%u orphaned", CPC_OBJECT,
+				 pm->number);
 			if (pm->finished) {
 				CPC_LOGF("Apply outstanding.  "
-					 "Schedule %s for later deletion.",
-					 key);
+					 "Schedule %s/%u for later deletion.",
+					 CPC_OBJECT, pm->number);
 				cpc_provision_wp_apply_cancel(pm->provision);
 				pm->lost_client = true;
 			} else {
@@ -161,48 +866,80 @@ void cpc_pm_manager_lost_client(cpc_pm_manager_t *manager, const gchar *name)
 	}
 }
 
-int cpc_pm_manager_new_message(cpc_pm_manager_t *manager,
-			       const gchar *client_name,
-			       GDBusConnection *connection, uint8_t *data,
-			       unsigned int length, gchar **path)
+void cpc_pm_manager_new_message(cpc_pm_manager_t *manager,
+				const gchar *client_name,
+				GDBusConnection *connection, uint8_t *data,
+				unsigned int length,
+				cpc_pm_manager_new_cb_t finished,
+				void *finished_data)
 {
-	CPC_ERR_MANAGE;
-
-	GString *new_path = NULL;
-	guint id;
-	cpc_push_message_t *pm = NULL;
+	cpc_parse_job_t *job;
+
+	job = g_new0(cpc_parse_job_t, 1);
+	job->client_name = g_strdup(client_name);
+	job->connection = g_object_ref(connection);
+	job->data = data;
+	job->length = length;
+	job->fd = -1;
+	job->finished = finished;
+	job->finished_data = finished_data;
+
+	prv_queue_job(manager, job);
+}
 
-	CPC_FAIL(prv_prv_push_message_new(connection, client_name, data, length,
-					  &pm));
+void cpc_pm_manager_new_message_fd(cpc_pm_manager_t *manager,
+				   const gchar *client_name,
+				   GDBusConnection *connection, int fd,
+				   cpc_pm_manager_new_cb_t finished,
+				   void *finished_data)
+{
+	cpc_parse_job_t *job;
 
-	new_path = g_string_new("");
-	g_string_printf(new_path, "%s/%u", CPC_OBJECT, manager->counter);
+	job = g_new0(cpc_parse_job_t, 1);
+	job->client_name = g_strdup(client_name);
+	job->connection = g_object_ref(connection);
+	job->fd = fd;
+	job->finished = finished;
+	job->finished_data = finished_data;
 
-	id =  g_dbus_connection_register_object(connection,
-						new_path->str,
-						manager->interface,
-						manager->vtable,
-						manager->user_data,
-						NULL, NULL);
-	if (!id)
-		CPC_FAIL_FORCE(CPC_ERR_IO);
+	prv_queue_job(manager, job);
+}
 
+void cpc_pm_manager_create_and_apply(cpc_pm_manager_t *manager,
+				     const gchar *client_name,
+				     GDBusConnection *connection,
+				     uint8_t *data, unsigned int length,
+				     const gchar *pin,
+				     cpc_pm_manager_apply_cb_t finished,
+				     void *finished_data,
+				     cpc_handle_t *handle)
+{
+	cpc_parse_job_t *job;
 
-	pm->id = id;
-	g_hash_table_insert(manager->objects, g_strdup(new_path->str),
-			    pm);
-	*path = g_string_free(new_path, FALSE);
-	++manager->counter;
+	job = g_new0(cpc_parse_job_t, 1);
+	job->client_name = g_strdup(client_name);
+	job->connection = g_object_ref(connection);
+	job->data = data;
+	job->length = length;
+	job->fd = -1;
+	job->pin = g_strdup(pin);
+	job->applied = finished;
+	job->applied_data = finished_data;
 
-	return CPC_ERR_NONE;
+	prv_queue_job(manager, job);
 
-CPC_ON_ERR:
+	*handle = job;
+}
 
-	prv_cpc_push_message_delete(pm);
-	if (new_path)
-		(void) g_string_free(new_path, TRUE);
+void cpc_pm_manager_create_and_apply_cancel(cpc_pm_manager_t *manager,
+					    cpc_handle_t handle)
+{
+	cpc_parse_job_t *job = handle;
 
-	return CPC_ERR;
+	if (job->applying)
+		cpc_provision_wp_apply_cancel(job->provision);
+	else
+		job->cancelled = true;
 }
 
 int cpc_pm_manager_get_properties(cpc_pm_manager_t *manager, const gchar *path,
@@ -211,35 +948,54 @@ int cpc_pm_manager_get_properties(cpc_pm_manager_t *manager, const gchar *path,
 	CPC_ERR_MANAGE;
 	cpc_push_message_t *pm;
 
-	CPC_FAIL_NULL(pm, g_hash_table_lookup(manager->objects, path),
-		      CPC_ERR_NOT_FOUND);
+	CPC_FAIL_NULL(pm, prv_lookup(manager, path), CPC_ERR_NOT_FOUND);
 
 	if (strcmp(client_name, pm->client_name))
 		CPC_FAIL_FORCE(CPC_ERR_DENIED);
 
-	props->pin_required = cpc_provision_wp_pin_required(pm->provision);
-	props->settings = cpc_provision_wp_get_settings(pm->provision);
-	props->sec_type = cpc_provision_wp_get_sec_type(pm->provision);
-	props->start_sessions = cpc_provision_wp_get_sessions(pm->provision);
+	prv_touch(manager, pm);
+	prv_get_props(pm->provision, props);
 
 CPC_ON_ERR:
 
 	return CPC_ERR;
 }
 
+int cpc_pm_manager_pin_message(cpc_pm_manager_t *manager, const gchar *path)
+{
+	CPC_ERR_MANAGE;
+	cpc_push_message_t *pm;
+
+	CPC_FAIL_NULL(pm, prv_lookup(manager, path), CPC_ERR_NOT_FOUND);
+	++pm->pins;
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+void cpc_pm_manager_unpin_message(cpc_pm_manager_t *manager,
+				  const gchar *path)
+{
+	cpc_push_message_t *pm = prv_lookup(manager, path);
+
+	if (pm && pm->pins > 0)
+		--pm->pins;
+}
+
 int cpc_pm_manager_remove_message(cpc_pm_manager_t *manager,
 				  const gchar *path, const gchar *client_name)
 {
 	CPC_ERR_MANAGE;
 	cpc_push_message_t *pm;
 
-	CPC_FAIL_NULL(pm, g_hash_table_lookup(manager->objects, path),
-		      CPC_ERR_NOT_FOUND);
+	CPC_FAIL_NULL(pm, prv_lookup(manager, path), CPC_ERR_NOT_FOUND);
 
 	if (strcmp(client_name, pm->client_name))
 		CPC_FAIL_FORCE(CPC_ERR_DENIED);
 
-	(void) g_hash_table_remove(manager->objects, path);
+	(void) g_hash_table_remove(manager->objects,
+				   GUINT_TO_POINTER(pm->number));
 
 CPC_ON_ERR:
 
@@ -248,15 +1004,63 @@ CPC_ON_ERR:
 
 void cpc_pm_manager_delete(cpc_pm_manager_t *manager)
 {
+	cpc_parse_job_t *job;
+
 	if (manager) {
+		g_thread_pool_free(manager->parse_pool, FALSE, TRUE);
+		while (g_source_remove_by_user_data(manager))
+			;
+		while ((job = g_async_queue_try_pop(manager->parsed))) {
+			(void) g_ptr_array_remove_fast(manager->jobs, job);
+			if (job->applied)
+				job->applied(CPC_ERR_DIED, NULL,
+					     job->applied_data);
+			else if (!job->mapping)
+				job->finished(CPC_ERR_DIED, NULL, false,
+					      job->finished_data);
+			prv_parse_job_delete(job);
+		}
+		while (manager->jobs->len > 0) {
+			job = g_ptr_array_remove_index_fast(manager->jobs, 0);
+			job->applied(CPC_ERR_DIED, NULL, job->applied_data);
+			prv_parse_job_delete(job);
+		}
+		g_async_queue_unref(manager->parsed);
+		g_ptr_array_unref(manager->jobs);
+		if (manager->subtree_id) {
+			(void) g_dbus_connection_unregister_subtree(
+				manager->connection, manager->subtree_id);
+			g_object_unref(manager->connection);
+		}
 		g_hash_table_unref(manager->objects);
+		g_hash_table_unref(manager->client_usage);
+		g_hash_table_unref(manager->live);
+		g_queue_clear(&manager->applied_order);
+		g_hash_table_unref(manager->applied);
 		g_free(manager);
 	}
 }
 
 unsigned int cpc_pm_manager_message_count(cpc_pm_manager_t *manager)
 {
-	return g_hash_table_size(manager->objects);
+	return g_hash_table_size(manager->objects) + manager->jobs->len;
+}
+
+void cpc_pm_manager_get_usage(cpc_pm_manager_t *manager,
+			      const gchar *client_name, cpc_pm_usage_t *total,
+			      cpc_pm_usage_t *client)
+{
+	cpc_pm_usage_t *usage;
+
+	*total = manager->usage;
+
+	usage = g_hash_table_lookup(manager->client_usage, client_name);
+	if (usage) {
+		*client = *usage;
+	} else {
+		client->bytes = 0;
+		client->objects = 0;
+	}
 }
 
 static void prv_apply_finished(int result, void *user_data)
@@ -265,20 +1069,39 @@ static void prv_apply_finished(int result, void *user_data)
 	cpc_push_message_t *pm;
 
 	pm = g_hash_table_lookup(apply_data->manager->objects,
-				 apply_data->pm_path);
+				 GUINT_TO_POINTER(apply_data->number));
 	if (pm) {
 		pm->finished(result, pm->finished_data);
 		pm->finished = NULL;
 		pm->finished_data = NULL;
-		if (result == CPC_ERR_NONE)
+		if (result == CPC_ERR_NONE) {
 			pm->applied = true;
+			prv_remember_applied(apply_data->manager, pm->digest);
+		}
 		if (pm->lost_client)
 			g_hash_table_remove(apply_data->manager->objects,
-					    apply_data->pm_path);
+					    GUINT_TO_POINTER(apply_data->number));
 	}
 	prv_apply_data_delete(apply_data);
 }
 
+/*
+ * Messages are created lazily, so their settings are generated on the parse
+ * pool the first time they are applied.
+ */
+
+static void prv_map_message(cpc_provision_wp_t *provision, void *user_data)
+{
+	cpc_apply_data_t *apply_data = user_data;
+	cpc_parse_job_t *job;
+
+	job = g_new0(cpc_parse_job_t, 1);
+	job->fd = -1;
+	job->mapping = provision;
+	job->number = apply_data->number;
+	g_thread_pool_push(apply_data->manager->parse_pool, job, NULL);
+}
+
 int cpc_pm_manager_apply(cpc_pm_manager_t *manager,
 			 const gchar *path, const gchar* client_name,
 			 const gchar *pin, cpc_cb_t finished,
@@ -288,8 +1111,7 @@ int cpc_pm_manager_apply(cpc_pm_manager_t *manager,
 	cpc_push_message_t *pm;
 	cpc_apply_data_t *apply_data = NULL;
 
-	CPC_FAIL_NULL(pm, g_hash_table_lookup(manager->objects, path),
-		      CPC_ERR_NOT_FOUND);
+	CPC_FAIL_NULL(pm, prv_lookup(manager, path), CPC_ERR_NOT_FOUND);
 
 	if (strcmp(client_name, pm->client_name))
 		CPC_FAIL_FORCE(CPC_ERR_DENIED);
@@ -297,14 +1119,20 @@ int cpc_pm_manager_apply(cpc_pm_manager_t *manager,
 	if (pm->finished)
 		CPC_FAIL_FORCE(CPC_ERR_DENIED);
 
-	if (pm->applied)
+	if (pm->applied || (pm->digest &&
+			    g_hash_table_lookup_extended(manager->applied,
+							 pm->digest, NULL,
+							 NULL)))
 		CPC_FAIL_FORCE(CPC_ERR_ALREADY_APPLIED);
 
 	apply_data = g_new0(cpc_apply_data_t, 1);
 	apply_data->manager = manager;
-	apply_data->pm_path = g_strdup(path);
+	apply_data->number = pm->number;
+
+	prv_touch(manager, pm);
 
 	CPC_FAIL(cpc_provision_wp_apply(pm->provision, pin, prv_apply_finished,
+					apply_data, prv_map_message,
 					apply_data));
 
 	pm->finished = finished;
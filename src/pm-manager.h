@@ -40,6 +40,14 @@
 
 typedef struct cpc_pm_manager_t_ cpc_pm_manager_t;
 
+/*
+ * created is false if path is that of an object which existed before the
+ * call, i.e., the message duplicated one that the client had already
+ * created.
+ */
+
+typedef void (*cpc_pm_manager_new_cb_t)(int result, const gchar *path,
+					bool created, void *user_data);
 
 typedef struct cpc_props_t_ cpc_props_t;
 struct cpc_props_t_ {
@@ -51,25 +59,99 @@ struct cpc_props_t_ {
 
 void cpc_props_free(cpc_props_t *props);
 
+/*
+ * Limits on the memory held by push message objects.  A limit of 0 means
+ * that there is no limit.
+ */
+
+#define CPC_MAX_PM_BYTES ((size_t) CPC_MAX_MESSAGE_MEMORY * 1024)
+#define CPC_MAX_CLIENT_PM_BYTES ((size_t) CPC_MAX_CLIENT_MESSAGE_MEMORY * 1024)
+
+typedef struct cpc_pm_usage_t_ cpc_pm_usage_t;
+struct cpc_pm_usage_t_ {
+	size_t bytes;
+	unsigned int objects;
+};
+
+/*
+ * props is only valid for the duration of the callback.  It is NULL if the
+ * message could not be parsed.
+ */
+
+typedef void (*cpc_pm_manager_apply_cb_t)(int result, cpc_props_t *props,
+					  void *user_data);
+
 void cpc_pm_manager_new(GDBusInterfaceInfo *interface,
 			const GDBusInterfaceVTable *vtable,
 			gpointer user_data,
 			cpc_pm_manager_t **manager);
-int cpc_pm_manager_new_message(cpc_pm_manager_t *manager,
-			       const gchar *client_name,
-			       GDBusConnection *connection,
-			       uint8_t *data, unsigned int length,
-			       gchar **path);
+
+/*
+ * Parses data on a worker thread.  The manager takes ownership of data, which
+ * must have been allocated with g_malloc.  finished is invoked from the main
+ * context once the new object has been registered or the parse has failed.
+ */
+
+void cpc_pm_manager_new_message(cpc_pm_manager_t *manager,
+				const gchar *client_name,
+				GDBusConnection *connection,
+				uint8_t *data, unsigned int length,
+				cpc_pm_manager_new_cb_t finished,
+				void *finished_data);
+
+/*
+ * Like cpc_pm_manager_new_message but reads the message from fd, which is
+ * mapped on the worker thread.  The manager takes ownership of fd.
+ */
+
+void cpc_pm_manager_new_message_fd(cpc_pm_manager_t *manager,
+				   const gchar *client_name,
+				   GDBusConnection *connection, int fd,
+				   cpc_pm_manager_new_cb_t finished,
+				   void *finished_data);
+
+/*
+ * Parses data on a worker thread like cpc_pm_manager_new_message, but
+ * instead of registering a d-Bus object for the message, authenticates it
+ * with pin and provisions its settings straight away.  finished is invoked
+ * with the properties of the message once provisioning has completed.
+ */
+
+void cpc_pm_manager_create_and_apply(cpc_pm_manager_t *manager,
+				     const gchar *client_name,
+				     GDBusConnection *connection,
+				     uint8_t *data, unsigned int length,
+				     const gchar *pin,
+				     cpc_pm_manager_apply_cb_t finished,
+				     void *finished_data,
+				     cpc_handle_t *handle);
+void cpc_pm_manager_create_and_apply_cancel(cpc_pm_manager_t *manager,
+					    cpc_handle_t handle);
 int cpc_pm_manager_get_properties(cpc_pm_manager_t *manager,
 				  const gchar *path,
 				  const gchar* client_name,
 				  cpc_props_t *props);
+
+/*
+ * Pinned messages are never evicted to make room for new ones, although
+ * they can still be removed.  Pins are counted, so each successful call to
+ * cpc_pm_manager_pin_message needs to be matched by a call to
+ * cpc_pm_manager_unpin_message.
+ */
+
+int cpc_pm_manager_pin_message(cpc_pm_manager_t *manager, const gchar *path);
+void cpc_pm_manager_unpin_message(cpc_pm_manager_t *manager,
+				  const gchar *path);
+
 int cpc_pm_manager_remove_message(cpc_pm_manager_t *manager,
 				  const gchar *path,
 				  const gchar *client_name);
 void cpc_pm_manager_delete(cpc_pm_manager_t *manager);
 
 unsigned int cpc_pm_manager_message_count(cpc_pm_manager_t *manager);
+void cpc_pm_manager_get_usage(cpc_pm_manager_t *manager,
+			      const gchar *client_name, cpc_pm_usage_t *total,
+			      cpc_pm_usage_t *client);
 
 void cpc_pm_manager_lost_client(cpc_pm_manager_t *manager,
 				const gchar *name);
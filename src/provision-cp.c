@@ -30,6 +30,8 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "log.h"
 #include "error.h"
@@ -49,12 +51,28 @@ struct cpc_tasks_cp_context_ {
 	cpc_context_t *context;
 	guint finished_source;
 	cpc_handle_t prov_handle;
+	gchar **fnames;
+	int fd;
+	unsigned int fname_count;
+	cpc_settings_t *settings;
+	int *results;
+	gint parsing;
+	GThreadPool *pool;
+	bool cancelled;
 };
 
 static void prv_cpc_tasks_cp_context_delete(cpc_tasks_cp_context *task_context)
 {
+	unsigned int i;
+
 	if (task_context) {
 		cpc_context_delete(task_context->context);
+		if (task_context->settings)
+			for (i = 0; i < task_context->fname_count; ++i)
+				cpc_settings_free(&task_context->settings[i]);
+		g_free(task_context->settings);
+		g_free(task_context->results);
+		g_strfreev(task_context->fnames);
 		g_free(task_context);
 	}
 }
@@ -78,58 +96,226 @@ static void prv_provision_cb(void *user_data, int result)
 		g_idle_add(prv_provision_finished, user_data);
 }
 
-int cpc_provision_cp_apply(const gchar *fname, cpc_cb_t finished,
-			   void *finished_data, cpc_handle_t *handle)
+static gboolean prv_files_parsed(gpointer user_data);
+
+/*
+ * Runs on a worker thread.  Each file is parsed and converted into settings
+ * independently.  The last worker to finish hands the results back to the
+ * main context.  A task created from a file descriptor has no fnames and a
+ * single document, read from fd.
+ */
+
+static void prv_parse_file(gpointer data, gpointer user_data)
 {
 	CPC_ERR_MANAGE;
-	uint8_t *buffer = NULL;
-	size_t file_size;
-	cpc_tasks_cp_context *task_context;
-	cpc_context_t *context;
-	cpc_provision_handle_t prov_handle;
+	cpc_tasks_cp_context *task_context = user_data;
+	unsigned int i = GPOINTER_TO_UINT(data) - 1;
+	cpc_file_map_t map;
+	cpc_context_t *context = NULL;
 
-	CPC_LOGF("Process CP task");
+	if (!task_context->fnames) {
+		CPC_ERR = cpc_context_new_from_fd(task_context->fd,
+						  CPC_APP_TYPES, &context);
+		close(task_context->fd);
+		CPC_FAIL(CPC_ERR);
+		goto parsed;
+	}
 
-	task_context = g_new0(cpc_tasks_cp_context, 1);
+	CPC_FAIL(cpc_file_map(task_context->fnames[i], &map));
 
-	CPC_ERR = cpc_file_get_binary(fname, &file_size, &buffer);
+	if (map.length > INT_MAX)
+		CPC_ERR = CPC_ERR_CORRUPT;
+	else
+		CPC_ERR = cpc_context_new((const char *) map.data, map.length,
+					  CPC_APP_TYPES, &context);
+	cpc_file_unmap(&map);
+	CPC_FAIL(CPC_ERR);
 
-	if (CPC_ERR != CPC_ERR_NONE) {
-		CPC_LOGF("Unable to load CP file: %s", fname);
-		goto CPC_ON_ERR;
-	}
+parsed:
 
-	if (file_size > INT_MAX) {
-		CPC_LOGF("File: %s too large", fname);
-		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
-	}
+	cpc_settings_init(&task_context->settings[i], context);
+
+CPC_ON_ERR:
+
+	cpc_context_delete(context);
+	task_context->results[i] = CPC_ERR;
 
-	CPC_ERR = cpc_context_new((const char*) buffer,
-				  file_size, &context);
+	if (g_atomic_int_dec_and_test(&task_context->parsing))
+		(void) g_idle_add(prv_files_parsed, task_context);
+}
+
+static gboolean prv_files_parsed(gpointer user_data)
+{
+	CPC_ERR_MANAGE;
+	cpc_tasks_cp_context *task_context = user_data;
+	cpc_settings_t *settings = task_context->settings;
+	unsigned int i;
 
-	if (CPC_ERR != CPC_ERR_NONE) {
-		CPC_LOGF("Unable to parse %s, err = %d",
-			      fname, CPC_ERR);
-		goto CPC_ON_ERR;
+	g_thread_pool_free(task_context->pool, FALSE, TRUE);
+	task_context->pool = NULL;
+
+	if (task_context->cancelled)
+		CPC_FAIL_FORCE(CPC_ERR_CANCELLED);
+
+	for (i = 0; i < task_context->fname_count; ++i) {
+		if (task_context->results[i] != CPC_ERR_NONE) {
+			CPC_LOGF("Unable to parse %s, err = %d",
+				 task_context->fnames ?
+				 task_context->fnames[i] : "fd",
+				 task_context->results[i]);
+			CPC_FAIL_FORCE(task_context->results[i]);
+		}
 	}
 
-	cpc_provision_apply(context, "", prv_provision_cb, task_context,
-			    &prov_handle);
+	/* Later files take precedence over earlier ones */
+
+	for (i = 1; i < task_context->fname_count; ++i)
+		cpc_settings_merge(&settings[0], &settings[i]);
+
+	cpc_provision_apply_settings(&settings[0], "", prv_provision_cb,
+				     task_context,
+				     &task_context->prov_handle);
+
+	return FALSE;
+
+CPC_ON_ERR:
+
+	task_context->result = CPC_ERR;
+
+	return prv_provision_finished(task_context);
+}
+
+static cpc_tasks_cp_context *prv_cp_context_new(cpc_cb_t finished,
+						 void *finished_data,
+						 unsigned int count)
+{
+	cpc_tasks_cp_context *task_context;
 
-	task_context->context = context;
+	task_context = g_new0(cpc_tasks_cp_context, 1);
 	task_context->finished = finished;
 	task_context->finished_data = finished_data;
-	task_context->prov_handle = prov_handle;
-	*handle = task_context;
+	task_context->fd = -1;
+	task_context->fname_count = count;
+	task_context->settings = g_new0(cpc_settings_t, count);
+	task_context->results = g_new0(int, count);
+	task_context->parsing = count;
 
-	free(buffer);
+	return task_context;
+}
+
+static void prv_parse_documents(cpc_tasks_cp_context *task_context)
+{
+	unsigned int count = task_context->fname_count;
+	unsigned int i;
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	task_context->pool =
+		g_thread_pool_new(prv_parse_file, task_context,
+				  MIN(count, (unsigned int) cpus), FALSE,
+				  NULL);
+
+	for (i = 0; i < count; ++i)
+		(void) g_thread_pool_push(task_context->pool,
+					  GUINT_TO_POINTER(i + 1), NULL);
+}
+
+int cpc_provision_cp_apply(const gchar *fname, cpc_cb_t finished,
+			   void *finished_data, cpc_handle_t *handle)
+{
+	const gchar *fnames[] = { fname, NULL };
+
+	CPC_LOGF("Process CP task");
+
+	return cpc_provision_cp_apply_files(fnames, finished, finished_data,
+					    handle);
+}
+
+int cpc_provision_cp_apply_fd(int fd, cpc_cb_t finished,
+			      void *finished_data, cpc_handle_t *handle)
+{
+	cpc_tasks_cp_context *task_context;
+
+	CPC_LOGF("Process CP task from fd %d", fd);
+
+	task_context = prv_cp_context_new(finished, finished_data, 1);
+	task_context->fd = fd;
+	prv_parse_documents(task_context);
+
+	*handle = task_context;
 
 	return CPC_ERR_NONE;
+}
+
+int cpc_provision_cp_apply_files(const gchar *const *fnames,
+				 cpc_cb_t finished, void *finished_data,
+				 cpc_handle_t *handle)
+{
+	CPC_ERR_MANAGE;
+	cpc_tasks_cp_context *task_context;
+	unsigned int count = g_strv_length((gchar **) fnames);
+
+	CPC_LOGF("Process CP task for %u files", count);
+
+	if (count == 0)
+		CPC_FAIL_FORCE(CPC_ERR_OPEN);
+
+	task_context = prv_cp_context_new(finished, finished_data, count);
+	task_context->fnames = g_strdupv((gchar **) fnames);
+	prv_parse_documents(task_context);
+
+	*handle = task_context;
 
 CPC_ON_ERR:
 
-	prv_cpc_tasks_cp_context_delete(task_context);
-	free(buffer);
+	return CPC_ERR;
+}
+
+static gint prv_compare_names(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar *const *) a, *(const gchar *const *) b);
+}
+
+int cpc_provision_cp_apply_dir(const gchar *dirname, cpc_cb_t finished,
+			       void *finished_data, cpc_handle_t *handle)
+{
+	CPC_ERR_MANAGE;
+	GDir *dir;
+	const gchar *name;
+	gchar *fname;
+	GPtrArray *fnames;
+
+	CPC_LOGF("Process CP directory %s", dirname);
+
+	dir = g_dir_open(dirname, 0, NULL);
+	if (!dir) {
+		CPC_LOGF("Unable to open directory %s", dirname);
+		CPC_FAIL_FORCE(CPC_ERR_OPEN);
+	}
+
+	fnames = g_ptr_array_new_with_free_func(g_free);
+	while ((name = g_dir_read_name(dir))) {
+		fname = g_build_filename(dirname, name, NULL);
+		if (name[0] != '.' &&
+		    g_file_test(fname, G_FILE_TEST_IS_REGULAR))
+			g_ptr_array_add(fnames, fname);
+		else
+			g_free(fname);
+	}
+	g_dir_close(dir);
+
+	g_ptr_array_sort(fnames, prv_compare_names);
+	g_ptr_array_add(fnames, NULL);
+
+	CPC_ERR = cpc_provision_cp_apply_files(
+		(const gchar *const *) fnames->pdata, finished, finished_data,
+		handle);
+
+	g_ptr_array_unref(fnames);
+
+CPC_ON_ERR:
 
 	return CPC_ERR;
 }
@@ -138,6 +324,8 @@ void cpc_provision_cp_apply_cancel(cpc_handle_t handle)
 {
 	cpc_tasks_cp_context *task_context = handle;
 
-	if (task_context->prov_handle && !task_context->finished_source)
+	if (task_context->pool)
+		task_context->cancelled = true;
+	else if (task_context->prov_handle && !task_context->finished_source)
 		cpc_provision_apply_cancel(task_context->prov_handle);
 }
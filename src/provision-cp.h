@@ -32,9 +32,42 @@
 
 #include "callback.h"
 
+/*
+ * The document is parsed on a worker thread.  Errors that occur while
+ * loading or parsing it are reported through finished.
+ */
+
 int cpc_provision_cp_apply(const gchar *fname, cpc_cb_t finished,
 			   void *finished_data, cpc_handle_t *handle);
 
+/*
+ * Takes ownership of fd, which is read and closed on a worker thread, as
+ * for cpc_provision_cp_apply.
+ */
+
+int cpc_provision_cp_apply_fd(int fd, cpc_cb_t finished,
+			      void *finished_data, cpc_handle_t *handle);
+
+/*
+ * Parses the files in fnames in parallel and provisions their combined
+ * settings in a single provman session per instance.  Where two files define
+ * the same setting, the file that appears later in fnames takes precedence.
+ * If any of the files cannot be parsed nothing is provisioned.
+ */
+
+int cpc_provision_cp_apply_files(const gchar *const *fnames,
+				 cpc_cb_t finished, void *finished_data,
+				 cpc_handle_t *handle);
+
+/*
+ * Applies all the regular files in dirname, other than hidden files, as
+ * cpc_provision_cp_apply_files does.  The files are applied in the order of
+ * their names.
+ */
+
+int cpc_provision_cp_apply_dir(const gchar *dirname, cpc_cb_t finished,
+			       void *finished_data, cpc_handle_t *handle);
+
 void cpc_provision_cp_apply_cancel(cpc_handle_t handle);
 
 #endif
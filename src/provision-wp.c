@@ -30,6 +30,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "error.h"
 #include "error-macros.h"
 #include "log.h"
@@ -40,7 +42,7 @@
 
 struct cpc_provision_wp_t_ {
 	cpc_wp_t *wp;
-	cpc_context_t *context;
+	GVariant *settings;
 	gchar **imsis;
 	cpc_provisioned_set appids;
 	cpc_ptr_array_t *start_sessions;
@@ -49,48 +51,127 @@ struct cpc_provision_wp_t_ {
 	void *user_data;
 	cpc_imsi_handle_t imsi_handle;
 	cpc_provision_handle_t prov_handle;
+	cpc_provision_wp_map_cb_t map;
+	void *map_data;
+	bool mapping;
+	bool cancelled;
 	int result;
 	bool applied;
+	size_t size;
 };
 
-int cpc_provision_wp_new(uint8_t *data, unsigned int length,
-			 cpc_provision_wp_t **provision)
+static int prv_get_prov_doc(cpc_wp_t *wp, char **prov_doc,
+			    unsigned int *prov_doc_size)
 {
 	CPC_ERR_MANAGE;
-	unsigned int prov_doc_size;
-	char *prov_doc = NULL;
-	cpc_provision_wp_t *prov = g_new0(cpc_provision_wp_t, 1);
 
-	CPC_ERR = cpc_wp_new(data, length, &prov->wp);
-	if (CPC_ERR != CPC_ERR_NONE) {
-		CPC_LOGF("Fail to create WAP Push context, err = %d", CPC_ERR);
-		goto CPC_ON_ERR;
-	}
-
-	CPC_ERR = cpc_get_prov_doc(prov->wp, &prov_doc, &prov_doc_size);
+	CPC_ERR = cpc_get_prov_doc(wp, prov_doc, prov_doc_size);
 	if (CPC_ERR != CPC_ERR_NONE) {
 		CPC_LOGF("Fail to retrieve XML document, err = %d", CPC_ERR);
 		goto CPC_ON_ERR;
 	}
 
-	if (prov_doc_size > INT_MAX) {
+	if (*prov_doc_size > INT_MAX) {
 		CPC_LOGF("XML document too large, err = %d", CPC_ERR);
+		free(*prov_doc);
+		*prov_doc = NULL;
 		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
 	}
 
-	CPC_ERR = cpc_context_new(prov_doc, prov_doc_size, &prov->context);
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+/*
+ * Maps the document onto the object model and generates the settings that
+ * Apply passes to provman.  If appids is not NULL the model is also
+ * analysed.
+ */
+
+static int prv_map_document(cpc_provision_wp_t *prov, const char *prov_doc,
+			    unsigned int prov_doc_size,
+			    cpc_provisioned_set *appids)
+{
+	CPC_ERR_MANAGE;
+	cpc_context_t *context = NULL;
+	cpc_settings_t settings;
+
+	CPC_ERR = cpc_context_new(prov_doc, prov_doc_size, CPC_APP_TYPES,
+				  &context);
 	if (CPC_ERR != CPC_ERR_NONE) {
 		CPC_LOGF("Fail to parse wap push message, err = %d", CPC_ERR);
 		goto CPC_ON_ERR;
 	}
 
-	CPC_ERR = cpc_context_analyse(prov->context, &prov->appids,
-				      &prov->start_sessions);
+	if (appids) {
+		CPC_ERR = cpc_context_analyse(context, appids,
+					      &prov->start_sessions);
+		if (CPC_ERR != CPC_ERR_NONE) {
+			CPC_LOGF("Fail to analyse wap push message, err = %d",
+				 CPC_ERR);
+			goto CPC_ON_ERR;
+		}
+	}
+
+	cpc_settings_init(&settings, context);
+	prov->settings = cpc_settings_pack(&settings);
+
+CPC_ON_ERR:
+
+	cpc_context_delete(context);
+
+	return CPC_ERR;
+}
+
+int cpc_provision_wp_new(uint8_t *data, unsigned int length, bool lazy,
+			 cpc_provision_wp_t **provision)
+{
+	CPC_ERR_MANAGE;
+	unsigned int prov_doc_size;
+	char *prov_doc = NULL;
+	size_t body_len;
+	const char *mac;
+	cpc_provision_wp_t *prov = g_new0(cpc_provision_wp_t, 1);
+
+	CPC_ERR = cpc_wp_new(data, length, &prov->wp);
 	if (CPC_ERR != CPC_ERR_NONE) {
-		CPC_LOGF("Fail to analyse wap push message, err = %d", CPC_ERR);
+		CPC_LOGF("Fail to create WAP Push context, err = %d", CPC_ERR);
 		goto CPC_ON_ERR;
 	}
 
+	CPC_FAIL(prv_get_prov_doc(prov->wp, &prov_doc, &prov_doc_size));
+
+	if (lazy) {
+		CPC_ERR = cpc_context_summarise(prov_doc, prov_doc_size,
+						CPC_APP_TYPES, &prov->appids,
+						&prov->start_sessions);
+		if (CPC_ERR != CPC_ERR_NONE) {
+			CPC_LOGF("Fail to parse wap push message, err = %d",
+				 CPC_ERR);
+			goto CPC_ON_ERR;
+		}
+	} else {
+		CPC_FAIL(prv_map_document(prov, prov_doc, prov_doc_size,
+					  &prov->appids));
+	}
+
+	/*
+	 * Messages can stay around for a long time before they are applied,
+	 * so only what Apply needs is kept: the MAC and body for
+	 * authentication and, unless they are to be generated lazily, the
+	 * settings generated from the document, in packed form.  The
+	 * document and the parsed context are released.
+	 */
+
+	CPC_FAIL(cpc_wp_compact(prov->wp));
+
+	(void) cpc_wp_body(prov->wp, &body_len);
+	mac = cpc_wp_mac(prov->wp);
+	prov->size = sizeof(*prov) + body_len + (mac ? strlen(mac) + 1 : 0);
+	if (prov->settings)
+		prov->size += g_variant_get_size(prov->settings);
+
 	*provision = prov;
 	prov = NULL;
 
@@ -107,7 +188,8 @@ void cpc_provision_wp_delete(cpc_provision_wp_t *provision)
 	if (provision) {
 		if (provision->imsis)
 			g_strfreev(provision->imsis);
-		cpc_context_delete(provision->context);
+		if (provision->settings)
+			g_variant_unref(provision->settings);
 		cpc_wp_delete(provision->wp);
 		if (provision->start_sessions) {
 			cpc_ptr_array_free(provision->start_sessions);
@@ -118,6 +200,11 @@ void cpc_provision_wp_delete(cpc_provision_wp_t *provision)
 	}
 }
 
+size_t cpc_provision_wp_size(cpc_provision_wp_t *provision)
+{
+	return provision->size;
+}
+
 bool cpc_provision_wp_pin_required(cpc_provision_wp_t *provision)
 {
 	cpc_sec_t sec_type;
@@ -297,6 +384,83 @@ static void prv_provision_cb(void *user_data, int result)
 	(void) g_idle_add(prv_apply_finished, user_data);
 }
 
+int cpc_provision_wp_map(cpc_provision_wp_t *provision)
+{
+	CPC_ERR_MANAGE;
+	unsigned int prov_doc_size;
+	char *prov_doc = NULL;
+
+	if (provision->settings)
+		goto CPC_ON_ERR;
+
+	CPC_FAIL(prv_get_prov_doc(provision->wp, &prov_doc, &prov_doc_size));
+	CPC_FAIL(prv_map_document(provision, prov_doc, prov_doc_size, NULL));
+	provision->size += g_variant_get_size(provision->settings);
+
+CPC_ON_ERR:
+
+	free(prov_doc);
+
+	return CPC_ERR;
+}
+
+static void prv_apply_settings(cpc_provision_wp_t *provision)
+{
+	cpc_settings_t settings;
+
+	cpc_settings_unpack(&settings, provision->settings);
+	cpc_provision_apply_settings(&settings, "", prv_provision_cb,
+				     provision, &provision->prov_handle);
+}
+
+/*
+ * Messages created lazily are only mapped once they have been
+ * authenticated, so that messages which are never applied, or whose PIN is
+ * wrong, never pay for it.  The mapping is handed to the map callback, if
+ * there is one, so that it does not block the main context.
+ */
+
+static int prv_provision(cpc_provision_wp_t *provision)
+{
+	CPC_ERR_MANAGE;
+
+	if (!provision->settings) {
+		if (provision->map) {
+			provision->mapping = true;
+			provision->map(provision, provision->map_data);
+			goto CPC_ON_ERR;
+		}
+		CPC_FAIL(cpc_provision_wp_map(provision));
+	}
+
+	prv_apply_settings(provision);
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+void cpc_provision_wp_map_finished(cpc_provision_wp_t *provision, int result)
+{
+	CPC_ERR_MANAGE;
+
+	provision->mapping = false;
+
+	if (provision->cancelled)
+		CPC_FAIL_FORCE(CPC_ERR_CANCELLED);
+
+	CPC_FAIL(result);
+
+	prv_apply_settings(provision);
+
+	return;
+
+CPC_ON_ERR:
+
+	provision->result = CPC_ERR;
+	(void) g_idle_add(prv_apply_finished, provision);
+}
+
 static void prv_imsi_cb(int result, gchar **imsis, void *user_data)
 {
 	CPC_ERR_MANAGE;
@@ -308,8 +472,7 @@ static void prv_imsi_cb(int result, gchar **imsis, void *user_data)
 
 	provision->imsis = imsis;
 	CPC_FAIL(prv_authenticate_message(provision, provision->pin));
-	cpc_provision_apply(provision->context, "", prv_provision_cb,
-			    provision, &provision->prov_handle);
+	CPC_FAIL(prv_provision(provision));
 
 	return;
 
@@ -320,12 +483,16 @@ CPC_ON_ERR:
 }
 
 int cpc_provision_wp_apply(cpc_provision_wp_t *provision,
-			   const gchar *pin, cpc_cb_t cb, void *user_data)
+			   const gchar *pin, cpc_cb_t cb, void *user_data,
+			   cpc_provision_wp_map_cb_t map, void *map_data)
 {
 	CPC_ERR_MANAGE;
 	cpc_sec_t sec_type;
 
 	sec_type = cpc_wp_security(provision->wp);
+	provision->map = map;
+	provision->map_data = map_data;
+	provision->cancelled = false;
 
 	if (!provision->imsis && ((sec_type == CPC_SECURITY_NETWPIN) ||
 				 (sec_type == CPC_SECURITY_USERNETWPIN))) {
@@ -334,8 +501,7 @@ int cpc_provision_wp_apply(cpc_provision_wp_t *provision,
 		cpc_imsi_get(prv_imsi_cb, provision, &provision->imsi_handle);
 	} else {
 		CPC_FAIL(prv_authenticate_message(provision, pin));
-		cpc_provision_apply(provision->context, "", prv_provision_cb,
-				    provision, &provision->prov_handle);
+		CPC_FAIL(prv_provision(provision));
 	}
 
 	provision->cb = cb;
@@ -352,6 +518,8 @@ void cpc_provision_wp_apply_cancel(cpc_provision_wp_t *provision)
 
 	if (provision->imsi_handle)
 		cpc_imsi_get_cancel(provision->imsi_handle);
+	else if (provision->mapping)
+		provision->cancelled = true;
 	else if (provision->prov_handle)
 		cpc_provision_apply_cancel(provision->prov_handle);
 }
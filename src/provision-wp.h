@@ -39,15 +39,49 @@
 
 typedef struct cpc_provision_wp_t_ cpc_provision_wp_t;
 
-int cpc_provision_wp_new(uint8_t *data, unsigned int length,
+/*
+ * Called from the main context by cpc_provision_wp_apply when the settings
+ * of a message created lazily need to be generated.  The callee arranges
+ * for cpc_provision_wp_map to be called, typically on a worker thread, and
+ * then for cpc_provision_wp_map_finished to be called from the main
+ * context with its result.
+ */
+
+typedef void (*cpc_provision_wp_map_cb_t)(cpc_provision_wp_t *provision,
+					  void *user_data);
+
+/*
+ * If lazy is true the message is only validated and summarised.  It is
+ * mapped onto the object model and its settings generated the first time it
+ * is successfully authenticated by cpc_provision_wp_apply.
+ */
+
+int cpc_provision_wp_new(uint8_t *data, unsigned int length, bool lazy,
 			 cpc_provision_wp_t **provision);
 void cpc_provision_wp_delete(cpc_provision_wp_t *provision);
+size_t cpc_provision_wp_size(cpc_provision_wp_t *provision);
 bool cpc_provision_wp_pin_required(cpc_provision_wp_t *provision);
 gchar *cpc_provision_wp_get_settings(cpc_provision_wp_t *provision);
 const gchar *cpc_provision_wp_get_sec_type(cpc_provision_wp_t *provision);
 gchar *cpc_provision_wp_get_sessions(cpc_provision_wp_t *provision);
+
+/*
+ * If map is NULL, the settings of a message created lazily are generated
+ * synchronously.
+ */
+
 int cpc_provision_wp_apply(cpc_provision_wp_t *provision, const gchar *pin,
-			   cpc_cb_t cb,void *user_data);
+			   cpc_cb_t cb, void *user_data,
+			   cpc_provision_wp_map_cb_t map, void *map_data);
+
+/*
+ * Generates the settings of a message created lazily, if that has not been
+ * done already, and adds them to its size.  Only provision is touched, so
+ * this may be called from any thread while nothing else uses provision.
+ */
+
+int cpc_provision_wp_map(cpc_provision_wp_t *provision);
+void cpc_provision_wp_map_finished(cpc_provision_wp_t *provision, int result);
 void cpc_provision_wp_apply_cancel(cpc_provision_wp_t *provision);
 
 
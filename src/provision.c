@@ -83,9 +83,60 @@ typedef enum cpc_provision_state_t_ cpc_provision_state_t;
 
 typedef struct omacp_provision_t_ omacp_provision_t;
 
-struct omacp_provision_t_ {
+/*
+ * Only one provisioning session at a time is run against each provman
+ * instance, as the sessions of a single client are not isolated from each
+ * other.  Provisioning requests that need an instance that is in use wait
+ * for it in the waiting queue of that instance's lock.
+ */
+
+typedef struct cpc_provman_lock_t_ cpc_provman_lock_t;
+struct cpc_provman_lock_t_ {
+	omacp_provision_t *owner;
+	GQueue waiting;
+};
+
+static cpc_provman_lock_t g_session_lock;
+static cpc_provman_lock_t g_system_lock;
+
+/*
+ * A provisioning request that arrives while no session is active is started
+ * straight away.  Requests that arrive while one is active are merged into
+ * a pending session, which starts once no session is active any more or
+ * CPC_APPLY_WINDOW milliseconds after its first request, whichever comes
+ * first.  g_coalescing points to the pending session, if any.  g_active
+ * counts the sessions that have started but not yet finished, including
+ * those waiting for a provman lock.
+ */
+
+static omacp_provision_t *g_coalescing;
+static unsigned int g_active;
+
+static void prv_provision_begin(omacp_provision_t *provision);
+
+/*
+ * Each call to cpc_provision_apply_settings creates a member.  The
+ * members of a session are notified in order once it has finished.  The
+ * members of a merged session keep a packed copy of their own settings, so
+ * that they can be provisioned separately if the merged session fails.
+ */
+
+typedef struct cpc_provision_member_t_ cpc_provision_member_t;
+struct cpc_provision_member_t_ {
+	omacp_provision_t *provision;
 	cpc_provision_cb_t finished;
 	void *finished_data;
+	cpc_settings_t settings;
+	GVariant *packed;
+	bool cancelled;
+};
+
+struct omacp_provision_t_ {
+	GPtrArray *members;
+	guint window_source;
+	bool started;
+	bool writing;
+	bool dropped;
 	GDBusProxy *session_proxy;
 	GDBusProxy *system_proxy;
 	GDBusProxy *current_proxy;
@@ -102,15 +153,81 @@ struct omacp_provision_t_ {
 	const gchar **always_remove;
 	unsigned int always_remove_count;
 	cpc_settings_t settings;
+	cpc_provman_lock_t *lock;
 };
 
 static void prv_provision_step(omacp_provision_t *provision);
+static void prv_merge_members(omacp_provision_t *provision);
 static void prv_system_proxy_created(GObject *source_object,
 				     GAsyncResult *result, gpointer user_data);
 
+static bool prv_lock_provman(omacp_provision_t *provision)
+{
+	cpc_provman_lock_t *lock =
+		(provision->current_proxy == provision->session_proxy) ?
+		&g_session_lock : &g_system_lock;
+
+	if (lock->owner == provision)
+		return true;
+
+	provision->lock = lock;
+
+	if (!lock->owner) {
+		lock->owner = provision;
+		return true;
+	}
+
+	CPC_LOGF("provman instance busy.  Waiting for it to become free");
+	g_queue_push_tail(&lock->waiting, provision);
+
+	return false;
+}
+
+static void prv_unlock_provman(omacp_provision_t *provision)
+{
+	cpc_provman_lock_t *lock = provision->lock;
+
+	if (!lock)
+		return;
+
+	provision->lock = NULL;
+
+	if (lock->owner != provision) {
+		(void) g_queue_remove(&lock->waiting, provision);
+	} else {
+		lock->owner = g_queue_pop_head(&lock->waiting);
+		if (lock->owner)
+			prv_provision_step(lock->owner);
+	}
+}
+
+static void prv_provision_member_delete(cpc_provision_member_t *member)
+{
+	cpc_settings_free(&member->settings);
+	if (member->packed)
+		g_variant_unref(member->packed);
+	g_free(member);
+}
+
 static void prv_omacp_provision_delete(omacp_provision_t *provision)
 {
+	unsigned int i;
+
 	if (provision) {
+		if (g_coalescing == provision)
+			g_coalescing = NULL;
+		if (provision->window_source)
+			(void) g_source_remove(provision->window_source);
+		if (provision->started && --g_active == 0 && g_coalescing) {
+			(void) g_source_remove(g_coalescing->window_source);
+			g_coalescing->window_source = 0;
+			prv_provision_begin(g_coalescing);
+		}
+		for (i = 0; i < provision->members->len; ++i)
+			prv_provision_member_delete(
+				g_ptr_array_index(provision->members, i));
+		g_ptr_array_unref(provision->members);
+		prv_unlock_provman(provision);
 		if (provision->cancellable)
 			g_object_unref(provision->cancellable);
 		if (provision->session_proxy)
@@ -125,11 +242,75 @@ static void prv_omacp_provision_delete(omacp_provision_t *provision)
 	}
 }
 
+static omacp_provision_t *prv_omacp_provision_new(const char *imsi)
+{
+	omacp_provision_t *provision;
+
+	provision = g_new0(omacp_provision_t, 1);
+	provision->members = g_ptr_array_new();
+	provision->current_objects =
+		g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	provision->imsi = g_strdup(imsi);
+	provision->cancellable = g_cancellable_new();
+
+	return provision;
+}
+
+/*
+ * Called when a merged session fails, so that one request that provman
+ * rejects does not fail all the others.  Each member that has not been
+ * cancelled is moved into a session of its own and provisioned again.
+ * Cancelled members are told the result of the merged session.
+ */
+
+static void prv_provision_separately(omacp_provision_t *provision)
+{
+	omacp_provision_t *alone;
+	cpc_provision_member_t *member;
+	unsigned int i;
+
+	CPC_LOGF("Merged session failed, err = %d.  Provisioning its %u "
+		 "requests separately", provision->result,
+		 provision->members->len);
+
+	for (i = 0; i < provision->members->len; ++i) {
+		member = g_ptr_array_index(provision->members, i);
+		if (member->cancelled) {
+			member->finished(member->finished_data,
+					 provision->result);
+			prv_provision_member_delete(member);
+			continue;
+		}
+
+		alone = prv_omacp_provision_new(provision->imsi);
+		cpc_settings_unpack(&member->settings, member->packed);
+		g_variant_unref(member->packed);
+		member->packed = NULL;
+		member->provision = alone;
+		g_ptr_array_add(alone->members, member);
+		prv_provision_begin(alone);
+	}
+
+	g_ptr_array_set_size(provision->members, 0);
+}
+
 static gboolean prv_provision_task_finished(gpointer user_data)
 {
 	omacp_provision_t *provision = user_data;
+	cpc_provision_member_t *member;
+	unsigned int i;
 
-	provision->finished(provision->finished_data, provision->result);
+	if (provision->members->len > 1 &&
+	    provision->result != CPC_ERR_NONE &&
+	    provision->result != CPC_ERR_CANCELLED) {
+		prv_provision_separately(provision);
+	} else {
+		for (i = 0; i < provision->members->len; ++i) {
+			member = g_ptr_array_index(provision->members, i);
+			member->finished(member->finished_data,
+					 provision->result);
+		}
+	}
 	prv_omacp_provision_delete(provision);
 
 	return FALSE;
@@ -155,6 +336,19 @@ static void prv_add_objects(omacp_provision_t *provision, const gchar *root,
 	}
 }
 
+static void prv_update_current(omacp_provision_t *provision)
+{
+	if (provision->current_proxy == provision->session_proxy) {
+		provision->current_settings =
+			provision->settings.session_settings;
+		provision->current_meta = provision->settings.session_meta;
+	} else {
+		provision->current_settings =
+			provision->settings.system_settings;
+		provision->current_meta = provision->settings.system_meta;
+	}
+}
+
 #ifdef CPC_OVERWRITE
 static void prv_identify_objects_to_remove(omacp_provision_t *provision)
 {
@@ -270,6 +464,25 @@ static void prv_get_objects_cb(GObject *source_object,
 
 	g_variant_unref(res);
 
+	/*
+	 * provman is about to be asked to change its settings, so this is
+	 * the last chance to drop the settings of cancelled members.
+	 */
+
+	provision->writing = true;
+	if (provision->dropped) {
+		provision->dropped = false;
+		prv_merge_members(provision);
+		prv_update_current(provision);
+		if (!provision->current_settings) {
+			CPC_LOGF("No settings left for this provman instance");
+			g_hash_table_remove_all(provision->current_objects);
+			provision->state = CPC_PROVISION_END;
+			prv_provision_step(provision);
+			return;
+		}
+	}
+
 #ifndef CPC_OVERWRITE
 	prv_remove_settings_for_existing_objects(provision);
 	g_hash_table_remove_all(provision->current_objects);
@@ -482,6 +695,9 @@ static void prv_provision_step(omacp_provision_t *provision)
 	GVariant *dict;
 
 	if (provision->state == CPC_PROVISION_START) {
+		if (!prv_lock_provman(provision))
+			return;
+
 		CPC_LOGF("Sending Start to provman instance %s",
 			 provision->imsi);
 
@@ -542,8 +758,10 @@ static void prv_provision_step(omacp_provision_t *provision)
 				  provision);
 		provision->state = CPC_PROVISION_FINISHED;
 	} else if (provision->state == CPC_PROVISION_FINISHED) {
+		prv_unlock_provman(provision);
 		if ((provision->current_proxy == provision->session_proxy) &&
-		    (provision->system_proxy)) {
+		    provision->system_proxy &&
+		    provision->settings.system_settings) {
 			prv_init_system(provision);
 			provision->state = CPC_PROVISION_START;
 			prv_provision_step(provision);
@@ -586,10 +804,18 @@ static int prv_proxy_created(GObject *source_object, GAsyncResult *result,
 
 static void prv_provision_start(omacp_provision_t *provision)
 {
-	if (provision->session_proxy) {
+	if (provision->session_proxy && provision->settings.session_settings) {
 		prv_init_session(provision);
-	} else if (provision->system_proxy) {
+	} else if (provision->system_proxy &&
+		   provision->settings.system_settings) {
 		prv_init_system(provision);
+	} else if (!provision->settings.session_settings &&
+		   !provision->settings.system_settings) {
+		CPC_LOGF("No settings left to provision");
+		provision->result = CPC_ERR_NONE;
+		provision->finished_source =
+			g_idle_add(prv_provision_task_finished, provision);
+		goto on_error;
 	} else {
 		CPC_LOGF("Unable to connect to either provman instances");
 		provision->result = CPC_ERR_IO;
@@ -653,19 +879,65 @@ void cpc_provision_apply(cpc_context_t *context, const char *imsi,
 			 cpc_provision_cb_t callback, void *user_data,
 			 cpc_provision_handle_t *handle)
 {
-	omacp_provision_t *provision;
+	cpc_settings_t settings;
 
-	provision = g_new0(omacp_provision_t, 1);
+	cpc_settings_init(&settings, context);
+	cpc_provision_apply_settings(&settings, imsi, callback, user_data,
+				     handle);
+}
 
-	cpc_settings_init(&provision->settings, context);
+/*
+ * Rebuilds the settings of provision from the packed settings of its
+ * members, later members taking precedence.
+ */
 
-	provision->current_objects =
-		g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-	provision->finished = callback;
-	provision->finished_data = user_data;
-	provision->imsi = g_strdup(imsi);
+static void prv_merge_members(omacp_provision_t *provision)
+{
+	cpc_provision_member_t *member;
+	cpc_settings_t settings;
+	unsigned int i;
 
-	provision->cancellable = g_cancellable_new();
+	cpc_settings_free(&provision->settings);
+	memset(&provision->settings, 0, sizeof(provision->settings));
+
+	for (i = 0; i < provision->members->len; ++i) {
+		member = g_ptr_array_index(provision->members, i);
+		cpc_settings_unpack(&settings, member->packed);
+		cpc_settings_merge(&provision->settings, &settings);
+		cpc_settings_free(&settings);
+	}
+}
+
+/*
+ * Called once no more requests are to be added to provision.  The settings
+ * of the members are merged, later requests taking precedence, and the
+ * provman session is started.
+ */
+
+static void prv_provision_begin(omacp_provision_t *provision)
+{
+	cpc_provision_member_t *member;
+	unsigned int i;
+
+	if (g_coalescing == provision)
+		g_coalescing = NULL;
+
+	provision->started = true;
+	++g_active;
+
+	if (provision->members->len == 1) {
+		member = g_ptr_array_index(provision->members, 0);
+		cpc_settings_merge(&provision->settings, &member->settings);
+	} else {
+		for (i = 0; i < provision->members->len; ++i) {
+			member = g_ptr_array_index(provision->members, i);
+			member->packed = cpc_settings_pack(&member->settings);
+		}
+		prv_merge_members(provision);
+	}
+
+	CPC_LOGF("Provisioning %u request(s) in one session",
+		 provision->members->len);
 
 	if (provision->settings.session_settings) {
 		CPC_LOGF("Creating session proxy");
@@ -691,14 +963,126 @@ void cpc_provision_apply(cpc_context_t *context, const char *imsi,
 			g_idle_add(prv_provision_task_finished, provision);
 		CPC_LOGF("No settings to provision");
 	}
+}
 
-	*handle = provision;
+static gboolean prv_window_closed(gpointer user_data)
+{
+	omacp_provision_t *provision = user_data;
+
+	provision->window_source = 0;
+	prv_provision_begin(provision);
+
+	return FALSE;
+}
+
+void cpc_provision_apply_settings(cpc_settings_t *settings, const char *imsi,
+				  cpc_provision_cb_t callback,
+				  void *user_data,
+				  cpc_provision_handle_t *handle)
+{
+	omacp_provision_t *provision = g_coalescing;
+	cpc_provision_member_t *member;
+
+	if (provision && strcmp(provision->imsi, imsi)) {
+		(void) g_source_remove(provision->window_source);
+		provision->window_source = 0;
+		prv_provision_begin(provision);
+		provision = NULL;
+	}
+
+	if (!provision) {
+		provision = prv_omacp_provision_new(imsi);
+		if (CPC_APPLY_WINDOW > 0 && g_active > 0) {
+			provision->window_source =
+				g_timeout_add(CPC_APPLY_WINDOW,
+					      prv_window_closed, provision);
+			g_coalescing = provision;
+		}
+	} else {
+		CPC_LOGF("Adding request to pending provisioning session");
+	}
+
+	member = g_new0(cpc_provision_member_t, 1);
+	member->provision = provision;
+	member->finished = callback;
+	member->finished_data = user_data;
+	member->settings = *settings;
+	memset(settings, 0, sizeof(*settings));
+	g_ptr_array_add(provision->members, member);
+
+	*handle = member;
+
+	if (provision != g_coalescing)
+		prv_provision_begin(provision);
+}
+
+static gboolean prv_member_cancelled(gpointer user_data)
+{
+	cpc_provision_member_t *member = user_data;
+
+	member->finished(member->finished_data, CPC_ERR_CANCELLED);
+	prv_provision_member_delete(member);
+
+	return FALSE;
+}
+
+static bool prv_all_cancelled(omacp_provision_t *provision)
+{
+	cpc_provision_member_t *member;
+	unsigned int i;
+
+	for (i = 0; i < provision->members->len; ++i) {
+		member = g_ptr_array_index(provision->members, i);
+		if (!member->cancelled)
+			return false;
+	}
+
+	return true;
 }
 
+/*
+ * A request is removed from its session, and told that it has been
+ * cancelled, as long as provman has not yet been asked to change anything.
+ * If the session has already started, its settings are merged again
+ * without those of the request before provman is changed.  After that a
+ * session is only cancelled when all of its members have asked for it to
+ * be.  Until then the settings of a cancelled member are provisioned and it
+ * is told the result of the session.
+ */
+
 void cpc_provision_apply_cancel(cpc_provision_handle_t handle)
 {
-	omacp_provision_t *provision = handle;
+	cpc_provision_member_t *member = handle;
+	omacp_provision_t *provision = member->provision;
+
+	if (member->cancelled)
+		return;
+
+	member->cancelled = true;
+
+	if (!provision->started ||
+	    (!provision->writing && provision->members->len > 1)) {
+		(void) g_ptr_array_remove(provision->members, member);
+		(void) g_idle_add(prv_member_cancelled, member);
+		if (provision->started)
+			provision->dropped = true;
+		else if (provision->members->len == 0)
+			prv_omacp_provision_delete(provision);
+		return;
+	}
+
+	if (!prv_all_cancelled(provision))
+		return;
 
-	if (provision->cancellable && !provision->finished_source)
-		g_cancellable_cancel(provision->cancellable);
+	if (provision->cancellable && !provision->finished_source) {
+		if (provision->lock && provision->lock->owner != provision) {
+			prv_unlock_provman(provision);
+			provision->result = CPC_ERR_CANCELLED;
+			provision->finished_source =
+				g_idle_add(prv_provision_task_finished,
+					   provision);
+		} else {
+			g_cancellable_cancel(provision->cancellable);
+		}
+	}
 }
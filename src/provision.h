@@ -30,6 +30,8 @@
 #ifndef CPC_PROVISION_H
 #define CPC_PROVISION_H
 
+#include "settings.h"
+
 typedef void (*cpc_provision_cb_t)(void *user_data, int result);
 typedef void *cpc_provision_handle_t;
 
@@ -39,6 +41,18 @@ void cpc_provision_apply(cpc_context_t *context,
 			 void *user_data,
 			 cpc_provision_handle_t *handle);
 
+/*
+ * Like cpc_provision_apply but provisions a set of settings that has already
+ * been generated.  Ownership of the contents of settings passes to the
+ * provisioning session and settings is left empty.
+ */
+
+void cpc_provision_apply_settings(cpc_settings_t *settings,
+				  const char *imsi,
+				  cpc_provision_cb_t callback,
+				  void *user_data,
+				  cpc_provision_handle_t *handle);
+
 void cpc_provision_apply_cancel(cpc_provision_handle_t handle);
 
 #endif
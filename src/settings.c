@@ -930,6 +930,182 @@ void cpc_settings_init(cpc_settings_t *settings, cpc_context_t *context)
 	g_free(acl_string);
 }
 
+static void prv_merge_table(GHashTable **table, GHashTable **other)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+
+	if (!*other)
+		return;
+
+	if (!*table) {
+		*table = *other;
+	} else {
+		g_hash_table_iter_init(&iter, *other);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			g_hash_table_iter_steal(&iter);
+			g_hash_table_replace(*table, key, value);
+		}
+		g_hash_table_unref(*other);
+	}
+
+	*other = NULL;
+}
+
+/*
+ * provman applies meta data in the order in which it is received, so
+ * appending the properties of other is enough for them to take precedence.
+ */
+
+static void prv_merge_meta(GPtrArray **meta, GPtrArray **other)
+{
+	unsigned int i;
+
+	if (!*other)
+		return;
+
+	if (!*meta) {
+		*meta = *other;
+	} else {
+		for (i = 0; i < (*other)->len; ++i)
+			g_ptr_array_add(*meta, g_ptr_array_index(*other, i));
+		g_ptr_array_set_free_func(*other, NULL);
+		g_ptr_array_unref(*other);
+	}
+
+	*other = NULL;
+}
+
+void cpc_settings_merge(cpc_settings_t *settings, cpc_settings_t *other)
+{
+	prv_merge_table(&settings->system_settings, &other->system_settings);
+	prv_merge_meta(&settings->system_meta, &other->system_meta);
+	prv_merge_table(&settings->session_settings,
+			&other->session_settings);
+	prv_merge_meta(&settings->session_meta, &other->session_meta);
+}
+
+#define CPC_SETTINGS_PACKED_TYPE "(a{ss}a(sss)a{ss}a(sss))"
+
+static void prv_pack_table(GVariantBuilder *vb, GHashTable *table)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+
+	g_variant_builder_open(vb, G_VARIANT_TYPE("a{ss}"));
+	if (table) {
+		g_hash_table_iter_init(&iter, table);
+		while (g_hash_table_iter_next(&iter, &key, &value))
+			g_variant_builder_add(vb, "{ss}", key, value);
+	}
+	g_variant_builder_close(vb);
+}
+
+static void prv_pack_meta(GVariantBuilder *vb, GPtrArray *meta)
+{
+	cpc_meta_prop_t *prop;
+	unsigned int i;
+
+	g_variant_builder_open(vb, G_VARIANT_TYPE("a(sss)"));
+	if (meta) {
+		for (i = 0; i < meta->len; ++i) {
+			prop = g_ptr_array_index(meta, i);
+			g_variant_builder_add(vb, "(sss)", prop->key,
+					      prop->prop, prop->value);
+		}
+	}
+	g_variant_builder_close(vb);
+}
+
+GVariant *cpc_settings_pack(cpc_settings_t *settings)
+{
+	GVariantBuilder vb;
+	GVariant *packed;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE(CPC_SETTINGS_PACKED_TYPE));
+	prv_pack_table(&vb, settings->system_settings);
+	prv_pack_meta(&vb, settings->system_meta);
+	prv_pack_table(&vb, settings->session_settings);
+	prv_pack_meta(&vb, settings->session_meta);
+	packed = g_variant_ref_sink(g_variant_builder_end(&vb));
+
+	/* Serialising the variant releases its tree of child values */
+
+	(void) g_variant_get_data(packed);
+
+	cpc_settings_free(settings);
+	memset(settings, 0, sizeof(*settings));
+
+	return packed;
+}
+
+static GHashTable *prv_unpack_table(GVariant *array)
+{
+	GHashTable *table = NULL;
+	GVariantIter iter;
+	gchar *key;
+	gchar *value;
+
+	if (g_variant_n_children(array) > 0) {
+		table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, g_free);
+		g_variant_iter_init(&iter, array);
+		while (g_variant_iter_next(&iter, "{ss}", &key, &value))
+			g_hash_table_insert(table, key, value);
+	}
+
+	return table;
+}
+
+static GPtrArray *prv_unpack_meta(GVariant *array)
+{
+	GPtrArray *meta = NULL;
+	GVariantIter iter;
+	cpc_meta_prop_t *prop;
+	gchar *key;
+	gchar *name;
+	gchar *value;
+
+	if (g_variant_n_children(array) > 0) {
+		meta = g_ptr_array_new_with_free_func(
+			prv_cpc_meta_data_prop_delete);
+		g_variant_iter_init(&iter, array);
+		while (g_variant_iter_next(&iter, "(sss)", &key, &name,
+					   &value)) {
+			prop = g_new(cpc_meta_prop_t, 1);
+			prop->key = key;
+			prop->prop = name;
+			prop->value = value;
+			g_ptr_array_add(meta, prop);
+		}
+	}
+
+	return meta;
+}
+
+void cpc_settings_unpack(cpc_settings_t *settings, GVariant *packed)
+{
+	GVariant *child;
+
+	child = g_variant_get_child_value(packed, 0);
+	settings->system_settings = prv_unpack_table(child);
+	g_variant_unref(child);
+
+	child = g_variant_get_child_value(packed, 1);
+	settings->system_meta = prv_unpack_meta(child);
+	g_variant_unref(child);
+
+	child = g_variant_get_child_value(packed, 2);
+	settings->session_settings = prv_unpack_table(child);
+	g_variant_unref(child);
+
+	child = g_variant_get_child_value(packed, 3);
+	settings->session_meta = prv_unpack_meta(child);
+	g_variant_unref(child);
+}
+
 void cpc_settings_free(cpc_settings_t *settings)
 {
 	if (settings->system_settings)
@@ -31,6 +31,8 @@
 #ifndef CPC_SETTINGS_H
 #define CPC_SETTINGS_H
 
+#include <glib.h>
+
 typedef struct cpc_settings_t_ cpc_settings_t;
 struct cpc_settings_t_ {
 	GHashTable *system_settings;
@@ -49,4 +51,20 @@ struct cpc_meta_prop_t_ {
 void cpc_settings_init(cpc_settings_t *settings, cpc_context_t *context);
 void cpc_settings_free(cpc_settings_t *settings);
 
+/*
+ * Moves the contents of other into settings.  Where both define the same key
+ * the value from other takes precedence.  other is left empty.
+ */
+
+void cpc_settings_merge(cpc_settings_t *settings, cpc_settings_t *other);
+
+/*
+ * Packs settings into a single serialised GVariant, which is much smaller
+ * than the hash tables and arrays, and leaves settings empty.
+ * cpc_settings_unpack recreates the settings from the packed form.
+ */
+
+GVariant *cpc_settings_pack(cpc_settings_t *settings);
+void cpc_settings_unpack(cpc_settings_t *settings, GVariant *packed);
+
 #endif
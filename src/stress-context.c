@@ -0,0 +1,261 @@
+/*
+ * CPClient
+ *
+ * Copyright (C) 2011 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+/*!
+ * @file <stress-context.c>
+ *
+ * @brief Main file for cpc-stress-context.  Parses the example OMA CP
+ *        documents from several threads at once and checks that every
+ *        thread generates the same settings as a parse made before any of
+ *        the threads were started.
+ *
+ ******************************************************************************/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libxml/parser.h>
+
+#include "error.h"
+#include "error-macros.h"
+#include "context.h"
+#include "settings.h"
+
+#define CPC_STRESS_DEFAULT_THREADS 8
+#define CPC_STRESS_DEFAULT_ITERATIONS 20
+
+typedef struct cpc_stress_doc_t_ cpc_stress_doc_t;
+struct cpc_stress_doc_t_ {
+	gchar *path;
+	gchar *data;
+	gsize length;
+	int result;
+	GVariant *settings;
+};
+
+static gint g_threads = CPC_STRESS_DEFAULT_THREADS;
+static gint g_iterations = CPC_STRESS_DEFAULT_ITERATIONS;
+static GPtrArray *g_docs;
+static gint g_mismatches;
+
+static GOptionEntry g_options[] = {
+	{ "threads", 't', 0, G_OPTION_ARG_INT, &g_threads,
+	  "Number of threads parsing at once (default: 8)", "N" },
+	{ "iterations", 'i', 0, G_OPTION_ARG_INT, &g_iterations,
+	  "Number of times each thread parses each document (default: 20)",
+	  "N" },
+	{ NULL }
+};
+
+static int prv_parse(const cpc_stress_doc_t *doc, GVariant **packed)
+{
+	CPC_ERR_MANAGE;
+	cpc_context_t *context = NULL;
+	cpc_settings_t settings;
+
+	if (doc->length > INT_MAX)
+		CPC_FAIL_FORCE(CPC_ERR_CORRUPT);
+
+	CPC_FAIL(cpc_context_new(doc->data, (int) doc->length, CPC_TYPE_ALL,
+				 &context));
+
+	cpc_settings_init(&settings, context);
+	*packed = cpc_settings_pack(&settings);
+
+CPC_ON_ERR:
+
+	cpc_context_delete(context);
+
+	return CPC_ERR;
+}
+
+/*
+ * Each thread starts at a different document so that different documents
+ * are being parsed at the same time.
+ */
+
+static gpointer prv_stress(gpointer data)
+{
+	unsigned int first = GPOINTER_TO_UINT(data);
+	cpc_stress_doc_t *doc;
+	GVariant *packed;
+	int result;
+	gint i;
+	unsigned int j;
+
+	for (i = 0; i < g_iterations; ++i) {
+		for (j = 0; j < g_docs->len; ++j) {
+			doc = g_ptr_array_index(g_docs,
+						(first + j) % g_docs->len);
+			packed = NULL;
+			result = prv_parse(doc, &packed);
+			if (result != doc->result ||
+			    (packed && !g_variant_equal(packed,
+							doc->settings))) {
+				fprintf(stderr, "%s: thread %u got %d, "
+					"expected %d\n", doc->path, first,
+					result, doc->result);
+				g_atomic_int_inc(&g_mismatches);
+			}
+			if (packed)
+				g_variant_unref(packed);
+		}
+	}
+
+	return NULL;
+}
+
+static void prv_doc_free(gpointer data)
+{
+	cpc_stress_doc_t *doc = data;
+
+	if (doc->settings)
+		g_variant_unref(doc->settings);
+	g_free(doc->data);
+	g_free(doc->path);
+	g_free(doc);
+}
+
+static gint prv_compare_paths(gconstpointer a, gconstpointer b)
+{
+	const cpc_stress_doc_t *doc_a = *(cpc_stress_doc_t *const *) a;
+	const cpc_stress_doc_t *doc_b = *(cpc_stress_doc_t *const *) b;
+
+	return strcmp(doc_a->path, doc_b->path);
+}
+
+static int prv_load_docs(const gchar *dirname)
+{
+	CPC_ERR_MANAGE;
+	GDir *dir;
+	const gchar *name;
+	cpc_stress_doc_t *doc;
+
+	CPC_FAIL_NULL(dir, g_dir_open(dirname, 0, NULL), CPC_ERR_OPEN);
+
+	while ((name = g_dir_read_name(dir))) {
+		if (!g_str_has_suffix(name, ".xml"))
+			continue;
+		doc = g_new0(cpc_stress_doc_t, 1);
+		doc->path = g_build_filename(dirname, name, NULL);
+		g_ptr_array_add(g_docs, doc);
+		if (!g_file_get_contents(doc->path, &doc->data, &doc->length,
+					 NULL)) {
+			fprintf(stderr, "Unable to read %s\n", doc->path);
+			CPC_ERR = CPC_ERR_READ;
+			break;
+		}
+	}
+	g_dir_close(dir);
+
+	g_ptr_array_sort(g_docs, prv_compare_paths);
+
+CPC_ON_ERR:
+
+	return CPC_ERR;
+}
+
+int main(int argc, char *argv[])
+{
+	CPC_ERR_MANAGE;
+	GOptionContext *option_context;
+	GError *error = NULL;
+	GThread **threads = NULL;
+	cpc_stress_doc_t *doc;
+	const gchar *dirname = CPC_EXAMPLES_DIR;
+	unsigned int i;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	g_thread_init(NULL);
+#endif
+	xmlInitParser();
+
+	option_context = g_option_context_new("[DIR] - parse the OMA CP "
+					      "documents in DIR concurrently");
+	g_option_context_add_main_entries(option_context, g_options, NULL);
+	if (!g_option_context_parse(option_context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(option_context);
+		return 2;
+	}
+	g_option_context_free(option_context);
+
+	if (argc > 2 || g_threads <= 0 || g_iterations <= 0) {
+		fprintf(stderr, "Invalid arguments.  See --help.\n");
+		return 2;
+	}
+
+	if (argc == 2)
+		dirname = argv[1];
+
+	g_docs = g_ptr_array_new_with_free_func(prv_doc_free);
+	CPC_FAIL(prv_load_docs(dirname));
+	if (g_docs->len == 0) {
+		fprintf(stderr, "No documents found in %s\n", dirname);
+		CPC_FAIL_FORCE(CPC_ERR_OPEN);
+	}
+
+	for (i = 0; i < g_docs->len; ++i) {
+		doc = g_ptr_array_index(g_docs, i);
+		doc->result = prv_parse(doc, &doc->settings);
+	}
+
+	threads = g_new0(GThread *, g_threads);
+	for (i = 0; i < (unsigned int) g_threads; ++i) {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+		threads[i] = g_thread_new("stress", prv_stress,
+					  GUINT_TO_POINTER(i));
+#else
+		threads[i] = g_thread_create(prv_stress, GUINT_TO_POINTER(i),
+					     TRUE, NULL);
+#endif
+		if (!threads[i]) {
+			fprintf(stderr, "Unable to create thread %u\n", i);
+			CPC_ERR = CPC_ERR_OOM;
+			break;
+		}
+	}
+
+	for (i = 0; i < (unsigned int) g_threads && threads[i]; ++i)
+		(void) g_thread_join(threads[i]);
+	CPC_FAIL(CPC_ERR);
+
+	printf("Parsed %u documents %d times from %d threads, %d mismatches\n",
+	       g_docs->len, g_iterations, g_threads, g_mismatches);
+
+	if (g_mismatches > 0)
+		CPC_ERR = CPC_ERR_CORRUPT;
+
+CPC_ON_ERR:
+
+	g_free(threads);
+	if (g_docs)
+		g_ptr_array_unref(g_docs);
+
+	return CPC_ERR == CPC_ERR_NONE ? 0 : 1;
+}
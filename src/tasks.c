@@ -29,7 +29,9 @@
 
 #include "config.h"
 
+#include <string.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include <glib.h>
 
@@ -48,12 +50,39 @@ struct cpc_task_data_t_ {
 	void *finished_data;
 };
 
+typedef struct cpc_create_pms_data_t_ cpc_create_pms_data_t;
+
+typedef struct cpc_create_pms_item_t_ cpc_create_pms_item_t;
+struct cpc_create_pms_item_t_ {
+	cpc_create_pms_data_t *batch;
+	gchar *path;
+	bool created;
+};
+
+struct cpc_create_pms_data_t_ {
+	GDBusMethodInvocation *invocation;
+	cpc_cb_t finished;
+	void *finished_data;
+	cpc_pm_manager_t *pm_manager;
+	gchar *client_name;
+	cpc_create_pms_item_t *items;
+	unsigned int count;
+	unsigned int outstanding;
+	int result;
+};
+
 void cpc_task_free(cpc_task_t *task)
 {
 	if (task) {
 		g_free(task->path);
 		g_free(task->pin);
 		g_free(task->wp_message);
+		if (task->messages)
+			g_variant_unref(task->messages);
+		g_strfreev(task->files);
+		if ((task->type == CPC_TASK_PARSECP_FD ||
+		     task->type == CPC_TASK_CREATE_PM_FD) && task->fd != -1)
+			close(task->fd);
 		if (task->invocation)
 			g_dbus_method_invocation_return_error(
 				task->invocation, G_IO_ERROR,
@@ -97,8 +126,23 @@ bool cpc_tasks_parsecp(cpc_task_t *task, cpc_cb_t finished,
 	CPC_LOGF("Starting ParseCP task");
 	syslog(LOG_INFO, "Starting ParseCP task");
 
-	CPC_FAIL(cpc_provision_cp_apply(task->path, prv_task_finished,
-					callback_data, handle));
+	if (task->type == CPC_TASK_PARSECP_FD) {
+		CPC_ERR = cpc_provision_cp_apply_fd(task->fd, prv_task_finished,
+						    callback_data, handle);
+		task->fd = -1;
+		CPC_FAIL(CPC_ERR);
+	} else if (task->type == CPC_TASK_PARSECP_DIR) {
+		CPC_FAIL(cpc_provision_cp_apply_dir(task->path,
+						    prv_task_finished,
+						    callback_data, handle));
+	} else if (task->type == CPC_TASK_PARSECP_FILES) {
+		CPC_FAIL(cpc_provision_cp_apply_files(
+				 (const gchar *const *) task->files,
+				 prv_task_finished, callback_data, handle));
+	} else {
+		CPC_FAIL(cpc_provision_cp_apply(task->path, prv_task_finished,
+						callback_data, handle));
+	}
 
 	task->invocation = NULL;
 
@@ -119,114 +163,264 @@ void cpc_tasks_parsecp_cancel(cpc_tasks_handle_t handle)
 	cpc_provision_cp_apply_cancel(handle);
 }
 
-void cpc_tasks_create_pm(cpc_task_t *task, cpc_pm_manager_t *pm_manager)
+static void prv_create_pm_finished(int result, const gchar *path,
+				   bool created, void *user_data)
 {
-	CPC_ERR_MANAGE;
-	gchar *path;
+	cpc_task_data_t *callback_data = user_data;
+
+	if (result == CPC_ERR_NONE) {
+		CPC_LOGF("New Push Message object created %s", path);
+		syslog(LOG_INFO, "New Push Message object created %s", path);
+
+		g_dbus_method_invocation_return_value(
+			callback_data->invocation, g_variant_new("(o)", path));
+	} else {
+		CPC_LOGF("Failed to create Push Message object");
+		syslog(LOG_INFO, "Failed to create Push Message object");
+
+		g_dbus_method_invocation_return_dbus_error(
+			callback_data->invocation, cpc_dbus_error_map(result),
+			"");
+	}
+
+	callback_data->finished(result, callback_data->finished_data);
+
+	g_free(callback_data);
+}
+
+void cpc_tasks_create_pm(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
+			 cpc_cb_t finished, void *finished_data)
+{
+	cpc_task_data_t *callback_data;
 	GDBusConnection *connection =
 		g_dbus_method_invocation_get_connection(task->invocation);
 	const gchar *client_name =
 		g_dbus_method_invocation_get_sender(task->invocation);
 
-	CPC_FAIL(cpc_pm_manager_new_message(pm_manager,
-						 client_name,
-						 connection,
-						 task->wp_message,
-						 task->wp_message_len,
-						 &path));
+	callback_data = g_new(cpc_task_data_t, 1);
+	callback_data->finished = finished;
+	callback_data->finished_data = finished_data;
+	callback_data->invocation = task->invocation;
 
-	CPC_LOGF("New Push Message object created %s", path);
-	syslog(LOG_INFO, "New Push Message object created %s", path);
+	CPC_LOGF("Queuing WP message for parsing");
+
+	if (task->type == CPC_TASK_CREATE_PM_FD) {
+		cpc_pm_manager_new_message_fd(pm_manager, client_name,
+					      connection, task->fd,
+					      prv_create_pm_finished,
+					      callback_data);
+		task->fd = -1;
+	} else {
+		cpc_pm_manager_new_message(pm_manager, client_name, connection,
+					   task->wp_message,
+					   task->wp_message_len,
+					   prv_create_pm_finished,
+					   callback_data);
+	}
 
-	g_dbus_method_invocation_return_value(
-		task->invocation, g_variant_new("(o)", path));
-	g_free(path);
+	task->wp_message = NULL;
 	task->invocation = NULL;
-	return;
+}
 
-CPC_ON_ERR:
+static void prv_create_pms_complete(cpc_create_pms_data_t *batch)
+{
+	GVariantBuilder vb;
+	unsigned int i;
+
+	for (i = 0; i < batch->count; ++i)
+		if (batch->items[i].path)
+			cpc_pm_manager_unpin_message(batch->pm_manager,
+						     batch->items[i].path);
+
+	if (batch->result == CPC_ERR_NONE) {
+		CPC_LOGF("%u Push Message objects created", batch->count);
+		syslog(LOG_INFO, "%u Push Message objects created",
+		       batch->count);
+
+		g_variant_builder_init(&vb, G_VARIANT_TYPE("ao"));
+		for (i = 0; i < batch->count; ++i)
+			g_variant_builder_add(&vb, "o", batch->items[i].path);
+		g_dbus_method_invocation_return_value(
+			batch->invocation,
+			g_variant_new("(@ao)", g_variant_builder_end(&vb)));
+	} else {
+		CPC_LOGF("Failed to create Push Message objects");
+		syslog(LOG_INFO, "Failed to create Push Message objects");
+
+		for (i = 0; i < batch->count; ++i)
+			if (batch->items[i].created)
+				(void) cpc_pm_manager_remove_message(
+					batch->pm_manager,
+					batch->items[i].path,
+					batch->client_name);
+		g_dbus_method_invocation_return_dbus_error(
+			batch->invocation, cpc_dbus_error_map(batch->result),
+			"");
+	}
 
-	CPC_LOGF("Failed to create Push Message object");
-	syslog(LOG_INFO, "Failed to create Push Message object");
+	batch->finished(batch->result, batch->finished_data);
+
+	for (i = 0; i < batch->count; ++i)
+		g_free(batch->items[i].path);
+	g_free(batch->items);
+	g_free(batch->client_name);
+	g_free(batch);
+}
+
+static void prv_create_pms_finished(int result, const gchar *path,
+				    bool created, void *user_data)
+{
+	cpc_create_pms_item_t *item = user_data;
+	cpc_create_pms_data_t *batch = item->batch;
+
+	if (result == CPC_ERR_NONE)
+		result = cpc_pm_manager_pin_message(batch->pm_manager, path);
+
+	if (result == CPC_ERR_NONE) {
+		item->path = g_strdup(path);
+		item->created = created;
+	} else if (batch->result == CPC_ERR_NONE)
+		batch->result = result;
+
+	if (--batch->outstanding == 0)
+		prv_create_pms_complete(batch);
+}
+
+/*
+ * The messages are parsed in parallel.  The call only succeeds if every
+ * one of them is valid, in which case the object paths are returned in the
+ * order of the messages.  Otherwise the objects that this call created are
+ * removed again.  Existing objects returned for duplicate messages are
+ * left alone.  The objects are pinned until the call completes, so that
+ * the later messages of a batch cannot evict the earlier ones.  A batch
+ * that does not fit within the limits on push messages fails with
+ * CPC_ERR_QUOTA instead.
+ */
+
+void cpc_tasks_create_pms(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
+			  cpc_cb_t finished, void *finished_data)
+{
+	cpc_create_pms_data_t *batch;
+	GDBusConnection *connection =
+		g_dbus_method_invocation_get_connection(task->invocation);
+	const gchar *client_name =
+		g_dbus_method_invocation_get_sender(task->invocation);
+	GVariant *message;
+	const uint8_t *data;
+	uint8_t *copy;
+	gsize length;
+	unsigned int i;
+
+	batch = g_new0(cpc_create_pms_data_t, 1);
+	batch->invocation = task->invocation;
+	batch->finished = finished;
+	batch->finished_data = finished_data;
+	batch->pm_manager = pm_manager;
+	batch->client_name = g_strdup(client_name);
+	batch->count = g_variant_n_children(task->messages);
+	batch->outstanding = batch->count;
+	batch->items = g_new0(cpc_create_pms_item_t, batch->count);
 
-	g_dbus_method_invocation_return_dbus_error(
-		task->invocation, cpc_dbus_error_map(CPC_ERR), "");
 	task->invocation = NULL;
+
+	CPC_LOGF("Queuing %u WP messages for parsing", batch->count);
+
+	if (batch->count == 0) {
+		prv_create_pms_complete(batch);
+		return;
+	}
+
+	for (i = 0; i < batch->count; ++i) {
+		batch->items[i].batch = batch;
+		message = g_variant_get_child_value(task->messages, i);
+		data = g_variant_get_fixed_array(message, &length,
+						 sizeof(uint8_t));
+		copy = g_new(uint8_t, length);
+		memcpy(copy, data, length);
+		cpc_pm_manager_new_message(pm_manager, client_name, connection,
+					   copy, length,
+					   prv_create_pms_finished,
+					   &batch->items[i]);
+		g_variant_unref(message);
+	}
 }
 
-void cpc_tasks_close_pm(cpc_task_t *task, cpc_pm_manager_t *pm_manager)
+void cpc_tasks_close_pm(GDBusMethodInvocation *invocation,
+			cpc_pm_manager_t *pm_manager, const gchar *path)
 {
 	CPC_ERR_MANAGE;
 	const gchar *client_name =
-		g_dbus_method_invocation_get_sender(task->invocation);
+		g_dbus_method_invocation_get_sender(invocation);
 
-	CPC_FAIL(cpc_pm_manager_remove_message(pm_manager, task->path,
-					       client_name));
+	CPC_FAIL(cpc_pm_manager_remove_message(pm_manager, path, client_name));
 
-	CPC_LOGF("Push Message object %s removed", task->path);
-	syslog(LOG_INFO, "Push Message object %s removed", task->path);
+	CPC_LOGF("Push Message object %s removed", path);
+	syslog(LOG_INFO, "Push Message object %s removed", path);
 
-	g_dbus_method_invocation_return_value(task->invocation, NULL);
-	task->invocation = NULL;
+	g_dbus_method_invocation_return_value(invocation, NULL);
 	return;
 
 CPC_ON_ERR:
-	CPC_LOGF("Failed to remove Push Message Object %s", task->path);
-	syslog(LOG_INFO, "Failed to remove Push Message Object %s", task->path);
+	CPC_LOGF("Failed to remove Push Message Object %s", path);
+	syslog(LOG_INFO, "Failed to remove Push Message Object %s", path);
 
 	g_dbus_method_invocation_return_dbus_error(
-		task->invocation, cpc_dbus_error_map(CPC_ERR), "");
-	task->invocation = NULL;
+		invocation, cpc_dbus_error_map(CPC_ERR), "");
+}
+
+static GVariant *prv_props_variant(cpc_props_t *props)
+{
+	GVariantBuilder vb;
+	const gchar *pin_required_str = props->pin_required ? "Yes" : "No";
+
+	CPC_LOGF("Pin Required %s", pin_required_str);
+	CPC_LOGF("Settings %s", props->settings);
+	CPC_LOGF("Sec Type %s", props->sec_type);
+	CPC_LOGF("Start Sessions with %s", props->start_sessions);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{ss}"));
+	g_variant_builder_add(&vb, "{ss}", "PinRequired", pin_required_str);
+	g_variant_builder_add(&vb, "{ss}", "Settings", props->settings);
+	g_variant_builder_add(&vb, "{ss}", "SecType", props->sec_type);
+	g_variant_builder_add(&vb, "{ss}", "StartSessionsWith",
+			      props->start_sessions);
+
+	return g_variant_builder_end(&vb);
 }
 
-void cpc_tasks_get_props(cpc_task_t *task, cpc_pm_manager_t *pm_manager)
+void cpc_tasks_get_props(GDBusMethodInvocation *invocation,
+			 cpc_pm_manager_t *pm_manager, const gchar *path)
 {
 	CPC_ERR_MANAGE;
-	GVariantBuilder *vb;
-	const gchar *pin_required_str;
+	GVariant *dict;
 	cpc_props_t props;
 	const gchar *client_name =
-		g_dbus_method_invocation_get_sender(task->invocation);
+		g_dbus_method_invocation_get_sender(invocation);
 
-	CPC_FAIL(cpc_pm_manager_get_properties(pm_manager, task->path,
-					       client_name, &props));
+	CPC_FAIL(cpc_pm_manager_get_properties(pm_manager, path, client_name,
+					       &props));
 
-	pin_required_str = props.pin_required ? "Yes" : "No";
-
-	CPC_LOGF("Pin Required %s", pin_required_str);
-	CPC_LOGF("Settings %s", props.settings);
-	CPC_LOGF("Sec Type %s", props.sec_type);
-	CPC_LOGF("Start Sessions with %s", props.start_sessions);
+	dict = prv_props_variant(&props);
 
 	syslog(LOG_INFO, "GetProps (%s, %s, %s %s) succeeded.",
-	       pin_required_str, props.settings, props.sec_type,
-	       props.start_sessions);
-
-	vb = g_variant_builder_new(G_VARIANT_TYPE("a{ss}"));
-	g_variant_builder_add(vb, "{ss}", "PinRequired", pin_required_str);
-	g_variant_builder_add(vb, "{ss}", "Settings", props.settings);
-	g_variant_builder_add(vb, "{ss}", "SecType", props.sec_type);
-	g_variant_builder_add(vb, "{ss}", "StartSessionsWith",
-			      props.start_sessions);
+	       props.pin_required ? "Yes" : "No", props.settings,
+	       props.sec_type, props.start_sessions);
+
 	cpc_props_free(&props);
 
 	g_dbus_method_invocation_return_value(
-		task->invocation, g_variant_new("(@a{ss})",
-						g_variant_builder_end(vb)));
-	g_variant_builder_unref(vb);
-	task->invocation = NULL;
+		invocation, g_variant_new("(@a{ss})", dict));
 	return;
 
 CPC_ON_ERR:
 
-	CPC_LOGF("Failed to retrieve properties for %s err %u", task->path,
+	CPC_LOGF("Failed to retrieve properties for %s err %u", path,
 		 CPC_ERR);
 	syslog(LOG_INFO, "Failed to retrieve properties for %s err %u",
-	       task->path, CPC_ERR);
+	       path, CPC_ERR);
 
 	g_dbus_method_invocation_return_dbus_error(
-		task->invocation, cpc_dbus_error_map(CPC_ERR), "");
-	task->invocation = NULL;
+		invocation, cpc_dbus_error_map(CPC_ERR), "");
 }
 
 bool cpc_tasks_apply(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
@@ -269,10 +463,101 @@ void cpc_tasks_apply_cancel(cpc_pm_manager_t *pm_manager,
 	cpc_pm_manager_apply_cancel(pm_manager, handle);
 }
 
-void cpc_tasks_get_version(cpc_task_t *task)
+static void prv_create_and_apply_finished(int result, cpc_props_t *props,
+					  void *user_data)
+{
+	cpc_task_data_t *callback_data = user_data;
+
+	if (result == CPC_ERR_NONE)
+		g_dbus_method_invocation_return_value(
+			callback_data->invocation,
+			g_variant_new("(@a{ss})", prv_props_variant(props)));
+	else
+		g_dbus_method_invocation_return_dbus_error(
+			callback_data->invocation,
+			cpc_dbus_error_map(result), "");
+
+	CPC_LOGF("CreateAndApply task finished with err %u", result);
+	syslog(LOG_INFO, "CreateAndApply task finished with err %u", result);
+
+	callback_data->finished(result, callback_data->finished_data);
+
+	g_free(callback_data);
+}
+
+void cpc_tasks_create_and_apply(cpc_task_t *task,
+				cpc_pm_manager_t *pm_manager,
+				cpc_cb_t finished, void *finished_data,
+				cpc_tasks_handle_t *handle)
+{
+	cpc_task_data_t *callback_data;
+	GDBusConnection *connection =
+		g_dbus_method_invocation_get_connection(task->invocation);
+	const gchar *client_name =
+		g_dbus_method_invocation_get_sender(task->invocation);
+
+	callback_data = g_new(cpc_task_data_t, 1);
+	callback_data->finished = finished;
+	callback_data->finished_data = finished_data;
+	callback_data->invocation = task->invocation;
+
+	CPC_LOGF("Starting CreateAndApply task");
+	syslog(LOG_INFO, "Starting CreateAndApply task");
+
+	cpc_pm_manager_create_and_apply(pm_manager, client_name, connection,
+					task->wp_message, task->wp_message_len,
+					task->pin,
+					prv_create_and_apply_finished,
+					callback_data, handle);
+
+	task->wp_message = NULL;
+	task->invocation = NULL;
+}
+
+void cpc_tasks_create_and_apply_cancel(cpc_pm_manager_t *pm_manager,
+				       cpc_tasks_handle_t handle)
+{
+	cpc_pm_manager_create_and_apply_cancel(pm_manager, handle);
+}
+
+void cpc_tasks_get_version(GDBusMethodInvocation *invocation)
 {
 	CPC_LOGF("Get CPClient Version %s", VERSION);
-	g_dbus_method_invocation_return_value(task->invocation,
+	g_dbus_method_invocation_return_value(invocation,
 					      g_variant_new("(s)", VERSION));
-	task->invocation = NULL;
+}
+
+void cpc_tasks_get_usage(GDBusMethodInvocation *invocation,
+			 cpc_pm_manager_t *pm_manager)
+{
+	GVariantBuilder vb;
+	cpc_pm_usage_t total;
+	cpc_pm_usage_t client;
+	const gchar *client_name =
+		g_dbus_method_invocation_get_sender(invocation);
+
+	cpc_pm_manager_get_usage(pm_manager, client_name, &total, &client);
+
+	CPC_LOGF("Usage %zu bytes in %u objects, %s %zu bytes in %u objects",
+		 total.bytes, total.objects, client_name, client.bytes,
+		 client.objects);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{st}"));
+	g_variant_builder_add(&vb, "{st}", "Bytes", (guint64) total.bytes);
+	g_variant_builder_add(&vb, "{st}", "Objects", (guint64) total.objects);
+	g_variant_builder_add(&vb, "{st}", "ClientBytes",
+			      (guint64) client.bytes);
+	g_variant_builder_add(&vb, "{st}", "ClientObjects",
+			      (guint64) client.objects);
+	g_variant_builder_add(&vb, "{st}", "MaxBytes",
+			      (guint64) CPC_MAX_PM_BYTES);
+	g_variant_builder_add(&vb, "{st}", "MaxObjects",
+			      (guint64) CPC_MAX_MESSAGES);
+	g_variant_builder_add(&vb, "{st}", "MaxClientBytes",
+			      (guint64) CPC_MAX_CLIENT_PM_BYTES);
+	g_variant_builder_add(&vb, "{st}", "MaxClientObjects",
+			      (guint64) CPC_MAX_CLIENT_MESSAGES);
+
+	g_dbus_method_invocation_return_value(
+		invocation, g_variant_new("(a{st})", &vb));
 }
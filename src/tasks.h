@@ -41,10 +41,15 @@
 enum cpc_task_type_t_ {
 	CPC_TASK_PARSECP,
 	CPC_TASK_CREATE_PM,
-	CPC_TASK_GET_VERSION,
 	CPC_TASK_CLOSE_PM,
 	CPC_TASK_GET_PROPS,
-	CPC_TASK_APPLY
+	CPC_TASK_APPLY,
+	CPC_TASK_CREATE_PMS,
+	CPC_TASK_CREATE_AND_APPLY,
+	CPC_TASK_PARSECP_FD,
+	CPC_TASK_CREATE_PM_FD,
+	CPC_TASK_PARSECP_DIR,
+	CPC_TASK_PARSECP_FILES
 };
 
 typedef enum cpc_task_type_t_ cpc_task_type_t;
@@ -57,6 +62,9 @@ struct cpc_task_t_ {
 	gchar *pin;
 	uint8_t *wp_message;
 	unsigned int wp_message_len;
+	GVariant *messages;
+	int fd;
+	gchar **files;
 };
 
 typedef void *cpc_tasks_handle_t;
@@ -71,11 +79,17 @@ bool cpc_tasks_parsecp(cpc_task_t *task, cpc_cb_t finished,
 
 void cpc_tasks_parsecp_cancel(cpc_tasks_handle_t handle);
 
-void cpc_tasks_create_pm(cpc_task_t *task, cpc_pm_manager_t *pm_manager);
+void cpc_tasks_create_pm(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
+			 cpc_cb_t finished, void *finished_data);
 
-void cpc_tasks_close_pm(cpc_task_t *task, cpc_pm_manager_t *pm_manager);
+void cpc_tasks_create_pms(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
+			  cpc_cb_t finished, void *finished_data);
 
-void cpc_tasks_get_props(cpc_task_t *task, cpc_pm_manager_t *pm_manager);
+void cpc_tasks_close_pm(GDBusMethodInvocation *invocation,
+			cpc_pm_manager_t *pm_manager, const gchar *path);
+
+void cpc_tasks_get_props(GDBusMethodInvocation *invocation,
+			 cpc_pm_manager_t *pm_manager, const gchar *path);
 
 bool cpc_tasks_apply(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
 		     cpc_cb_t finished, void *finished_data,
@@ -84,7 +98,18 @@ bool cpc_tasks_apply(cpc_task_t *task, cpc_pm_manager_t *pm_manager,
 void cpc_tasks_apply_cancel(cpc_pm_manager_t *pm_manager,
 			    cpc_tasks_handle_t handle);
 
-void cpc_tasks_get_version(cpc_task_t *task);
+void cpc_tasks_create_and_apply(cpc_task_t *task,
+				cpc_pm_manager_t *pm_manager,
+				cpc_cb_t finished, void *finished_data,
+				cpc_tasks_handle_t *handle);
+
+void cpc_tasks_create_and_apply_cancel(cpc_pm_manager_t *pm_manager,
+				       cpc_tasks_handle_t handle);
+
+void cpc_tasks_get_version(GDBusMethodInvocation *invocation);
+
+void cpc_tasks_get_usage(GDBusMethodInvocation *invocation,
+			 cpc_pm_manager_t *pm_manager);
 
 
 #endif